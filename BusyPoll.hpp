@@ -0,0 +1,101 @@
+//
+// Created by Florian Damiot on 19/10/2026.
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <sys/socket.h>
+
+// Added in Linux 5.11, missing from older headers
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+
+/**
+ * @brief Low latency mode of the network loops: instead of sleeping in the kernel
+ * until a packet arrives, the loops keep polling without blocking, trading a CPU for latency.
+ */
+struct BusyPollConfig {
+    bool enabled = false;
+    // Go back to blocking waits once nothing was received for this long
+    std::chrono::microseconds idleBeforeBlocking{2000};
+    // SO_BUSY_POLL on the sockets, in microseconds, 0 to leave it unset
+    // (values above net.core.busy_read need CAP_NET_ADMIN)
+    int socketBusyPollUs = 0;
+    // SO_PREFER_BUSY_POLL on the sockets, the driver then leaves the queue to the polling thread
+    bool preferBusyPoll = false;
+};
+
+/**
+ * @brief Set the busy poll options of a socket.
+ * @return false if the kernel refused one of them, the loops still spin without them.
+ */
+inline bool applyBusyPollOptions(const int &socket, const BusyPollConfig &config)
+{
+    bool applied = true;
+
+    if (!config.enabled)
+        return true;
+    if (config.socketBusyPollUs > 0)
+        applied &= setsockopt(socket, SOL_SOCKET, SO_BUSY_POLL,
+                              &config.socketBusyPollUs, sizeof(config.socketBusyPollUs)) == 0;
+    if (config.preferBusyPoll) {
+        const int prefer = 1;
+        applied &= setsockopt(socket, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer)) == 0;
+    }
+    return applied;
+}
+
+/**
+ * @brief Decide whether a loop spins or blocks: it spins while packets keep coming,
+ * and falls back to blocking after BusyPollConfig::idleBeforeBlocking without any.
+ * The next packet received, even through a blocking wait, makes it spin again.
+ */
+class BusyPollBackoff {
+    public:
+        explicit BusyPollBackoff(const BusyPollConfig &config = {}) : _config(config), _spinning(config.enabled)
+        {
+
+        }
+
+        bool spinning() const
+        {
+            return _spinning;
+        }
+
+        /**
+         * @brief Something was received.
+         */
+        void activity()
+        {
+            _spinning = _config.enabled;
+            _idlePolls = 0;
+        }
+
+        /**
+         * @brief A poll found nothing.
+         */
+        void idle()
+        {
+            if (!_spinning)
+                return;
+            if (_idlePolls++ == 0) {
+                _idleSince = std::chrono::steady_clock::now();
+                return;
+            }
+            // Reading the clock costs more than a poll, only check it from time to time
+            if ((_idlePolls & 63) == 0 && std::chrono::steady_clock::now() - _idleSince >= _config.idleBeforeBlocking)
+                _spinning = false;
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+
+    private:
+        BusyPollConfig _config;
+        bool _spinning;
+        uint64_t _idlePolls = 0;
+        std::chrono::steady_clock::time_point _idleSince;
+};
@@ -0,0 +1,135 @@
+//
+// Created by Florian Damiot on 19/10/2026.
+//
+
+#pragma once
+
+#include "./NetworkUtils.hpp"
+#include "./PacketBufferPool.hpp"
+#include "./SessionResume.hpp"
+#include "./ClockSync.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Flags of ClientTable::Hot
+#define CLIENT_FLAG_OUTPUT_PENDING 0x1
+
+// Interest mask matching every broadcast
+#define CLIENT_INTEREST_ALL 0xFFFFFFFFu
+
+/**
+ * @brief Table of the connected clients stored as two parallel arrays.
+ *
+ * The state read for every client of a broadcast (socket, output queue head, flags, interest mask)
+ * is packed in the hot array, four clients per cache line, while the metadata and the buffers
+ * live at the same index in the cold array and are only touched when needed.
+ * Removing a client moves the last one in its place, so indices are only stable
+ * until the next insert or erase.
+ */
+class ClientTable {
+    public:
+        struct Hot {
+            int socket = -1;
+            // Offset of the next byte of the output buffer to write
+            uint32_t outputOffset = 0;
+            uint32_t flags = 0;
+            uint32_t interestMask = CLIENT_INTEREST_ALL;
+        };
+
+        struct Cold {
+            NetClient client;
+            // Borrowed from the pool only while a packet is partially read
+            PacketBuffer input;
+            // Borrowed from the pool only while bytes wait for the socket
+            PacketBuffer output;
+            // Last time the socket was readable, for the idle timeout
+            std::chrono::steady_clock::time_point lastReceive{};
+            // Heartbeat timer of the event loop, 0 if keepalive is disabled
+            uint64_t keepAliveTimer = 0;
+            // Token the client sends over UDP to bind its endpoint, 0 if none
+            uint64_t udpBindToken = 0;
+            // Resumable session, token 0 if session resumption is disabled
+            ClientSession session;
+            // RTT and clock offset, measured once the client bound its UDP endpoint
+            ClientClock clock;
+        };
+
+        ClientTable() = default;
+
+        /**
+         * @brief Add a client at the end of the table.
+         * @return The index of the client.
+         */
+        uint32_t insert(NetClient client)
+        {
+            const auto index = static_cast<uint32_t>(_hot.size());
+            Hot hot;
+            hot.socket = client.socket;
+            _hot.push_back(hot);
+            Cold cold;
+            cold.client = std::move(client);
+            _cold.push_back(std::move(cold));
+            _indices[_hot[index].socket] = index;
+            return index;
+        }
+
+        /**
+         * @brief Remove a client, the last client takes its index.
+         * @param socket The socket of the client.
+         * @param removed Receive the state of the removed client.
+         * @return false if no client uses this socket.
+         */
+        bool erase(const int &socket, Cold &removed)
+        {
+            auto it = _indices.find(socket);
+            if (it == _indices.end())
+                return false;
+            const uint32_t index = it->second;
+            const auto last = static_cast<uint32_t>(_hot.size() - 1);
+            _indices.erase(it);
+            removed = std::move(_cold[index]);
+            if (index != last) {
+                _hot[index] = _hot[last];
+                _cold[index] = std::move(_cold[last]);
+                _indices[_hot[index].socket] = index;
+            }
+            _hot.pop_back();
+            _cold.pop_back();
+            return true;
+        }
+
+        /**
+         * @brief Find the index of a client.
+         * @return The index, or -1 if no client uses this socket.
+         */
+        int64_t find(const int &socket) const
+        {
+            auto it = _indices.find(socket);
+            // Both branches as int64_t, a uint32_t one would turn -1 into UINT32_MAX
+            return it == _indices.end() ? static_cast<int64_t>(-1) : static_cast<int64_t>(it->second);
+        }
+
+        Hot &hot(const uint32_t &index) { return _hot[index]; }
+        Cold &cold(const uint32_t &index) { return _cold[index]; }
+
+        std::span<Hot> hot() { return _hot; }
+
+        size_t size() const { return _hot.size(); }
+
+        void clear()
+        {
+            _hot.clear();
+            _cold.clear();
+            _indices.clear();
+        }
+
+    private:
+        std::vector<Hot> _hot;
+        std::vector<Cold> _cold;
+        std::unordered_map<int, uint32_t> _indices;
+};
@@ -0,0 +1,170 @@
+//
+// Created by Florian Damiot on 19/10/2026.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+/**
+ * @brief Round trip time and clock offset of every client, measured over UDP.
+ *
+ * The server pings each client with a bound UDP endpoint on a regular interval, the client answers
+ * right away, and the four timestamps give one sample as NTP does:
+ * t0 server send, t1 client receive, t2 client send, t3 server receive,
+ * rtt = (t3 - t0) - (t2 - t1) and offset = ((t1 - t0) + (t2 - t3)) / 2.
+ * All the times are steady clock nanoseconds of the machine taking them.
+ */
+struct ClockSyncConfig {
+    bool enabled = false;
+    // Time between two pings of the same client
+    std::chrono::milliseconds interval{1000};
+    // Length of the server tick, see ServerClock
+    std::chrono::nanoseconds tick = std::chrono::nanoseconds(1000000000 / 60);
+};
+
+/**
+ * @brief CLOCK_SYNC_PACKET_ID from the server. Carries what the server measured, so the client
+ * knows its RTT and the server clock too.
+ */
+struct ClockPing {
+    uint32_t socket = 0;
+    uint32_t unused = 0;
+    uint64_t serverSendNs = 0;
+    // Estimates of the server for this client, 0 until the first answer
+    uint64_t smoothedRttNs = 0;
+    int64_t offsetNs = 0;
+    // Server time of tick 0 and tick length, see ServerClock
+    uint64_t epochNs = 0;
+    uint64_t tickNs = 0;
+};
+
+/**
+ * @brief CLOCK_SYNC_PACKET_ID from the client, the answer to a ClockPing.
+ */
+struct ClockPong {
+    uint32_t socket = 0;
+    uint32_t unused = 0;
+    uint64_t serverSendNs = 0;
+    uint64_t clientReceiveNs = 0;
+    uint64_t clientSendNs = 0;
+};
+
+inline uint64_t steadyNowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Server time cut in ticks of a fixed length from an epoch, the start of the server.
+ */
+struct ServerClock {
+    uint64_t epochNs = 0;
+    uint64_t tickNs = 1;
+
+    uint64_t tickAt(const uint64_t &serverNs) const
+    {
+        return serverNs <= epochNs ? 0 : (serverNs - epochNs) / tickNs;
+    }
+
+    uint64_t currentTick() const
+    {
+        return tickAt(steadyNowNs());
+    }
+};
+
+/**
+ * @brief RTT and clock offset estimates of one client.
+ * The RTT is smoothed as TCP does (RFC 6298). The offset comes from the sample with the lowest RTT
+ * among the last ones, as the NTP clock filter does: queueing delays the packets of a slow round trip
+ * unevenly, so the fastest round trip is the one whose offset is the most accurate.
+ */
+class ClientClock {
+    public:
+        static constexpr size_t FilterSize = 8;
+
+        void addSample(const uint64_t &serverSendNs, const uint64_t &clientReceiveNs,
+                       const uint64_t &clientSendNs, const uint64_t &serverReceiveNs)
+        {
+            const int64_t elapsed = static_cast<int64_t>(serverReceiveNs - serverSendNs);
+            const int64_t held = static_cast<int64_t>(clientSendNs - clientReceiveNs);
+            const uint64_t rtt = static_cast<uint64_t>(std::max<int64_t>(elapsed - std::max<int64_t>(held, 0), 0));
+            const int64_t offset = (static_cast<int64_t>(clientReceiveNs - serverSendNs)
+                                    + static_cast<int64_t>(clientSendNs - serverReceiveNs)) / 2;
+
+            if (_samples == 0) {
+                _smoothedRtt = rtt;
+                _rttVariance = rtt / 2;
+            } else {
+                const uint64_t deviation = rtt > _smoothedRtt ? rtt - _smoothedRtt : _smoothedRtt - rtt;
+                _rttVariance = (3 * _rttVariance + deviation) / 4;
+                _smoothedRtt = (7 * _smoothedRtt + rtt) / 8;
+            }
+            _filter[_samples % FilterSize] = {rtt, offset};
+            _samples++;
+            _lastRtt = rtt;
+
+            const size_t count = std::min<uint64_t>(_samples, FilterSize);
+            const Sample *best = std::min_element(_filter.begin(), _filter.begin() + count,
+                [](const Sample &a, const Sample &b) { return a.rtt < b.rtt; });
+            _offset = best->offset;
+        }
+
+        uint64_t getSmoothedRttNs() const
+        {
+            return _smoothedRtt;
+        }
+
+        uint64_t getRttVarianceNs() const
+        {
+            return _rttVariance;
+        }
+
+        uint64_t getLastRttNs() const
+        {
+            return _lastRtt;
+        }
+
+        /**
+         * @brief Client clock minus server clock.
+         */
+        int64_t getOffsetNs() const
+        {
+            return _offset;
+        }
+
+        uint64_t getSampleCount() const
+        {
+            return _samples;
+        }
+
+        /**
+         * @brief A time of the client clock, e.g. sent in an event, on the server clock.
+         */
+        uint64_t toServerTime(const uint64_t &clientNs) const
+        {
+            return clientNs - static_cast<uint64_t>(_offset);
+        }
+
+        uint64_t toServerTick(const uint64_t &clientNs, const ServerClock &clock) const
+        {
+            return clock.tickAt(toServerTime(clientNs));
+        }
+
+    private:
+        struct Sample {
+            uint64_t rtt = 0;
+            int64_t offset = 0;
+        };
+
+        std::array<Sample, FilterSize> _filter{};
+        uint64_t _samples = 0;
+        uint64_t _smoothedRtt = 0;
+        uint64_t _rttVariance = 0;
+        uint64_t _lastRtt = 0;
+        int64_t _offset = 0;
+};
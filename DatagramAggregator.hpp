@@ -0,0 +1,197 @@
+//
+// Created by Florian Damiot on 19/10/2026.
+//
+
+#pragma once
+
+#include "./NetworkUtils.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <span>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Kind of a message inside an aggregated datagram.
+ */
+enum class DatagramMessageKind : uint8_t {
+    Event = 0, // Regular event, every message is delivered
+    State = 1  // Latest-value-wins state, see LatestValueChannel.hpp
+};
+
+/**
+ * @brief Gather every event sent to the same endpoint during a tick
+ * into as few datagrams as possible.
+ *
+ * Each event is written behind a compact sub-header made of two varints
+ * (packet id shifted left with the message kind in the low bit, then payload size),
+ * so a small event with an id below 64 only costs two bytes instead of a full IP/UDP header.
+ * Datagrams are filled up to maxPayload bytes and sent together by flush().
+ */
+class DatagramAggregator {
+    public:
+        using SendFunction = std::function<void(const sockaddr_in &, std::span<const std::byte>)>;
+        using MessageFunction = std::function<void(uint32_t, DatagramMessageKind, std::span<const std::byte>)>;
+
+        /**
+         * @brief Construct a new Datagram Aggregator object.
+         * @param maxPayload The maximum size of an emitted datagram.
+         */
+        explicit DatagramAggregator(const size_t &maxPayload = DATAGRAM_PAYLOAD_SIZE) : _maxPayload(maxPayload)
+        {
+
+        }
+
+        /**
+         * @brief Queue an event for the given endpoint until the next flush.
+         * @param to The endpoint to send the event to.
+         * @param packetId The id of the packet.
+         * @param data The serialized event.
+         * @param kind How the receiver must treat the message.
+         */
+        void enqueue(const sockaddr_in &to, const uint32_t &packetId, std::span<const std::byte> data,
+                     const DatagramMessageKind &kind = DatagramMessageKind::Event)
+        {
+            const uint64_t tag = (static_cast<uint64_t>(packetId) << 1) | static_cast<uint8_t>(kind);
+            const size_t messageSize = varintSize(tag) + varintSize(data.size()) + data.size();
+            if (messageSize > _maxPayload)
+                throw std::runtime_error("Event is too large to fit in a single datagram");
+
+            Destination &destination = _destinations[endpointKey(to)];
+            destination.address = to;
+            if (destination.used == 0 || destination.datagrams[destination.used - 1].size() + messageSize > _maxPayload) {
+                if (destination.used == destination.datagrams.size())
+                    destination.datagrams.emplace_back().reserve(_maxPayload);
+                destination.used++;
+            }
+            std::vector<std::byte> &datagram = destination.datagrams[destination.used - 1];
+            writeVarint(datagram, tag);
+            writeVarint(datagram, data.size());
+            datagram.insert(datagram.end(), data.begin(), data.end());
+        }
+
+        /**
+         * @brief Send every pending datagram, typically once at the end of a tick.
+         * The buffers are kept so the next tick does not allocate again.
+         * @param send The function writing one datagram to the socket.
+         * @return The number of datagrams sent.
+         */
+        size_t flush(const SendFunction &send)
+        {
+            size_t sent = 0;
+
+            for (auto &[key, destination] : _destinations) {
+                for (size_t i = 0; i < destination.used; i++) {
+                    send(destination.address, destination.datagrams[i]);
+                    destination.datagrams[i].clear();
+                    sent++;
+                }
+                destination.used = 0;
+            }
+            return (sent);
+        }
+
+        /**
+         * @brief Count the datagrams that the next flush will send.
+         */
+        size_t pendingDatagrams() const
+        {
+            size_t count = 0;
+
+            for (const auto &[key, destination] : _destinations)
+                count += destination.used;
+            return (count);
+        }
+
+        /**
+         * @brief Forget an endpoint and the memory kept for it.
+         * @param to The endpoint to forget.
+         */
+        void erase(const sockaddr_in &to)
+        {
+            _destinations.erase(endpointKey(to));
+        }
+
+        /**
+         * @brief Split a received datagram back into the events it contains.
+         * Parsing stops at the first malformed sub-header.
+         * @param datagram The received datagram.
+         * @param onMessage Called with the packet id, kind and payload of each event.
+         * @return The number of events found.
+         */
+        static size_t split(std::span<const std::byte> datagram, const MessageFunction &onMessage)
+        {
+            size_t offset = 0;
+            size_t count = 0;
+
+            while (offset < datagram.size()) {
+                uint64_t tag;
+                uint64_t size;
+                if (!readVarint(datagram, offset, tag) || !readVarint(datagram, offset, size))
+                    break;
+                if ((tag >> 1) > UINT32_MAX || size > datagram.size() - offset)
+                    break;
+                onMessage(static_cast<uint32_t>(tag >> 1), static_cast<DatagramMessageKind>(tag & 1),
+                          datagram.subspan(offset, size));
+                offset += size;
+                count++;
+            }
+            return (count);
+        }
+
+        /**
+         * @brief Build the key identifying an endpoint from its address and port.
+         */
+        static uint64_t endpointKey(const sockaddr_in &address)
+        {
+            return (static_cast<uint64_t>(address.sin_addr.s_addr) << 16) | address.sin_port;
+        }
+
+        // Varint (LEB128) helpers, also used for the headers nested inside messages
+
+        static size_t varintSize(uint64_t value)
+        {
+            size_t size = 1;
+
+            while (value >= 0x80) {
+                value >>= 7;
+                size++;
+            }
+            return (size);
+        }
+
+        static void writeVarint(std::vector<std::byte> &out, uint64_t value)
+        {
+            while (value >= 0x80) {
+                out.push_back(static_cast<std::byte>((value & 0x7F) | 0x80));
+                value >>= 7;
+            }
+            out.push_back(static_cast<std::byte>(value));
+        }
+
+        static bool readVarint(std::span<const std::byte> in, size_t &offset, uint64_t &value)
+        {
+            value = 0;
+            for (unsigned int shift = 0; shift < 64 && offset < in.size(); shift += 7) {
+                const auto byte = static_cast<uint8_t>(in[offset++]);
+                value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                if ((byte & 0x80) == 0)
+                    return (true);
+            }
+            return (false);
+        }
+
+    private:
+        struct Destination {
+            sockaddr_in address{};
+            // Datagrams are reused between ticks, only the first `used` ones are pending
+            std::vector<std::vector<std::byte>> datagrams;
+            size_t used = 0;
+        };
+
+        size_t _maxPayload;
+        std::unordered_map<uint64_t, Destination> _destinations;
+};
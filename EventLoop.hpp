@@ -0,0 +1,237 @@
+//
+// Created by Florian Damiot on 19/10/2026.
+//
+
+#pragma once
+
+#include "./BusyPoll.hpp"
+#include "./TimerWheel.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/**
+ * @brief Readiness based event loop (epoll) running on a single thread.
+ * File descriptors are registered with a handler called with the ready events,
+ * any thread can post a task to run on the loop thread,
+ * and the loop thread can schedule a task to run at a given time on a timer wheel.
+ * In busy poll mode the loop polls epoll without blocking while events keep coming.
+ */
+class EventLoop {
+    public:
+        using Handler = std::function<void(uint32_t events)>;
+        using Clock = TimerWheel::Clock;
+        using TimerId = TimerWheel::TimerId;
+
+        EventLoop()
+        {
+            _epollFd = epoll_create1(EPOLL_CLOEXEC);
+            if (_epollFd == -1)
+                throw std::runtime_error("Failed to create epoll instance");
+            _wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (_wakeFd == -1)
+                throw std::runtime_error("Failed to create eventfd for event loop");
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.fd = _wakeFd;
+            epoll_ctl(_epollFd, EPOLL_CTL_ADD, _wakeFd, &event);
+        }
+
+        ~EventLoop()
+        {
+            close(_wakeFd);
+            close(_epollFd);
+        }
+
+        EventLoop(const EventLoop &) = delete;
+        EventLoop &operator=(const EventLoop &) = delete;
+
+        /**
+         * @brief Watch a file descriptor, must be called from the loop thread once it runs.
+         * @param fd The file descriptor to watch.
+         * @param events The epoll events to wait for.
+         * @param handler Called on the loop thread with the ready events.
+         */
+        void add(const int &fd, const uint32_t &events, Handler handler)
+        {
+            epoll_event event{};
+            event.events = events;
+            event.data.fd = fd;
+            if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &event) == -1)
+                throw std::runtime_error("Failed to add file descriptor to event loop");
+            _handlers[fd] = std::move(handler);
+        }
+
+        /**
+         * @brief Change the events watched for a file descriptor, can be called from any thread.
+         */
+        void modify(const int &fd, const uint32_t &events)
+        {
+            epoll_event event{};
+            event.events = events;
+            event.data.fd = fd;
+            epoll_ctl(_epollFd, EPOLL_CTL_MOD, fd, &event);
+        }
+
+        /**
+         * @brief Stop watching a file descriptor, must be called from the loop thread.
+         * The handler may remove its own file descriptor.
+         */
+        void remove(const int &fd)
+        {
+            epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+            auto it = _handlers.find(fd);
+            if (it == _handlers.end())
+                return;
+            // The handler may be the one running, destroy it once the current batch is done
+            _removedHandlers.push_back(std::move(it->second));
+            _handlers.erase(it);
+        }
+
+        /**
+         * @brief Run a task on the loop thread, can be called from any thread.
+         */
+        void post(std::function<void()> task)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_tasksMutex);
+                _tasks.push_back(std::move(task));
+            }
+            wakeUp();
+        }
+
+        /**
+         * @brief Run a task on the loop thread once the deadline is reached, must be called from the loop thread.
+         * The deadline is rounded up to the millisecond, scheduling and cancelling are O(1).
+         * @return The id to cancel the timer.
+         */
+        TimerId schedule(const Clock::time_point &deadline, std::function<void()> task)
+        {
+            return _timers.schedule(deadline, std::move(task));
+        }
+
+        /**
+         * @brief Cancel a timer that did not run yet, must be called from the loop thread.
+         * @return false if the timer already ran or was cancelled.
+         */
+        bool cancel(const TimerId &timer)
+        {
+            return _timers.cancel(timer);
+        }
+
+        /**
+         * @brief Enable or disable busy polling, must be called before run().
+         */
+        void setBusyPoll(const BusyPollConfig &config)
+        {
+            _busyPoll = config;
+        }
+
+        /**
+         * @brief Run the loop on the calling thread until stop() is called,
+         * even if it was called before run(). The tasks posted before stop() all run.
+         */
+        void run()
+        {
+            epoll_event events[64];
+            BusyPollBackoff backoff(_busyPoll);
+
+            _loopThread.store(std::this_thread::get_id(), std::memory_order_release);
+            while (!_stopRequested) {
+                const int count = epoll_wait(_epollFd, events, 64, backoff.spinning() ? 0 : nextTimeout());
+                if (count > 0)
+                    backoff.activity();
+                else
+                    backoff.idle();
+                for (int i = 0; i < count; i++) {
+                    const int fd = events[i].data.fd;
+                    if (fd == _wakeFd) {
+                        uint64_t value;
+                        while (read(_wakeFd, &value, sizeof(value)) > 0);
+                        continue;
+                    }
+                    auto it = _handlers.find(fd);
+                    if (it != _handlers.end())
+                        it->second(events[i].events);
+                }
+                _removedHandlers.clear();
+                runTasks();
+                _timers.advance(Clock::now());
+            }
+            runTasks();
+            _stopRequested = false;
+        }
+
+        /**
+         * @brief Ask the loop to return from run(), can be called from any thread.
+         */
+        void stop()
+        {
+            _stopRequested = true;
+            wakeUp();
+        }
+
+        bool isInLoopThread() const
+        {
+            return std::this_thread::get_id() == _loopThread.load(std::memory_order_acquire);
+        }
+
+    private:
+        void wakeUp() const
+        {
+            const uint64_t value = 1;
+            if (write(_wakeFd, &value, sizeof(value)) == -1)
+                return;
+        }
+
+        int nextTimeout() const
+        {
+            const auto deadline = _timers.nextDeadline();
+            if (!deadline)
+                return -1;
+            const auto remaining = *deadline - Clock::now();
+            if (remaining <= Clock::duration::zero())
+                return 0;
+            // Round up so the loop does not wake up just before the deadline
+            return static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(remaining).count());
+        }
+
+        void runTasks()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_tasksMutex);
+                _runningTasks.swap(_tasks);
+            }
+            for (auto &task : _runningTasks)
+                task();
+            // Keep the capacity so posting does not allocate in steady state
+            _runningTasks.clear();
+        }
+
+    private:
+        int _epollFd = -1;
+        int _wakeFd = -1;
+        std::atomic<bool> _stopRequested = false;
+        // Set by run(), read by isInLoopThread() from any thread
+        std::atomic<std::thread::id> _loopThread;
+        BusyPollConfig _busyPoll;
+
+        std::unordered_map<int, Handler> _handlers;
+        std::vector<Handler> _removedHandlers;
+
+        std::vector<std::function<void()>> _tasks;
+        std::vector<std::function<void()>> _runningTasks;
+        std::mutex _tasksMutex;
+
+        TimerWheel _timers;
+};
@@ -2,14 +2,50 @@
 // Created by Florian Damiot on 13/02/2023.
 //
 
+#pragma once
+
+#include "./PacketBufferPool.hpp"
+#include "./MpscQueue.hpp"
+#include "./HandlerExecutor.hpp"
+#include "./NetMetrics.hpp"
+#include "./TrafficCapture.hpp"
+
 #include <functional>
 #include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <map>
 #include <memory>
 #include <any>
+#include <span>
+#include <thread>
 #include <vector>
 
+    class EventRegistry;
+
+    /**
+     * @brief A packet decoded by a network thread, waiting for the game thread to run its handlers.
+     */
+    struct QueuedPacket
+    {
+        EventRegistry *registry = nullptr;
+        uint32_t packetId = 0;
+        uint64_t strand = 0;
+        PacketBuffer data;
+        uint64_t arrivalNs = 0;
+    };
+
+    using DispatchQueue = MpscQueue<QueuedPacket>;
+
+    /**
+     * @brief Where the handler of a packet runs.
+     */
+    enum class HandlerExecution
+    {
+        Inline, // On the thread dispatching the packet
+        Pooled  // On the HandlerExecutor, in order with the other pooled handlers of the same client
+    };
+
     /**
      * @brief This class is used to register, unregister listeners
      * and trigger events.
@@ -26,24 +62,26 @@
         /**
          * @brief Register a handler for the event.
          * @param handler The handler to register.
+         * @param execution Run the handler inline or on the executor, see setExecutor().
          */
         template <typename EventType>
         void registerHandler(const uint32_t &packerHeaderId,
-                             const std::shared_ptr<std::function<void(EventType e)>> &handler)
+                             const std::shared_ptr<std::function<void(EventType e)>> &handler,
+                             const HandlerExecution &execution = HandlerExecution::Inline)
         {
             auto it = _mEventHandlers.find(packerHeaderId);
 
             if (it == _mEventHandlers.end())
             {
-                std::vector<std::shared_ptr<std::function<void(EventType)>>> v;
-                v.push_back(handler);
+                HandlerList<EventType> v;
+                v.push_back({handler, execution});
                 _mEventHandlers[packerHeaderId] = v;
+                _mDispatchers[packerHeaderId] = &EventRegistry::triggerHandler<EventType>;
             }
             else
             {
-                std::vector<std::shared_ptr<std::function<void(EventType)>>> v =
-                        std::any_cast<std::vector<std::shared_ptr<std::function<void(EventType)>>>>(_mEventHandlers[packerHeaderId]);
-                v.push_back(handler);
+                HandlerList<EventType> v = std::any_cast<HandlerList<EventType>>(_mEventHandlers[packerHeaderId]);
+                v.push_back({handler, execution});
                 _mEventHandlers[packerHeaderId] = v;
             }
         }
@@ -62,8 +100,10 @@
             {
                 return;
             }
-            std::vector<std::shared_ptr<std::function<void(EventType)>>> v = std::any_cast<std::vector<std::shared_ptr<std::function<void(EventType)>>>>(_mEventHandlers[packerHeaderId]);
-            v.erase(std::remove(v.begin(), v.end(), handler), v.end());
+            HandlerList<EventType> v = std::any_cast<HandlerList<EventType>>(_mEventHandlers[packerHeaderId]);
+            v.erase(std::remove_if(v.begin(), v.end(), [&handler](const RegisteredHandler<EventType> &registered) {
+                return registered.handler == handler;
+            }), v.end());
             _mEventHandlers[packerHeaderId] = v;
         }
 
@@ -73,26 +113,156 @@
          * @tparam EventType
          * @param packerHeaderId
          * @param data
+         * @param strand Key keeping the pooled handlers in order, usually the client the packet comes from.
+         * @param arrivalNs Kernel receive time of the packet on the wall clock, 0 if unknown.
          */
         template <class EventType>
         void triggerHandler(const uint32_t &packerHeaderId,
-                            const std::vector<std::byte> &data)
+                            std::span<const std::byte> data,
+                            const uint64_t &strand = 0,
+                            const uint64_t &arrivalNs = 0)
         {
             auto it = _mEventHandlers.find(packerHeaderId);
 
-            if (it == this->_mEventHandlers.end())
+            if (it == this->_mEventHandlers.end() || data.size() < sizeof(EventType))
             {
                 return;
             }
 
-            std::vector<std::shared_ptr<std::function<void(EventType)>>> v = std::any_cast<std::vector<std::shared_ptr<std::function<void(EventType)>>>>(this->_mEventHandlers[packerHeaderId]);
+            // Look at the handlers in place, copying the vector would allocate on every packet
+            auto *v = std::any_cast<HandlerList<EventType>>(&it->second);
+
+            if (v == nullptr)
+            {
+                return;
+            }
+
+            if (_metrics != nullptr)
+            {
+                triggerMeasured(packerHeaderId, data, strand, arrivalNs, *v);
+                return;
+            }
 
             EventType e = deserializeData<EventType>(data);
 
-            for (auto &fct_ptr : v)
+            for (auto &registered : *v)
+            {
+                if (registered.execution == HandlerExecution::Pooled && _executor != nullptr)
+                {
+                    _executor->post(strand, [handler = registered.handler, e] { (*handler)(e); });
+                    continue;
+                }
+                registered.handler.get()->operator()(e);
+            }
+        }
+
+        /**
+         * @brief Trigger the handlers of a packet when only its id is known,
+         * as it is the case when reading from the network.
+         * When a dispatch queue is set, the packet is copied into the queue instead
+         * and its handlers run when the consumer calls dispatchNow().
+         * If the queue is full the calling thread waits for room, slowing the reads down.
+         * @param packerHeaderId The id of the packet.
+         * @param data The serialized event.
+         * @param strand Key keeping the pooled handlers in order, usually the client the packet comes from.
+         * @param arrivalNs Kernel receive time of the packet on the wall clock, 0 if unknown.
+         * @return true if a handler type is registered for this id.
+         */
+        bool dispatch(const uint32_t &packerHeaderId,
+                      std::span<const std::byte> data,
+                      const uint64_t &strand = 0,
+                      const uint64_t &arrivalNs = 0)
+        {
+            if (_metrics != nullptr)
+            {
+                if (PacketMetrics *metrics = _metrics->local(_transport, packerHeaderId))
+                {
+                    metrics->addReceived(data.size());
+                }
+            }
+            if (_capture != nullptr)
+            {
+                _capture->record(_transport, packerHeaderId, data, strand);
+            }
+            if (_dispatchQueue == nullptr)
+            {
+                return (dispatchNow(packerHeaderId, data, strand, arrivalNs));
+            }
+            if (_mDispatchers.find(packerHeaderId) == _mDispatchers.end())
+            {
+                return (false);
+            }
+            QueuedPacket packet{this, packerHeaderId, strand, PacketBufferPool::getDefault().acquire(data), arrivalNs};
+            while (!_dispatchQueue->tryPush(std::move(packet)))
+            {
+                std::this_thread::yield();
+            }
+            return (true);
+        }
+
+        /**
+         * @brief Trigger the handlers of a packet on the calling thread, even if a dispatch queue is set.
+         * @param packerHeaderId The id of the packet.
+         * @param data The serialized event.
+         * @param strand Key keeping the pooled handlers in order, usually the client the packet comes from.
+         * @param arrivalNs Kernel receive time of the packet on the wall clock, 0 if unknown.
+         * @return true if a handler type is registered for this id.
+         */
+        bool dispatchNow(const uint32_t &packerHeaderId,
+                         std::span<const std::byte> data,
+                         const uint64_t &strand = 0,
+                         const uint64_t &arrivalNs = 0)
+        {
+            auto it = _mDispatchers.find(packerHeaderId);
+
+            if (it == _mDispatchers.end())
             {
-                fct_ptr.get()->operator()(e);
+                return (false);
             }
+            (this->*(it->second))(packerHeaderId, data, strand, arrivalNs);
+            return (true);
+        }
+
+        /**
+         * @brief Queue the packets received from the network instead of running their handlers
+         * on the network thread, see dispatch().
+         * @param queue The queue, or nullptr to run handlers on the network thread again.
+         */
+        void setDispatchQueue(DispatchQueue *queue)
+        {
+            _dispatchQueue = queue;
+        }
+
+        /**
+         * @brief Set the executor running the handlers registered with HandlerExecution::Pooled.
+         * Without executor, those handlers run inline.
+         * @param executor The executor, it must outlive the registry.
+         */
+        void setExecutor(HandlerExecutor *executor)
+        {
+            _executor = executor;
+        }
+
+        /**
+         * @brief Record the packets dispatched, the time spent decoding them and running their handlers.
+         * @param metrics The metrics, it must outlive the registry, or nullptr to stop measuring.
+         * @param transport The transport the packets of this registry come from.
+         */
+        void setMetrics(NetMetrics *metrics, const NetTransport &transport)
+        {
+            _metrics = metrics;
+            _transport = transport;
+        }
+
+        /**
+         * @brief Record the packets dispatched into a capture file while it is started.
+         * @param capture The capture, it must outlive the registry, or nullptr.
+         * @param transport The transport the packets of this registry come from.
+         */
+        void setCapture(TrafficCapture *capture, const NetTransport &transport)
+        {
+            _capture = capture;
+            _transport = transport;
         }
 
         /**
@@ -102,7 +272,7 @@
          * @return The deserialized data as an event.
          */
         template <class EventType>
-        EventType deserializeData(const std::vector<std::byte> &data)
+        EventType deserializeData(std::span<const std::byte> data)
         {
             EventType e;
             memcpy(&e, data.data(), sizeof(EventType));
@@ -113,13 +283,12 @@
          * @brief When sending a packet, this method will be called to serialize the data.
          * @tparam EventType The type of the event.
          * @param e The event to serialize.
-         * @return The serialized data.
+         * @return The serialized data, in a buffer borrowed from the packet buffer pool.
          */
         template <class EventType>
-        std::vector<std::byte> serializeData(const EventType &e)
+        PacketBuffer serializeData(const EventType &e)
         {
-            std::vector<std::byte> v;
-            v.resize(sizeof(EventType));
+            PacketBuffer v = PacketBufferPool::getDefault().acquire(sizeof(EventType));
             memcpy(v.data(), &e, sizeof(EventType));
             return (v);
         }
@@ -140,12 +309,86 @@
                 return (0);
             }
 
-            std::vector<std::shared_ptr<std::function<void(EventType)>>> v = std::any_cast<std::vector<std::shared_ptr<std::function<void(EventType)>>>>(this->_mEventHandlers[packerHeaderId]);
+            HandlerList<EventType> v = std::any_cast<HandlerList<EventType>>(this->_mEventHandlers[packerHeaderId]);
 
             return (v.size());
         }
 
     private:
+        template <typename EventType>
+        struct RegisteredHandler
+        {
+            std::shared_ptr<std::function<void(EventType)>> handler;
+            HandlerExecution execution;
+        };
+
+        template <typename EventType>
+        using HandlerList = std::vector<RegisteredHandler<EventType>>;
+
+        /**
+         * triggerHandler() with its decode and handler times recorded,
+         * pooled handlers are timed on the executor thread running them.
+         */
+        template <class EventType>
+        void triggerMeasured(const uint32_t &packerHeaderId,
+                             std::span<const std::byte> data,
+                             const uint64_t &strand,
+                             const uint64_t &arrivalNs,
+                             HandlerList<EventType> &handlers)
+        {
+            PacketMetrics *metrics = _metrics->local(_transport, packerHeaderId);
+            const uint64_t start = NetMetrics::nowNs();
+            EventType e = deserializeData<EventType>(data);
+            uint64_t now = NetMetrics::nowNs();
+
+            if (metrics != nullptr)
+            {
+                metrics->decode.record(now - start);
+            }
+            for (auto &registered : handlers)
+            {
+                if (registered.execution == HandlerExecution::Pooled && _executor != nullptr)
+                {
+                    _executor->post(strand, [handler = registered.handler, e, registry = _metrics,
+                                             transport = _transport, packerHeaderId, arrivalNs] {
+                        const uint64_t waited = arrivalNs != 0 ? NetMetrics::wallElapsedNs(arrivalNs) : 0;
+                        const uint64_t begin = NetMetrics::nowNs();
+                        (*handler)(e);
+                        if (PacketMetrics *pooled = registry->local(transport, packerHeaderId))
+                        {
+                            pooled->handler.record(NetMetrics::nowNs() - begin);
+                            if (arrivalNs != 0)
+                            {
+                                pooled->kernelToHandler.record(waited);
+                            }
+                        }
+                    });
+                    now = NetMetrics::nowNs();
+                    continue;
+                }
+                const uint64_t begin = now;
+                if (metrics != nullptr && arrivalNs != 0)
+                {
+                    metrics->kernelToHandler.record(NetMetrics::wallElapsedNs(arrivalNs));
+                }
+                registered.handler.get()->operator()(e);
+                now = NetMetrics::nowNs();
+                if (metrics != nullptr)
+                {
+                    metrics->handler.record(now - begin);
+                }
+            }
+        }
+
+        using DispatchFunction = void (EventRegistry::*)(const uint32_t &, std::span<const std::byte>, const uint64_t &,
+                                                         const uint64_t &);
+
         std::map<uint32_t, std::any> _mEventHandlers;
+        std::map<uint32_t, DispatchFunction> _mDispatchers;
+        DispatchQueue *_dispatchQueue = nullptr;
+        HandlerExecutor *_executor = nullptr;
+        NetMetrics *_metrics = nullptr;
+        TrafficCapture *_capture = nullptr;
+        NetTransport _transport = NetTransport::Tcp;
     };
 
@@ -0,0 +1,239 @@
+//
+// Created by Florian Damiot on 19/10/2026.
+//
+
+#pragma once
+
+#include "./ThreadConfig.hpp"
+#include "./NetLog.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Thread pool running the handlers too expensive for the network loop.
+ *
+ * Every worker owns a deque: it takes its own tasks from the back and,
+ * once empty, steals from the front of the other workers' deques.
+ * Tasks posted with a strand key run one at a time and in posting order for that key,
+ * which keeps the messages of a client ordered while different clients run in parallel.
+ * Keys are hashed into a fixed number of strands, two keys sharing a strand are serialized together.
+ */
+class HandlerExecutor {
+    public:
+        using Task = std::function<void()>;
+
+        /**
+         * @brief Construct a new Handler Executor object and start its threads.
+         * @param threadCount The number of worker threads.
+         * @param strandCount The number of strands the keys are hashed into.
+         * @param placement Placement of the threads, each one gets its index appended to the name.
+         */
+        explicit HandlerExecutor(const size_t &threadCount = std::max(1u, std::thread::hardware_concurrency()),
+                                 const size_t &strandCount = 4096,
+                                 const ThreadPlacement &placement = {"net-exec"})
+                                 : _workers(std::max<size_t>(threadCount, 1)), _strands(std::max<size_t>(strandCount, 1))
+        {
+            const NumaTopology topology = NumaTopology::detect();
+            for (size_t i = 0; i < _workers.size(); i++) {
+                ThreadPlacement workerPlacement = placement;
+                workerPlacement.name += "-" + std::to_string(i);
+                _threads.emplace_back([this, i, workerPlacement, topology] {
+                    const std::string applied = applyThreadPlacement(workerPlacement, topology);
+                    NET_LOG_INFO("Starting executor thread {}", applied);
+                    workerLoop(i);
+                });
+            }
+        }
+
+        /**
+         * @brief Run the tasks already posted, then stop and join every thread.
+         */
+        ~HandlerExecutor()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_sleepMutex);
+                _stopping = true;
+            }
+            _sleepCondition.notify_all();
+            for (auto &thread : _threads)
+                thread.join();
+        }
+
+        HandlerExecutor(const HandlerExecutor &) = delete;
+        HandlerExecutor &operator=(const HandlerExecutor &) = delete;
+
+        /**
+         * @brief Run a task on any worker, without ordering.
+         */
+        void post(Task task)
+        {
+            submit(std::move(task));
+        }
+
+        /**
+         * @brief Run a task after every task previously posted with the same key.
+         * @param strandKey Identify the sequence the task belongs to, e.g. the client.
+         * @param task The task to run.
+         */
+        void post(const uint64_t &strandKey, Task task)
+        {
+            Strand &strand = _strands[std::hash<uint64_t>{}(strandKey) % _strands.size()];
+            {
+                std::lock_guard<std::mutex> lock(strand.mutex);
+                strand.tasks.push_back(std::move(task));
+                if (strand.scheduled)
+                    return;
+                strand.scheduled = true;
+            }
+            submit([this, &strand] { runStrand(strand); });
+        }
+
+        size_t getThreadCount() const
+        {
+            return _threads.size();
+        }
+
+        /**
+         * @brief Tasks posted and not taken by a thread yet.
+         */
+        size_t getPendingTasks() const
+        {
+            return _pending.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct Worker {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        struct Strand {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+            // A task of this strand is in a worker deque or running
+            bool scheduled = false;
+        };
+
+        void submit(Task task)
+        {
+            // A worker keeps what it posts, the others steal it if they are idle
+            const size_t index = _currentExecutor == this ? _currentWorker
+                                 : _nextWorker.fetch_add(1, std::memory_order_relaxed) % _workers.size();
+            {
+                std::lock_guard<std::mutex> lock(_workers[index].mutex);
+                _workers[index].tasks.push_back(std::move(task));
+            }
+            // Ordered against the sleepers count: either a parking worker sees the task or we see it parking
+            _pending.fetch_add(1);
+            if (_sleepers.load() == 0)
+                return;
+            {
+                std::lock_guard<std::mutex> lock(_sleepMutex);
+            }
+            _sleepCondition.notify_one();
+        }
+
+        /**
+         * Count one pending task as ours, without locking.
+         */
+        bool claim()
+        {
+            size_t pending = _pending.load();
+            while (pending > 0)
+                if (_pending.compare_exchange_weak(pending, pending - 1))
+                    return true;
+            return false;
+        }
+
+        bool take(const size_t &self, Task &task)
+        {
+            {
+                Worker &worker = _workers[self];
+                std::lock_guard<std::mutex> lock(worker.mutex);
+                if (!worker.tasks.empty()) {
+                    task = std::move(worker.tasks.back());
+                    worker.tasks.pop_back();
+                    return true;
+                }
+            }
+            for (size_t i = 1; i < _workers.size(); i++) {
+                Worker &victim = _workers[(self + i) % _workers.size()];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (!victim.tasks.empty()) {
+                    task = std::move(victim.tasks.front());
+                    victim.tasks.pop_front();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void workerLoop(const size_t &self)
+        {
+            _currentExecutor = this;
+            _currentWorker = self;
+            Task task;
+            while (true) {
+                if (!claim()) {
+                    std::unique_lock<std::mutex> lock(_sleepMutex);
+                    _sleepers.fetch_add(1);
+                    _sleepCondition.wait(lock, [this] { return _pending.load() > 0 || _stopping; });
+                    _sleepers.fetch_sub(1);
+                    if (_pending.load() == 0)
+                        return;
+                    continue;
+                }
+                // A task is counted for us, it may just not be visible in a deque yet
+                while (!take(self, task))
+                    std::this_thread::yield();
+                task();
+                task = nullptr;
+            }
+        }
+
+        void runStrand(Strand &strand)
+        {
+            Task task;
+            {
+                std::lock_guard<std::mutex> lock(strand.mutex);
+                task = std::move(strand.tasks.front());
+                strand.tasks.pop_front();
+            }
+            task();
+            {
+                std::lock_guard<std::mutex> lock(strand.mutex);
+                if (strand.tasks.empty()) {
+                    strand.scheduled = false;
+                    return;
+                }
+            }
+            // Go back through a deque so one busy client cannot hold a worker forever
+            submit([this, &strand] { runStrand(strand); });
+        }
+
+    private:
+        std::vector<Worker> _workers;
+        std::vector<Strand> _strands;
+        std::vector<std::thread> _threads;
+        std::atomic<size_t> _nextWorker = 0;
+
+        // Submitting only locks the sleep mutex when a worker is parked on it
+        std::atomic<size_t> _pending = 0;
+        std::atomic<size_t> _sleepers = 0;
+        std::mutex _sleepMutex;
+        std::condition_variable _sleepCondition;
+        bool _stopping = false;
+
+        inline static thread_local HandlerExecutor *_currentExecutor = nullptr;
+        inline static thread_local size_t _currentWorker = 0;
+};
@@ -0,0 +1,398 @@
+//
+// Created by Florian Damiot on 19/10/2026.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct WorldPosition {
+    float x = 0;
+    float y = 0;
+};
+
+struct InterestConfig {
+    // Side of a grid cell, close to the view radius a query only looks at 3x3 cells
+    float cellSize = 64;
+    // View radius of the clients not given their own
+    float viewRadius = 64;
+    // An entity leaves the view this much further than it enters it,
+    // so one moving along the edge does not appear and disappear on every update
+    float hysteresis = 4;
+};
+
+/**
+ * @brief Area of interest: which clients see which entities, on a uniform grid of the world.
+ *
+ * Clients and entities are bucketed by cell, so finding the clients near a position
+ * only looks at the cells the radius covers instead of every client.
+ * Every client keeps the set of entities it sees and every entity the clients seeing it.
+ * Moving one only compares it against the cells around it, and the visibility callback
+ * reports what entered or left a view, to spawn and despawn the entity on that client.
+ * Not thread safe, it belongs to the game thread, except for releaseClient().
+ *
+ * Clients are usually keyed by their TCP socket, which the kernel reuses once closed:
+ * the grid must forget a client when it leaves, or the next one on that socket inherits its view.
+ * Call releaseClient() from the disconnect handler. With session resumption that handler only runs
+ * once the session expires, when the socket may belong to another client already:
+ * release the socket from the connect and resume handlers instead, before adding the client.
+ */
+class InterestGrid {
+    public:
+        using VisibilityFunction = std::function<void(int client, uint32_t entity, bool visible)>;
+
+        explicit InterestGrid(const InterestConfig &config = {}) : _config(config), _maxRadius(config.viewRadius)
+        {
+
+        }
+
+        /**
+         * @brief Called when an entity enters or leaves the view of a client,
+         * not when the client is removed. It must not change the grid.
+         * Leaving is the despawn of the entity on that client, where UdpManager::forgetState() belongs.
+         */
+        void setOnVisibilityChange(const VisibilityFunction &onVisibilityChange)
+        {
+            _onVisibilityChange = onVisibilityChange;
+        }
+
+        /**
+         * @brief Add or move a client, usually identified by its TCP socket.
+         * @param viewRadius Its own view radius, the one of the config if negative.
+         */
+        void updateClient(const int &client, const WorldPosition &position, const float &viewRadius = -1)
+        {
+            forgetReleasedClients();
+            auto [it, inserted] = _clients.try_emplace(client);
+            Client &state = it->second;
+            const uint64_t cell = cellOf(position);
+
+            if (inserted)
+                _cells[cell].clients.push_back(client);
+            else if (cell != state.cell)
+                moveBetweenCells(client, state.cell, cell, &Cell::clients);
+            state.position = position;
+            state.cell = cell;
+            state.radius = viewRadius < 0 ? _config.viewRadius : viewRadius;
+            _maxRadius = std::max(_maxRadius, state.radius);
+
+            // What the client sees from its new position
+            _scratchEntities.clear();
+            forEachCell(position, state.radius + _config.hysteresis, [&](const Cell &near) {
+                for (const uint32_t &entity : near.entities) {
+                    const float limit = state.visible.contains(entity) ? state.radius + _config.hysteresis : state.radius;
+                    if (distanceSquared(_entities[entity].position, position) <= limit * limit)
+                        _scratchEntities.push_back(entity);
+                }
+            });
+            std::sort(_scratchEntities.begin(), _scratchEntities.end());
+            _scratchHidden.clear();
+            for (const uint32_t &entity : state.visible)
+                if (!std::binary_search(_scratchEntities.begin(), _scratchEntities.end(), entity))
+                    _scratchHidden.push_back(entity);
+            for (const uint32_t &entity : _scratchHidden)
+                hide(client, entity);
+            for (const uint32_t &entity : _scratchEntities)
+                if (!state.visible.contains(entity))
+                    show(client, entity);
+        }
+
+        void removeClient(const int &client)
+        {
+            forgetReleasedClients();
+            eraseClient(client);
+        }
+
+        /**
+         * @brief Remove a client from any thread, e.g. the network thread running the disconnect handler.
+         * It is removed on the game thread by the next update or removal, like with removeClient().
+         */
+        void releaseClient(const int &client)
+        {
+            std::lock_guard<std::mutex> lock(_releasedMutex);
+            _releasedClients.push_back(client);
+            _hasReleasedClients.store(true, std::memory_order_release);
+        }
+
+        /**
+         * @brief Add or move an entity.
+         */
+        void updateEntity(const uint32_t &entity, const WorldPosition &position)
+        {
+            forgetReleasedClients();
+            auto [it, inserted] = _entities.try_emplace(entity);
+            Entity &state = it->second;
+            const uint64_t cell = cellOf(position);
+
+            if (inserted)
+                _cells[cell].entities.push_back(entity);
+            else if (cell != state.cell)
+                moveBetweenCells(entity, state.cell, cell, &Cell::entities);
+            state.position = position;
+            state.cell = cell;
+
+            // The clients seeing it from its new position
+            _scratchClients.clear();
+            forEachCell(position, _maxRadius + _config.hysteresis, [&](const Cell &near) {
+                for (const int &client : near.clients) {
+                    const Client &viewer = _clients[client];
+                    const bool watching = std::binary_search(state.watchers.begin(), state.watchers.end(), client);
+                    const float limit = watching ? viewer.radius + _config.hysteresis : viewer.radius;
+                    if (distanceSquared(viewer.position, position) <= limit * limit)
+                        _scratchClients.push_back(client);
+                }
+            });
+            std::sort(_scratchClients.begin(), _scratchClients.end());
+            _scratchHiddenClients.clear();
+            std::set_difference(state.watchers.begin(), state.watchers.end(), _scratchClients.begin(), _scratchClients.end(),
+                                std::back_inserter(_scratchHiddenClients));
+            for (const int &client : _scratchHiddenClients)
+                hide(client, entity);
+            for (const int &client : _scratchClients)
+                if (!std::binary_search(state.watchers.begin(), state.watchers.end(), client))
+                    show(client, entity);
+        }
+
+        /**
+         * @brief Remove an entity, it leaves the view of every client seeing it.
+         */
+        void removeEntity(const uint32_t &entity)
+        {
+            forgetReleasedClients();
+            auto it = _entities.find(entity);
+            if (it == _entities.end())
+                return;
+            const std::vector<int> watchers = std::move(it->second.watchers);
+            removeFromCell(it->second.cell, entity, &Cell::entities);
+            _entities.erase(it);
+            for (const int &client : watchers) {
+                _clients[client].visible.erase(entity);
+                if (_onVisibilityChange)
+                    _onVisibilityChange(client, entity, false);
+            }
+        }
+
+        /**
+         * @brief Call a function with every client within a radius of a position.
+         * A negative or NaN radius finds no client, an infinite one every client.
+         */
+        template<typename Function>
+        void forEachClientNear(const WorldPosition &position, const float &radius, const Function &function) const
+        {
+            forEachCell(position, radius, [&](const Cell &near) {
+                for (const int &client : near.clients)
+                    if (distanceSquared(_clients.at(client).position, position) <= radius * radius)
+                        function(client);
+            });
+        }
+
+        /**
+         * @brief Call a function with every client seeing an entity.
+         */
+        template<typename Function>
+        void forEachWatcher(const uint32_t &entity, const Function &function) const
+        {
+            auto it = _entities.find(entity);
+            if (it == _entities.end())
+                return;
+            for (const int &client : it->second.watchers)
+                function(client);
+        }
+
+        bool isVisible(const int &client, const uint32_t &entity) const
+        {
+            auto it = _clients.find(client);
+            return it != _clients.end() && it->second.visible.contains(entity);
+        }
+
+        /**
+         * @brief The entities a client sees, empty if the client is unknown.
+         */
+        const std::unordered_set<uint32_t> &getVisibleEntities(const int &client) const
+        {
+            static const std::unordered_set<uint32_t> none;
+            auto it = _clients.find(client);
+            return it == _clients.end() ? none : it->second.visible;
+        }
+
+        size_t getClientCount() const
+        {
+            return _clients.size();
+        }
+
+        size_t getEntityCount() const
+        {
+            return _entities.size();
+        }
+
+    private:
+        struct Client {
+            WorldPosition position;
+            float radius = 0;
+            uint64_t cell = 0;
+            std::unordered_set<uint32_t> visible;
+        };
+
+        struct Entity {
+            WorldPosition position;
+            uint64_t cell = 0;
+            // Sorted
+            std::vector<int> watchers;
+        };
+
+        struct Cell {
+            std::vector<int> clients;
+            std::vector<uint32_t> entities;
+        };
+
+        static float distanceSquared(const WorldPosition &a, const WorldPosition &b)
+        {
+            const float dx = a.x - b.x;
+            const float dy = a.y - b.y;
+            return dx * dx + dy * dy;
+        }
+
+        static uint64_t cellKey(const int32_t &x, const int32_t &y)
+        {
+            return (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(y);
+        }
+
+        // Saturated: casting a float out of the int32_t range, or NaN, is undefined
+        int32_t cellCoordinate(const float &value) const
+        {
+            const float cell = std::floor(value / _config.cellSize);
+            if (std::isnan(cell))
+                return 0;
+            return static_cast<int32_t>(std::clamp(cell, -2147483648.0f, 2147483520.0f));
+        }
+
+        uint64_t cellOf(const WorldPosition &position) const
+        {
+            return cellKey(cellCoordinate(position.x), cellCoordinate(position.y));
+        }
+
+        template<typename Function>
+        void forEachCell(const WorldPosition &position, const float &radius, const Function &function) const
+        {
+            if (!(radius >= 0) || std::isnan(position.x) || std::isnan(position.y))
+                return;
+            const int64_t minX = cellCoordinate(position.x - radius);
+            const int64_t maxX = cellCoordinate(position.x + radius);
+            const int64_t minY = cellCoordinate(position.y - radius);
+            const int64_t maxY = cellCoordinate(position.y + radius);
+            const auto width = static_cast<uint64_t>(maxX - minX + 1);
+            const auto height = static_cast<uint64_t>(maxY - minY + 1);
+
+            // A radius covering more cells than there are, e.g. a huge one, looks at every occupied cell instead
+            if (width > _cells.size() || height > _cells.size() / width) {
+                for (const auto &[key, cell] : _cells) {
+                    const auto x = static_cast<int32_t>(key >> 32);
+                    const auto y = static_cast<int32_t>(key & 0xFFFFFFFF);
+                    if (x >= minX && x <= maxX && y >= minY && y <= maxY)
+                        function(cell);
+                }
+                return;
+            }
+            for (int64_t x = minX; x <= maxX; x++)
+                for (int64_t y = minY; y <= maxY; y++)
+                    if (auto it = _cells.find(cellKey(static_cast<int32_t>(x), static_cast<int32_t>(y))); it != _cells.end())
+                        function(it->second);
+        }
+
+        void forgetReleasedClients()
+        {
+            if (!_hasReleasedClients.load(std::memory_order_acquire))
+                return;
+            std::vector<int> released;
+            {
+                std::lock_guard<std::mutex> lock(_releasedMutex);
+                released.swap(_releasedClients);
+                _hasReleasedClients.store(false, std::memory_order_relaxed);
+            }
+            for (const int &client : released)
+                eraseClient(client);
+        }
+
+        void eraseClient(const int &client)
+        {
+            auto it = _clients.find(client);
+            if (it == _clients.end())
+                return;
+            for (const uint32_t &entity : it->second.visible)
+                eraseSorted(_entities[entity].watchers, client);
+            removeFromCell(it->second.cell, client, &Cell::clients);
+            _clients.erase(it);
+        }
+
+        template<typename Id>
+        void removeFromCell(const uint64_t &cell, const Id &id, std::vector<Id> Cell::*members)
+        {
+            auto it = _cells.find(cell);
+            std::vector<Id> &ids = it->second.*members;
+            // Order does not matter in a cell, swap with the last one
+            *std::find(ids.begin(), ids.end(), id) = ids.back();
+            ids.pop_back();
+            if (it->second.clients.empty() && it->second.entities.empty())
+                _cells.erase(it);
+        }
+
+        template<typename Id>
+        void moveBetweenCells(const Id &id, const uint64_t &from, const uint64_t &to, std::vector<Id> Cell::*members)
+        {
+            removeFromCell(from, id, members);
+            (_cells[to].*members).push_back(id);
+        }
+
+        static void eraseSorted(std::vector<int> &values, const int &value)
+        {
+            auto it = std::lower_bound(values.begin(), values.end(), value);
+            if (it != values.end() && *it == value)
+                values.erase(it);
+        }
+
+        void show(const int &client, const uint32_t &entity)
+        {
+            _clients[client].visible.insert(entity);
+            std::vector<int> &watchers = _entities[entity].watchers;
+            watchers.insert(std::lower_bound(watchers.begin(), watchers.end(), client), client);
+            if (_onVisibilityChange)
+                _onVisibilityChange(client, entity, true);
+        }
+
+        void hide(const int &client, const uint32_t &entity)
+        {
+            _clients[client].visible.erase(entity);
+            eraseSorted(_entities[entity].watchers, client);
+            if (_onVisibilityChange)
+                _onVisibilityChange(client, entity, false);
+        }
+
+    private:
+        InterestConfig _config;
+        // Largest view radius any client had, how far an entity looks for the clients seeing it
+        float _maxRadius;
+        std::unordered_map<int, Client> _clients;
+        std::unordered_map<uint32_t, Entity> _entities;
+        std::unordered_map<uint64_t, Cell> _cells;
+        VisibilityFunction _onVisibilityChange = nullptr;
+
+        // Kept between updates so moving does not allocate
+        std::vector<uint32_t> _scratchEntities;
+        std::vector<uint32_t> _scratchHidden;
+        std::vector<int> _scratchClients;
+        std::vector<int> _scratchHiddenClients;
+
+        // Released from other threads, removed by the game thread
+        std::mutex _releasedMutex;
+        std::vector<int> _releasedClients;
+        std::atomic<bool> _hasReleasedClients = false;
+};
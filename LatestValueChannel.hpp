@@ -0,0 +1,259 @@
+//
+// Created by Florian Damiot on 19/10/2026.
+//
+
+#pragma once
+
+#include "./DatagramAggregator.hpp"
+
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Header written in front of every state message:
+ * varint entity id, varint field, then a little endian 16 bits sequence number.
+ */
+struct StateHeader {
+    uint32_t entityId;
+    uint16_t field;
+    uint16_t sequence;
+
+    /**
+     * @brief Key identifying a state slot, the pair (entity id, field).
+     */
+    uint64_t key() const
+    {
+        return (static_cast<uint64_t>(entityId) << 16) | field;
+    }
+
+    void write(std::vector<std::byte> &out) const
+    {
+        DatagramAggregator::writeVarint(out, entityId);
+        DatagramAggregator::writeVarint(out, field);
+        out.push_back(static_cast<std::byte>(sequence & 0xFF));
+        out.push_back(static_cast<std::byte>(sequence >> 8));
+    }
+
+    /**
+     * @brief Read the header at the beginning of a state message.
+     * @param data The state message, the remaining bytes are the serialized event.
+     * @param offset Set to the size of the header.
+     * @return false if the header is truncated or malformed.
+     */
+    bool read(std::span<const std::byte> data, size_t &offset)
+    {
+        uint64_t entity;
+        uint64_t fieldValue;
+
+        offset = 0;
+        if (!DatagramAggregator::readVarint(data, offset, entity) ||
+            !DatagramAggregator::readVarint(data, offset, fieldValue))
+            return (false);
+        if (entity > UINT32_MAX || fieldValue > UINT16_MAX || data.size() - offset < 2)
+            return (false);
+        entityId = static_cast<uint32_t>(entity);
+        field = static_cast<uint16_t>(fieldValue);
+        sequence = static_cast<uint16_t>(static_cast<uint8_t>(data[offset]) |
+                                         (static_cast<uint8_t>(data[offset + 1]) << 8));
+        offset += 2;
+        return (true);
+    }
+};
+
+/**
+ * @brief Sending side of the latest-value-wins channels, used for entity state
+ * such as position or animation where only the newest value matters.
+ *
+ * Setting a value replaces the one still waiting for this endpoint and key,
+ * so a superseded update never reaches the network.
+ * Values are moved into a DatagramAggregator by drainInto(), once per tick.
+ */
+class LatestValueSender {
+    public:
+        LatestValueSender() = default;
+
+        /**
+         * @brief Set the value of a state slot for an endpoint, replacing any unsent older value.
+         * @param to The endpoint to send the state to.
+         * @param packetId The id of the packet, used to dispatch the event on the receiver.
+         * @param entityId The entity the state belongs to.
+         * @param field The field of the entity, e.g. position or animation.
+         * @param data The serialized event.
+         */
+        void set(const sockaddr_in &to, const uint32_t &packetId,
+                 const uint32_t &entityId, const uint16_t &field,
+                 std::span<const std::byte> data)
+        {
+            Endpoint &endpoint = _endpoints[DatagramAggregator::endpointKey(to)];
+            const uint64_t key = StateHeader{entityId, field, 0}.key();
+            auto [it, inserted] = endpoint.slots.try_emplace(key);
+            Slot &slot = it->second;
+
+            if (inserted)
+                endpoint.fields[entityId].push_back(field);
+            endpoint.address = to;
+            if (!slot.dirty) {
+                slot.dirty = true;
+                endpoint.dirtyKeys.push_back(key);
+            }
+            slot.packetId = packetId;
+            slot.entityId = entityId;
+            slot.field = field;
+            slot.value.assign(data.begin(), data.end());
+        }
+
+        /**
+         * @brief Queue the pending value of every slot into the aggregator, each with the next sequence number of its slot.
+         * @param aggregator The aggregator sending the datagrams of this tick.
+         * @return The number of values queued.
+         */
+        size_t drainInto(DatagramAggregator &aggregator)
+        {
+            size_t count = 0;
+
+            for (auto &[endpointKey, endpoint] : _endpoints) {
+                for (const uint64_t &key : endpoint.dirtyKeys) {
+                    // Forgotten since it was set, or forgotten and set again, listed twice then
+                    auto it = endpoint.slots.find(key);
+                    if (it == endpoint.slots.end() || !it->second.dirty)
+                        continue;
+                    Slot &slot = it->second;
+                    _scratch.clear();
+                    StateHeader{slot.entityId, slot.field, ++slot.sequence}.write(_scratch);
+                    _scratch.insert(_scratch.end(), slot.value.begin(), slot.value.end());
+                    aggregator.enqueue(endpoint.address, slot.packetId, _scratch, DatagramMessageKind::State);
+                    slot.dirty = false;
+                    count++;
+                }
+                endpoint.dirtyKeys.clear();
+            }
+            return (count);
+        }
+
+        /**
+         * @brief Forget every slot of an endpoint, e.g. when the client disconnects.
+         */
+        void erase(const sockaddr_in &to)
+        {
+            _endpoints.erase(DatagramAggregator::endpointKey(to));
+        }
+
+        /**
+         * @brief Forget every slot of an entity for an endpoint, e.g. when it leaves the view of the client.
+         * The sequence numbers start over, the receiver must forget the entity too, see LatestValueReceiver::forget().
+         */
+        void forget(const sockaddr_in &to, const uint32_t &entityId)
+        {
+            auto it = _endpoints.find(DatagramAggregator::endpointKey(to));
+            if (it != _endpoints.end())
+                forget(it->second, entityId);
+        }
+
+        /**
+         * @brief Forget every slot of an entity for every endpoint, e.g. when it despawns.
+         */
+        void forget(const uint32_t &entityId)
+        {
+            for (auto &[key, endpoint] : _endpoints)
+                forget(endpoint, entityId);
+        }
+
+    private:
+        struct Slot {
+            uint32_t packetId = 0;
+            uint32_t entityId = 0;
+            uint16_t field = 0;
+            uint16_t sequence = 0;
+            bool dirty = false;
+            std::vector<std::byte> value;
+        };
+
+        struct Endpoint {
+            sockaddr_in address{};
+            std::unordered_map<uint64_t, Slot> slots;
+            // Fields with a slot, by entity, to forget an entity without looking at every slot
+            std::unordered_map<uint32_t, std::vector<uint16_t>> fields;
+            std::vector<uint64_t> dirtyKeys;
+        };
+
+        static void forget(Endpoint &endpoint, const uint32_t &entityId)
+        {
+            auto it = endpoint.fields.find(entityId);
+            if (it == endpoint.fields.end())
+                return;
+            for (const uint16_t &field : it->second)
+                endpoint.slots.erase(StateHeader{entityId, field, 0}.key());
+            endpoint.fields.erase(it);
+        }
+
+        std::unordered_map<uint64_t, Endpoint> _endpoints;
+        std::vector<std::byte> _scratch;
+};
+
+/**
+ * @brief Receiving side of the latest-value-wins channels.
+ * Remember the last sequence number applied for each endpoint and key,
+ * and reject anything older, which happens when UDP reorders datagrams.
+ */
+class LatestValueReceiver {
+    public:
+        LatestValueReceiver() = default;
+
+        /**
+         * @brief Check if a state is newer than the last one applied and remember it if so.
+         * Sequence numbers wrap around, a value is newer if it is less than half the range ahead.
+         * @param from The endpoint the state comes from.
+         * @param header The header of the received state.
+         * @return true if the state must be applied, false if it is stale.
+         */
+        bool accept(const sockaddr_in &from, const StateHeader &header)
+        {
+            Endpoint &endpoint = _endpoints[DatagramAggregator::endpointKey(from)];
+            auto [it, inserted] = endpoint.lastSequences.try_emplace(header.key(), header.sequence);
+
+            if (inserted) {
+                endpoint.fields[header.entityId].push_back(header.field);
+                return (true);
+            }
+            const auto delta = static_cast<int16_t>(static_cast<uint16_t>(header.sequence - it->second));
+            if (delta <= 0)
+                return (false);
+            it->second = header.sequence;
+            return (true);
+        }
+
+        /**
+         * @brief Forget every sequence number of an endpoint.
+         */
+        void erase(const sockaddr_in &from)
+        {
+            _endpoints.erase(DatagramAggregator::endpointKey(from));
+        }
+
+        /**
+         * @brief Forget the sequence numbers of an entity, once it despawned:
+         * the sender numbers its states from the start again if it comes back.
+         */
+        void forget(const sockaddr_in &from, const uint32_t &entityId)
+        {
+            auto endpoint = _endpoints.find(DatagramAggregator::endpointKey(from));
+            if (endpoint == _endpoints.end())
+                return;
+            auto it = endpoint->second.fields.find(entityId);
+            if (it == endpoint->second.fields.end())
+                return;
+            for (const uint16_t &field : it->second)
+                endpoint->second.lastSequences.erase(StateHeader{entityId, field, 0}.key());
+            endpoint->second.fields.erase(it);
+        }
+
+    private:
+        struct Endpoint {
+            std::unordered_map<uint64_t, uint16_t> lastSequences;
+            std::unordered_map<uint32_t, std::vector<uint16_t>> fields;
+        };
+
+        std::unordered_map<uint64_t, Endpoint> _endpoints;
+};
@@ -0,0 +1,119 @@
+//
+// Created by Florian Damiot on 19/10/2026.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+#define CACHE_LINE_SIZE 64
+
+/**
+ * @brief Bounded lock-free queue for many producers and a single consumer.
+ *
+ * Every cell carries a sequence number telling whether it is free for the producer
+ * of a given position or ready for the consumer (Vyukov bounded queue).
+ * Cells and both ends of the queue sit on their own cache line,
+ * so producers and the consumer do not invalidate each other's lines.
+ * @tparam T The type of the values, must be default constructible and movable.
+ */
+template<typename T>
+class MpscQueue {
+    public:
+        /**
+         * @brief Construct a new Mpsc Queue object.
+         * @param capacity The number of values the queue can hold, rounded up to a power of two.
+         */
+        explicit MpscQueue(const size_t &capacity)
+        {
+            size_t size = 2;
+            while (size < capacity)
+                size <<= 1;
+            _mask = size - 1;
+            _cells = std::unique_ptr<Cell[]>(new Cell[size]);
+            for (size_t i = 0; i < size; i++)
+                _cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        MpscQueue(const MpscQueue &) = delete;
+        MpscQueue &operator=(const MpscQueue &) = delete;
+
+        /**
+         * @brief Push a value, can be called from any thread.
+         * @return false if the queue is full, the value is left untouched.
+         */
+        bool tryPush(T &&value)
+        {
+            size_t position = _tail.load(std::memory_order_relaxed);
+            Cell *cell;
+
+            while (true) {
+                cell = &_cells[position & _mask];
+                const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                const auto difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+                if (difference == 0) {
+                    if (_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                        break;
+                } else if (difference < 0) {
+                    return false;
+                } else {
+                    position = _tail.load(std::memory_order_relaxed);
+                }
+            }
+            cell->value = std::move(value);
+            cell->sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * @brief Pop the oldest value, must only be called from the consumer thread.
+         * @return false if the queue is empty.
+         */
+        bool tryPop(T &value)
+        {
+            const size_t head = _head.load(std::memory_order_relaxed);
+            Cell &cell = _cells[head & _mask];
+
+            if (cell.sequence.load(std::memory_order_acquire) != head + 1)
+                return false;
+            value = std::move(cell.value);
+            cell.sequence.store(head + _mask + 1, std::memory_order_release);
+            _head.store(head + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        /**
+         * @brief Number of values in the queue, only exact when no producer is pushing.
+         * Can be called from any thread.
+         */
+        size_t sizeApprox() const
+        {
+            const size_t head = _head.load(std::memory_order_relaxed);
+            const size_t tail = _tail.load(std::memory_order_relaxed);
+            return tail > head ? tail - head : 0;
+        }
+
+        size_t capacity() const
+        {
+            return _mask + 1;
+        }
+
+    private:
+        struct alignas(CACHE_LINE_SIZE) Cell {
+            std::atomic<size_t> sequence{0};
+            T value{};
+        };
+
+        size_t _mask = 0;
+        std::unique_ptr<Cell[]> _cells;
+
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> _tail{0};
+        // Only written by the consumer, atomic so sizeApprox() can read it from any thread
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> _head{0};
+};
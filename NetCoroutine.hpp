@@ -0,0 +1,245 @@
+//
+// Created by Florian Damiot on 19/10/2026.
+//
+
+#pragma once
+
+#include "./EventLoop.hpp"
+#include "./NetworkUtils.hpp"
+#include "./PacketBufferPool.hpp"
+
+#include <chrono>
+#include <coroutine>
+#include <cstring>
+#include <exception>
+#include <optional>
+#include <span>
+#include <vector>
+
+/**
+ * @brief Return type of a session coroutine.
+ * The coroutine starts right away and frees its frame when it returns,
+ * every resumption happens on the event loop thread.
+ */
+class NetTask {
+    public:
+        struct promise_type {
+            NetTask get_return_object() { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+};
+
+/**
+ * @brief What happens to a packet arriving while the inbox of a session is full.
+ */
+enum class SessionOverflow {
+    // The packet is dropped and the session goes on
+    Drop,
+    // The client is disconnected, for sessions that cannot miss a packet
+    Disconnect
+};
+
+/**
+ * @brief Packets of a client read by a session coroutine instead of the EventRegistry.
+ * Owned by the NetSession, the TcpManager only references it while it lives.
+ * Only used from the event loop thread.
+ */
+struct SessionMailbox {
+    // Copy the payload into the suspended awaiter, false if it is not a valid event
+    using DeliverFunction = bool (*)(void *awaiter, std::span<const std::byte> data);
+
+    int socket = -1;
+    bool closed = false;
+
+    // Set while a recv() is suspended
+    std::coroutine_handle<> receiver = nullptr;
+    uint32_t awaitedPacketId = 0;
+    void *receiveAwaiter = nullptr;
+    DeliverFunction deliver = nullptr;
+
+    // Packets received while no recv() was waiting for them, at most inboxCapacity
+    std::vector<NetPacket> inbox;
+    size_t inboxCapacity = 256;
+    SessionOverflow overflow = SessionOverflow::Drop;
+
+    // Set while a send() waits for the output of the client to drain
+    std::coroutine_handle<> drainWaiter = nullptr;
+
+    // Set while a sleep_for() waits for its timer, cancelled on close
+    EventLoop *loop = nullptr;
+    std::coroutine_handle<> sleeper = nullptr;
+    EventLoop::TimerId sleepTimer = TimerWheel::InvalidTimer;
+
+    /**
+     * @brief Give a received packet to the waiting recv(), or keep it for a later one.
+     * @return false if the inbox is full, the packet is not kept.
+     */
+    bool push(const uint32_t &packetId, std::span<const std::byte> data)
+    {
+        if (receiver && packetId == awaitedPacketId && deliver(receiveAwaiter, data)) {
+            std::coroutine_handle<> handle = receiver;
+            receiver = nullptr;
+            handle.resume();
+            return true;
+        }
+        if (inbox.size() >= inboxCapacity)
+            return false;
+        inbox.push_back(NetPacket{static_cast<int>(packetId), PacketBufferPool::getDefault().acquire(data)});
+        return true;
+    }
+
+    /**
+     * @brief Wake the send() waiting for the output to drain.
+     */
+    void drained()
+    {
+        if (!drainWaiter)
+            return;
+        std::coroutine_handle<> handle = drainWaiter;
+        drainWaiter = nullptr;
+        handle.resume();
+    }
+
+    /**
+     * @brief Mark the client as disconnected and wake every waiting operation, they fail.
+     */
+    void close()
+    {
+        closed = true;
+        inbox.clear();
+        if (receiver) {
+            std::coroutine_handle<> handle = receiver;
+            receiver = nullptr;
+            handle.resume();
+        }
+        drained();
+        wake();
+    }
+
+    /**
+     * @brief Cancel the timer of the waiting sleep_for() and resume it now.
+     */
+    void wake()
+    {
+        if (!sleeper)
+            return;
+        loop->cancel(sleepTimer);
+        sleepTimer = TimerWheel::InvalidTimer;
+        std::coroutine_handle<> handle = sleeper;
+        sleeper = nullptr;
+        handle.resume();
+    }
+};
+
+/**
+ * @brief Awaiter of NetSession::recv(), gives the next event of a packet id,
+ * or std::nullopt once the client is disconnected.
+ * It lives in the coroutine frame, waiting for a packet does not allocate.
+ */
+template<typename EventType>
+class RecvAwaiter {
+    public:
+        RecvAwaiter(SessionMailbox &mailbox, const uint32_t &packetId) : _mailbox(mailbox), _packetId(packetId)
+        {
+
+        }
+
+        bool await_ready()
+        {
+            if (_mailbox.closed)
+                return true;
+            for (auto it = _mailbox.inbox.begin(); it != _mailbox.inbox.end(); it++) {
+                if (static_cast<uint32_t>(it->packetId) == _packetId && deliverTo(this, it->data)) {
+                    _mailbox.inbox.erase(it);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            _mailbox.receiver = handle;
+            _mailbox.awaitedPacketId = _packetId;
+            _mailbox.receiveAwaiter = this;
+            _mailbox.deliver = &RecvAwaiter::deliverTo;
+        }
+
+        std::optional<EventType> await_resume()
+        {
+            return _event;
+        }
+
+    private:
+        static bool deliverTo(void *awaiter, std::span<const std::byte> data)
+        {
+            if (data.size() < sizeof(EventType))
+                return false;
+            EventType event;
+            memcpy(&event, data.data(), sizeof(EventType));
+            static_cast<RecvAwaiter *>(awaiter)->_event = event;
+            return true;
+        }
+
+        SessionMailbox &_mailbox;
+        uint32_t _packetId;
+        std::optional<EventType> _event;
+};
+
+/**
+ * @brief Awaiter suspending a coroutine until a deadline, resumed by the event loop timers.
+ * With a mailbox, the sleep ends early once the session is closed and gives false.
+ */
+class SleepAwaiter {
+    public:
+        SleepAwaiter(EventLoop &loop, const EventLoop::Clock::time_point &deadline, SessionMailbox *mailbox = nullptr)
+                     : _loop(loop), _deadline(deadline), _mailbox(mailbox)
+        {
+
+        }
+
+        bool await_ready() const
+        {
+            return (_mailbox != nullptr && _mailbox->closed) || _deadline <= EventLoop::Clock::now();
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            if (_mailbox == nullptr) {
+                _loop.schedule(_deadline, [handle] { handle.resume(); });
+                return;
+            }
+            // The coroutine frame holds the session, the mailbox outlives the timer
+            SessionMailbox *mailbox = _mailbox;
+            mailbox->loop = &_loop;
+            mailbox->sleeper = handle;
+            mailbox->sleepTimer = _loop.schedule(_deadline, [mailbox] {
+                mailbox->sleepTimer = TimerWheel::InvalidTimer;
+                std::coroutine_handle<> sleeper = mailbox->sleeper;
+                mailbox->sleeper = nullptr;
+                sleeper.resume();
+            });
+        }
+
+        bool await_resume() const
+        {
+            return _mailbox == nullptr || !_mailbox->closed;
+        }
+
+    private:
+        EventLoop &_loop;
+        EventLoop::Clock::time_point _deadline;
+        SessionMailbox *_mailbox;
+};
+
+/**
+ * @brief Suspend the coroutine for a duration, must be awaited from the loop thread.
+ */
+template<typename Rep, typename Period>
+SleepAwaiter sleep_for(EventLoop &loop, const std::chrono::duration<Rep, Period> &duration)
+{
+    return {loop, EventLoop::Clock::now() + std::chrono::duration_cast<EventLoop::Clock::duration>(duration)};
+}
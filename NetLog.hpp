@@ -0,0 +1,508 @@
+//
+// Created by Florian Damiot on 19/10/2026.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+enum class LogLevel : uint8_t {
+    Trace,
+    Debug,
+    Info,
+    Warn,
+    Error,
+    Off
+};
+
+// Lowest level compiled in, 0 for Trace to 5 for Off. The log calls below it
+// are discarded at compile time, their arguments are not even evaluated.
+#ifndef NET_LOG_LEVEL
+#define NET_LOG_LEVEL 2
+#endif
+
+#define NET_LOG(level, ...) \
+    do { \
+        if constexpr (static_cast<int>(level) >= NET_LOG_LEVEL) \
+            NetLogger::get().log(level, __VA_ARGS__); \
+    } while (false)
+
+#define NET_LOG_TRACE(...) NET_LOG(LogLevel::Trace, __VA_ARGS__)
+#define NET_LOG_DEBUG(...) NET_LOG(LogLevel::Debug, __VA_ARGS__)
+#define NET_LOG_INFO(...) NET_LOG(LogLevel::Info, __VA_ARGS__)
+#define NET_LOG_WARN(...) NET_LOG(LogLevel::Warn, __VA_ARGS__)
+#define NET_LOG_ERROR(...) NET_LOG(LogLevel::Error, __VA_ARGS__)
+
+/**
+ * @brief Byte ring of log records, written by one thread and read by the logger thread.
+ * A record that does not fit is dropped, logging never blocks the caller.
+ */
+class LogRing {
+    public:
+        static constexpr size_t Capacity = 64 * 1024;
+
+        /**
+         * @brief Room for a record of the given size, nullptr if the ring is full.
+         * The record is visible to the reader once commit() is called.
+         */
+        std::byte *reserve(const size_t &size)
+        {
+            uint64_t head = _head.load(std::memory_order_relaxed);
+            const uint64_t tail = _tail.load(std::memory_order_acquire);
+            const size_t offset = head % Capacity;
+            const size_t contiguous = Capacity - offset;
+            // A record never wraps, the end of the ring is skipped instead
+            const size_t needed = contiguous < size ? contiguous + size : size;
+
+            if (size > Capacity / 4 || Capacity - (head - tail) < needed) {
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            if (contiguous < size) {
+                // Records are 8 byte aligned, so the skipped end has room for its size and marker
+                const uint32_t skip = static_cast<uint32_t>(contiguous);
+                memcpy(_data.get() + offset, &skip, sizeof(skip));
+                _data[offset + sizeof(skip)] = static_cast<std::byte>(SkipMarker);
+                head += contiguous;
+                _head.store(head, std::memory_order_release);
+            }
+            return _data.get() + head % Capacity;
+        }
+
+        void commit(const size_t &size)
+        {
+            _head.store(_head.load(std::memory_order_relaxed) + size, std::memory_order_release);
+        }
+
+        /**
+         * @brief Call a function with every committed record, then free them.
+         */
+        template<typename RecordFunction>
+        size_t drain(const RecordFunction &onRecord)
+        {
+            const uint64_t head = _head.load(std::memory_order_acquire);
+            uint64_t tail = _tail.load(std::memory_order_relaxed);
+            size_t count = 0;
+
+            while (tail != head) {
+                const std::byte *record = _data.get() + tail % Capacity;
+                uint32_t size;
+                memcpy(&size, record, sizeof(size));
+                if (static_cast<uint8_t>(record[sizeof(size)]) != SkipMarker) {
+                    onRecord(record, size);
+                    count++;
+                }
+                tail += size;
+            }
+            _tail.store(tail, std::memory_order_release);
+            return count;
+        }
+
+        uint64_t takeDropped()
+        {
+            return _dropped.exchange(0, std::memory_order_relaxed);
+        }
+
+        bool empty() const
+        {
+            return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+        }
+
+        // Set while a thread writes to the ring, an unowned empty ring is reused by the next thread
+        std::atomic<bool> owned = true;
+        uint32_t threadNumber = 0;
+
+        // Every record starts with its size then its level
+        static constexpr size_t RecordHeaderSize = 24;
+        // In place of the level when the end of the ring is skipped
+        static constexpr uint8_t SkipMarker = 0xFF;
+
+    private:
+        std::unique_ptr<std::byte[]> _data = std::make_unique<std::byte[]>(Capacity);
+        alignas(64) std::atomic<uint64_t> _head = 0;
+        alignas(64) std::atomic<uint64_t> _tail = 0;
+        std::atomic<uint64_t> _dropped = 0;
+};
+
+/**
+ * @brief Asynchronous logger: the calling thread only copies the format pointer and the raw
+ * arguments into its own ring, the logger thread formats and writes them.
+ * Formats are string literals with {} placeholders, e.g.
+ * NET_LOG_INFO("Accepted connection from {}:{}", ip, port).
+ * Info and below go to stdout, warnings and errors to stderr.
+ * Records of one thread keep their order, records of different threads may interleave late.
+ */
+class NetLogger {
+    public:
+        /**
+         * @brief The process wide logger, never destroyed: it flushes and logs synchronously
+         * once exit() started, for the objects destroyed after it.
+         */
+        static NetLogger &get()
+        {
+            static NetLogger *logger = [] {
+                auto *created = new NetLogger();
+                std::atexit([] { get().shutdown(); });
+                return created;
+            }();
+            return *logger;
+        }
+
+        /**
+         * @brief Skip the records below a level at runtime, on top of NET_LOG_LEVEL.
+         */
+        void setLevel(const LogLevel &level)
+        {
+            _level.store(level, std::memory_order_relaxed);
+        }
+
+        template<size_t N, typename... Args>
+        void log(const LogLevel &level, const char (&format)[N], const Args &... args)
+        {
+            if (level < _level.load(std::memory_order_relaxed))
+                return;
+            if (_stopped.load(std::memory_order_acquire)) {
+                writeNow(level, format, args...);
+                return;
+            }
+            const size_t size = align(LogRing::RecordHeaderSize + (argumentSize(args) + ... + 0));
+            LogRing &ring = localRing();
+            std::byte *record = ring.reserve(size);
+            if (record == nullptr)
+                return;
+
+            const auto header = RecordHeader{static_cast<uint32_t>(size), static_cast<uint8_t>(level),
+                                             static_cast<uint8_t>(sizeof...(Args)), 0, nowNs(), format};
+            memcpy(record, &header, sizeof(header));
+            [[maybe_unused]] std::byte *out = record + sizeof(header);
+            (writeArgument(out, args), ...);
+            ring.commit(size);
+        }
+
+        /**
+         * @brief Write every record logged so far.
+         */
+        void flush()
+        {
+            drainAll();
+        }
+
+    private:
+        NetLogger()
+        {
+            _thread = std::thread([this] { run(); });
+        }
+
+        struct RecordHeader {
+            uint32_t size;
+            uint8_t level;
+            uint8_t argumentCount;
+            uint16_t unused;
+            uint64_t timestamp;
+            const char *format;
+        };
+        static_assert(sizeof(RecordHeader) == LogRing::RecordHeaderSize);
+
+        enum class ArgumentType : uint8_t {
+            Signed,
+            Unsigned,
+            Float,
+            Bool,
+            String,
+            Pointer
+        };
+
+        // Strings longer than that are cut, a record must fit in a quarter of the ring
+        static constexpr size_t MaxStringSize = 1024;
+
+        static size_t align(const size_t &size)
+        {
+            return (size + 7) & ~size_t(7);
+        }
+
+        static uint64_t nowNs()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+
+        template<typename T>
+        static std::string_view asString(const T &value)
+        {
+            if constexpr (std::is_convertible_v<T, std::string_view>)
+                return std::string_view(value).substr(0, MaxStringSize);
+            else
+                return std::string_view(value == nullptr ? "(null)" : value).substr(0, MaxStringSize);
+        }
+
+        template<typename T>
+        static constexpr bool isString()
+        {
+            return std::is_convertible_v<T, std::string_view>
+                   || std::is_same_v<std::decay_t<T>, const char *> || std::is_same_v<std::decay_t<T>, char *>;
+        }
+
+        template<typename T>
+        static size_t argumentSize(const T &value)
+        {
+            if constexpr (isString<T>())
+                return 1 + sizeof(uint32_t) + asString(value).size();
+            else
+                return 1 + sizeof(uint64_t);
+        }
+
+        template<typename T>
+        static void writeArgument(std::byte *&out, const T &value)
+        {
+            auto put = [&out](const ArgumentType &type, const void *data, const size_t &size) {
+                *out++ = static_cast<std::byte>(type);
+                memcpy(out, data, size);
+                out += size;
+            };
+
+            if constexpr (isString<T>()) {
+                const std::string_view string = asString(value);
+                const auto size = static_cast<uint32_t>(string.size());
+                put(ArgumentType::String, &size, sizeof(size));
+                memcpy(out, string.data(), string.size());
+                out += string.size();
+            } else if constexpr (std::is_same_v<T, bool>) {
+                const uint64_t raw = value;
+                put(ArgumentType::Bool, &raw, sizeof(raw));
+            } else if constexpr (std::is_enum_v<T>) {
+                writeArgument(out, static_cast<std::underlying_type_t<T>>(value));
+            } else if constexpr (std::is_floating_point_v<T>) {
+                const double raw = value;
+                put(ArgumentType::Float, &raw, sizeof(raw));
+            } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+                const int64_t raw = value;
+                put(ArgumentType::Signed, &raw, sizeof(raw));
+            } else if constexpr (std::is_integral_v<T>) {
+                const uint64_t raw = value;
+                put(ArgumentType::Unsigned, &raw, sizeof(raw));
+            } else if constexpr (std::is_pointer_v<T>) {
+                const auto raw = reinterpret_cast<uint64_t>(value);
+                put(ArgumentType::Pointer, &raw, sizeof(raw));
+            } else if constexpr (std::is_same_v<T, std::thread::id>) {
+                const uint64_t raw = std::hash<std::thread::id>{}(value);
+                put(ArgumentType::Unsigned, &raw, sizeof(raw));
+            } else {
+                static_assert(sizeof(T) == 0, "Unsupported log argument type");
+            }
+        }
+
+        LogRing &localRing()
+        {
+            // Gives the ring back when the thread exits
+            struct Owner {
+                LogRing *ring = nullptr;
+
+                ~Owner()
+                {
+                    if (ring != nullptr)
+                        ring->owned.store(false, std::memory_order_release);
+                }
+            };
+            thread_local Owner owner;
+
+            if (owner.ring == nullptr) {
+                std::lock_guard<std::mutex> lock(_ringsMutex);
+                for (auto &ring : _rings) {
+                    if (!ring->owned.load(std::memory_order_acquire) && ring->empty()) {
+                        ring->owned.store(true, std::memory_order_relaxed);
+                        owner.ring = ring.get();
+                        break;
+                    }
+                }
+                if (owner.ring == nullptr) {
+                    _rings.push_back(std::make_unique<LogRing>());
+                    _rings.back()->threadNumber = static_cast<uint32_t>(_rings.size());
+                    owner.ring = _rings.back().get();
+                }
+            }
+            return *owner.ring;
+        }
+
+        void run()
+        {
+            while (!_stopping.load(std::memory_order_acquire)) {
+                // Nothing wakes the thread up, logging stays free of system calls
+                if (drainAll() == 0)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+
+        size_t drainAll()
+        {
+            std::lock_guard<std::mutex> drainLock(_drainMutex);
+            std::vector<LogRing *> rings;
+            {
+                std::lock_guard<std::mutex> lock(_ringsMutex);
+                for (auto &ring : _rings)
+                    rings.push_back(ring.get());
+            }
+
+            size_t count = 0;
+            for (LogRing *ring : rings) {
+                count += ring->drain([this, ring](const std::byte *record, const size_t &size) {
+                    formatRecord(record, size, ring->threadNumber);
+                });
+                if (const uint64_t dropped = ring->takeDropped(); dropped > 0) {
+                    formatPrefix(_stderrBuffer, LogLevel::Warn, nowNs(), ring->threadNumber);
+                    _stderrBuffer += std::to_string(dropped) + " log records dropped, the ring was full\n";
+                }
+            }
+            writeBuffers();
+            return count;
+        }
+
+        void formatRecord(const std::byte *record, const size_t &size, const uint32_t &threadNumber)
+        {
+            RecordHeader header{};
+            memcpy(&header, record, sizeof(header));
+            const auto level = static_cast<LogLevel>(header.level);
+            std::string &out = level >= LogLevel::Warn ? _stderrBuffer : _stdoutBuffer;
+            const std::byte *argument = record + sizeof(header);
+            const std::byte *end = record + size;
+
+            formatPrefix(out, level, header.timestamp, threadNumber);
+            uint8_t remaining = header.argumentCount;
+            for (const char *c = header.format; *c != '\0'; c++) {
+                if (c[0] == '{' && c[1] == '}' && remaining > 0) {
+                    argument = formatArgument(out, argument, end);
+                    remaining--;
+                    c++;
+                    continue;
+                }
+                out += *c;
+            }
+            out += '\n';
+        }
+
+        static const std::byte *formatArgument(std::string &out, const std::byte *argument, const std::byte *end)
+        {
+            if (argument >= end)
+                return end;
+            const auto type = static_cast<ArgumentType>(*argument++);
+            if (type == ArgumentType::String) {
+                uint32_t size;
+                memcpy(&size, argument, sizeof(size));
+                argument += sizeof(size);
+                out.append(reinterpret_cast<const char *>(argument), size);
+                return argument + size;
+            }
+
+            uint64_t raw;
+            memcpy(&raw, argument, sizeof(raw));
+            char text[32];
+            std::to_chars_result result{text, {}};
+            switch (type) {
+                case ArgumentType::Signed:
+                    result = std::to_chars(text, text + sizeof(text), static_cast<int64_t>(raw));
+                    break;
+                case ArgumentType::Unsigned:
+                    result = std::to_chars(text, text + sizeof(text), raw);
+                    break;
+                case ArgumentType::Float: {
+                    double value;
+                    memcpy(&value, &raw, sizeof(value));
+                    result = std::to_chars(text, text + sizeof(text), value);
+                    break;
+                }
+                case ArgumentType::Bool:
+                    out += raw != 0 ? "true" : "false";
+                    break;
+                case ArgumentType::Pointer:
+                    out += "0x";
+                    result = std::to_chars(text, text + sizeof(text), raw, 16);
+                    break;
+                default:
+                    break;
+            }
+            out.append(text, result.ptr);
+            return argument + sizeof(raw);
+        }
+
+        static void formatPrefix(std::string &out, const LogLevel &level, const uint64_t &timestamp,
+                                 const uint32_t &threadNumber)
+        {
+            static constexpr const char *Names[] = {"TRACE", "DEBUG", "INFO ", "WARN ", "ERROR"};
+            const auto seconds = static_cast<time_t>(timestamp / 1000000000);
+            tm local{};
+            localtime_r(&seconds, &local);
+            char text[64];
+            const int length = snprintf(text, sizeof(text), "%02d:%02d:%02d.%06u %s [%u] ",
+                                        local.tm_hour, local.tm_min, local.tm_sec,
+                                        static_cast<unsigned>(timestamp % 1000000000 / 1000),
+                                        Names[std::min<size_t>(static_cast<size_t>(level), 4)], threadNumber);
+            out.append(text, std::max(length, 0));
+        }
+
+        void writeBuffers()
+        {
+            if (!_stdoutBuffer.empty()) {
+                fwrite(_stdoutBuffer.data(), 1, _stdoutBuffer.size(), stdout);
+                fflush(stdout);
+                _stdoutBuffer.clear();
+            }
+            if (!_stderrBuffer.empty()) {
+                fwrite(_stderrBuffer.data(), 1, _stderrBuffer.size(), stderr);
+                fflush(stderr);
+                _stderrBuffer.clear();
+            }
+        }
+
+        // Used once the logger thread is gone
+        template<size_t N, typename... Args>
+        void writeNow(const LogLevel &level, const char (&format)[N], const Args &... args)
+        {
+            const size_t size = align(LogRing::RecordHeaderSize + (argumentSize(args) + ... + 0));
+            std::vector<std::byte> record(size);
+            const auto header = RecordHeader{static_cast<uint32_t>(size), static_cast<uint8_t>(level),
+                                             static_cast<uint8_t>(sizeof...(Args)), 0, nowNs(), format};
+            memcpy(record.data(), &header, sizeof(header));
+            [[maybe_unused]] std::byte *out = record.data() + sizeof(header);
+            (writeArgument(out, args), ...);
+
+            std::lock_guard<std::mutex> lock(_drainMutex);
+            formatRecord(record.data(), size, 0);
+            writeBuffers();
+        }
+
+        void shutdown()
+        {
+            _stopping.store(true, std::memory_order_release);
+            if (_thread.joinable())
+                _thread.join();
+            drainAll();
+            _stopped.store(true, std::memory_order_release);
+        }
+
+    private:
+        std::atomic<LogLevel> _level = LogLevel::Trace;
+        std::vector<std::unique_ptr<LogRing>> _rings;
+        std::mutex _ringsMutex;
+        // Held while formatting, by the logger thread or by flush()
+        std::mutex _drainMutex;
+        std::string _stdoutBuffer;
+        std::string _stderrBuffer;
+        std::atomic<bool> _stopping = false;
+        std::atomic<bool> _stopped = false;
+        std::thread _thread;
+};
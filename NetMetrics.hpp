@@ -0,0 +1,367 @@
+//
+// Created by Florian Damiot on 19/10/2026.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+enum class NetTransport : uint8_t {
+    Tcp,
+    Udp
+};
+
+/**
+ * @brief Merged copy of a LatencyHistogram.
+ */
+struct HistogramSnapshot {
+    std::vector<uint64_t> buckets;
+    uint64_t count = 0;
+    uint64_t sum = 0;
+
+    /**
+     * @brief The value below which the given ratio of the recorded values are, e.g. 0.99.
+     * Exact to the bucket, within 1/16 of the value.
+     */
+    uint64_t percentile(const double &ratio) const;
+
+    uint64_t mean() const
+    {
+        return count == 0 ? 0 : sum / count;
+    }
+
+    void merge(const HistogramSnapshot &other)
+    {
+        if (buckets.size() < other.buckets.size())
+            buckets.resize(other.buckets.size());
+        for (size_t i = 0; i < other.buckets.size(); i++)
+            buckets[i] += other.buckets[i];
+        count += other.count;
+        sum += other.sum;
+    }
+};
+
+/**
+ * @brief Log-linear histogram of durations in nanoseconds, as HdrHistogram does:
+ * each power of two is cut in 16 buckets, so any value is known within 6%
+ * from 1ns to 18 minutes with a fixed array and no allocation when recording.
+ * Written by one thread, read by snapshots from any thread.
+ */
+class LatencyHistogram {
+    public:
+        static constexpr uint32_t SubBits = 4;
+        static constexpr uint64_t SubBuckets = 1 << SubBits;
+        // Values are clamped below 2^40 ns
+        static constexpr uint32_t MaxBits = 40;
+        static constexpr size_t BucketCount = (MaxBits - SubBits) * SubBuckets + SubBuckets;
+
+        void record(const uint64_t &value)
+        {
+            increment(_buckets[bucketOf(value)], 1);
+            increment(_count, 1);
+            increment(_sum, value);
+        }
+
+        static size_t bucketOf(uint64_t value)
+        {
+            value = std::min<uint64_t>(value, (uint64_t(1) << MaxBits) - 1);
+            if (value < SubBuckets)
+                return static_cast<size_t>(value);
+            // The top SubBits + 1 bits of the value pick the bucket inside its power of two
+            const uint32_t shift = std::bit_width(value) - SubBits - 1;
+            return (shift + 1) * SubBuckets + ((value >> shift) - SubBuckets);
+        }
+
+        /**
+         * @brief The highest value of a bucket.
+         */
+        static uint64_t bucketValue(const size_t &bucket)
+        {
+            if (bucket < SubBuckets)
+                return bucket;
+            const uint64_t shift = bucket / SubBuckets - 1;
+            return (((bucket % SubBuckets) + SubBuckets + 1) << shift) - 1;
+        }
+
+        void addTo(HistogramSnapshot &snapshot) const
+        {
+            if (snapshot.buckets.size() < BucketCount)
+                snapshot.buckets.resize(BucketCount);
+            for (size_t i = 0; i < BucketCount; i++)
+                snapshot.buckets[i] += _buckets[i].load(std::memory_order_relaxed);
+            snapshot.count += _count.load(std::memory_order_relaxed);
+            snapshot.sum += _sum.load(std::memory_order_relaxed);
+        }
+
+    private:
+        // Only the owner thread writes, a plain load and store is enough and cheaper than a locked add
+        static void increment(std::atomic<uint64_t> &counter, const uint64_t &value)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+
+    private:
+        std::array<std::atomic<uint64_t>, BucketCount> _buckets{};
+        std::atomic<uint64_t> _count = 0;
+        std::atomic<uint64_t> _sum = 0;
+};
+
+inline uint64_t HistogramSnapshot::percentile(const double &ratio) const
+{
+    if (count == 0)
+        return 0;
+    const auto rank = static_cast<uint64_t>(ratio * static_cast<double>(count - 1));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); i++) {
+        seen += buckets[i];
+        if (seen > rank)
+            return LatencyHistogram::bucketValue(i);
+    }
+    return LatencyHistogram::bucketValue(buckets.size() - 1);
+}
+
+/**
+ * @brief Metrics of one packet id on one transport, as seen by one thread.
+ */
+class PacketMetrics {
+    public:
+        void addReceived(const uint64_t &bytes)
+        {
+            increment(_received, 1);
+            increment(_receivedBytes, bytes);
+        }
+
+        void addSent(const uint64_t &bytes)
+        {
+            increment(_sent, 1);
+            increment(_sentBytes, bytes);
+        }
+
+        // Time to deserialize the event
+        LatencyHistogram decode;
+        // Time spent in the handlers
+        LatencyHistogram handler;
+        // Time from the kernel receiving the packet to a handler starting, see SocketTelemetryConfig
+        LatencyHistogram kernelToHandler;
+
+    private:
+        friend class NetMetrics;
+
+        static void increment(std::atomic<uint64_t> &counter, const uint64_t &value)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+
+        std::atomic<uint64_t> _received = 0;
+        std::atomic<uint64_t> _receivedBytes = 0;
+        std::atomic<uint64_t> _sent = 0;
+        std::atomic<uint64_t> _sentBytes = 0;
+};
+
+/**
+ * @brief Merged metrics of one packet id on one transport.
+ */
+struct PacketMetricsSnapshot {
+    NetTransport transport = NetTransport::Tcp;
+    uint32_t packetId = 0;
+    uint64_t received = 0;
+    uint64_t receivedBytes = 0;
+    uint64_t sent = 0;
+    uint64_t sentBytes = 0;
+    HistogramSnapshot decode;
+    HistogramSnapshot handler;
+    HistogramSnapshot kernelToHandler;
+};
+
+/**
+ * @brief Per packet id and per transport counters and latency histograms.
+ *
+ * Every thread recording gets its own shard, so recording is a few relaxed stores
+ * with no lock and no shared cache line. snapshot() merges the shards on demand
+ * and can run at any time from any thread.
+ */
+class NetMetrics {
+    public:
+        NetMetrics() : _instance(_nextInstance.fetch_add(1, std::memory_order_relaxed))
+        {
+
+        }
+
+        NetMetrics(const NetMetrics &) = delete;
+        NetMetrics &operator=(const NetMetrics &) = delete;
+
+        /**
+         * @brief The metrics of a packet id in the shard of the calling thread.
+         * @return nullptr if the shard already tracks too many packet ids, see getUntracked().
+         */
+        PacketMetrics *local(const NetTransport &transport, const uint32_t &packetId)
+        {
+            return localShard().find(keyOf(transport, packetId));
+        }
+
+        /**
+         * @brief Merge the shards of every thread.
+         * @return The metrics of each packet id seen, sorted by transport then packet id.
+         */
+        std::vector<PacketMetricsSnapshot> snapshot() const
+        {
+            std::map<uint64_t, PacketMetricsSnapshot> merged;
+            std::lock_guard<std::mutex> lock(_shardsMutex);
+
+            for (const auto &shard : _shards) {
+                shard->forEach([&merged](const uint64_t &key, const PacketMetrics &metrics) {
+                    PacketMetricsSnapshot &entry = merged[key];
+                    entry.transport = static_cast<NetTransport>(key >> 32);
+                    entry.packetId = static_cast<uint32_t>(key);
+                    entry.received += metrics._received.load(std::memory_order_relaxed);
+                    entry.receivedBytes += metrics._receivedBytes.load(std::memory_order_relaxed);
+                    entry.sent += metrics._sent.load(std::memory_order_relaxed);
+                    entry.sentBytes += metrics._sentBytes.load(std::memory_order_relaxed);
+                    metrics.decode.addTo(entry.decode);
+                    metrics.handler.addTo(entry.handler);
+                    metrics.kernelToHandler.addTo(entry.kernelToHandler);
+                });
+            }
+            std::vector<PacketMetricsSnapshot> result;
+            result.reserve(merged.size());
+            for (auto &[key, entry] : merged)
+                result.push_back(std::move(entry));
+            return result;
+        }
+
+        /**
+         * @brief Records dropped because a shard ran out of packet id slots.
+         */
+        uint64_t getUntracked() const
+        {
+            uint64_t untracked = 0;
+            std::lock_guard<std::mutex> lock(_shardsMutex);
+            for (const auto &shard : _shards)
+                untracked += shard->untracked.load(std::memory_order_relaxed);
+            return untracked;
+        }
+
+        /**
+         * @brief Count packets the kernel dropped before we could read them, see SocketTelemetryConfig.
+         */
+        void addKernelDrops(const NetTransport &transport, const uint64_t &drops)
+        {
+            _kernelDrops[static_cast<size_t>(transport)].fetch_add(drops, std::memory_order_relaxed);
+        }
+
+        uint64_t getKernelDrops(const NetTransport &transport) const
+        {
+            return _kernelDrops[static_cast<size_t>(transport)].load(std::memory_order_relaxed);
+        }
+
+        static uint64_t nowNs()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        /**
+         * @brief Time since a kernel receive timestamp, which is on the wall clock.
+         * @return 0 if the wall clock stepped back since.
+         */
+        static uint64_t wallElapsedNs(const uint64_t &sinceNs)
+        {
+            const uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            return now > sinceNs ? now - sinceNs : 0;
+        }
+
+    private:
+        /**
+         * Open addressing table of the packet ids seen by one thread.
+         * Only the owner thread inserts: it publishes the metrics before the key,
+         * so a snapshot seeing a key always sees its metrics.
+         */
+        class Shard {
+            public:
+                static constexpr size_t Slots = 512;
+
+                PacketMetrics *find(const uint64_t &key)
+                {
+                    const uint64_t stored = key + 1;
+                    size_t slot = hash(key);
+                    for (size_t probe = 0; probe < Slots; probe++) {
+                        Entry &entry = _entries[slot];
+                        const uint64_t current = entry.key.load(std::memory_order_relaxed);
+                        if (current == stored)
+                            return entry.metrics.get();
+                        if (current == 0) {
+                            entry.metrics = std::make_unique<PacketMetrics>();
+                            entry.key.store(stored, std::memory_order_release);
+                            return entry.metrics.get();
+                        }
+                        slot = (slot + 1) % Slots;
+                    }
+                    untracked.store(untracked.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                    return nullptr;
+                }
+
+                template<typename Function>
+                void forEach(const Function &function) const
+                {
+                    for (const Entry &entry : _entries) {
+                        const uint64_t stored = entry.key.load(std::memory_order_acquire);
+                        if (stored != 0)
+                            function(stored - 1, *entry.metrics);
+                    }
+                }
+
+                std::atomic<uint64_t> untracked = 0;
+
+            private:
+                struct Entry {
+                    // Key + 1, 0 for a free slot
+                    std::atomic<uint64_t> key = 0;
+                    std::unique_ptr<PacketMetrics> metrics;
+                };
+
+                static size_t hash(const uint64_t &key)
+                {
+                    return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) % Slots;
+                }
+
+                std::array<Entry, Slots> _entries{};
+        };
+
+        static uint64_t keyOf(const NetTransport &transport, const uint32_t &packetId)
+        {
+            return (static_cast<uint64_t>(transport) << 32) | packetId;
+        }
+
+        Shard &localShard()
+        {
+            // Keyed by instance number rather than address, a new instance may reuse a freed address
+            thread_local std::vector<std::pair<uint64_t, Shard *>> shards;
+            for (const auto &[instance, shard] : shards)
+                if (instance == _instance)
+                    return *shard;
+            std::lock_guard<std::mutex> lock(_shardsMutex);
+            _shards.push_back(std::make_unique<Shard>());
+            shards.emplace_back(_instance, _shards.back().get());
+            return *_shards.back();
+        }
+
+    private:
+        uint64_t _instance;
+        // Shards live as long as the metrics, even once their thread exited
+        std::vector<std::unique_ptr<Shard>> _shards;
+        mutable std::mutex _shardsMutex;
+        std::array<std::atomic<uint64_t>, 2> _kernelDrops{};
+
+        inline static std::atomic<uint64_t> _nextInstance = 1;
+};
@@ -0,0 +1,125 @@
+//
+// Created by Florian Damiot on 19/10/2026.
+//
+
+#pragma once
+
+#include "./TcpManager.hpp"
+#include "./NetCoroutine.hpp"
+
+#include <chrono>
+#include <memory>
+
+/**
+ * @brief Awaiter of NetSession::send(), the event is written when awaited
+ * and the coroutine only suspends while the client's output is waiting for the socket.
+ * Gives false if the client is disconnected.
+ */
+template<typename EventType>
+class SendAwaiter {
+    public:
+        SendAwaiter(TcpManager &manager, SessionMailbox &mailbox, const uint32_t &packetId, const EventType &event)
+                    : _manager(manager), _mailbox(mailbox), _packetId(packetId), _event(event)
+        {
+
+        }
+
+        bool await_ready()
+        {
+            if (_mailbox.closed)
+                return true;
+            _sent = _manager.sendEvent(_mailbox.socket, static_cast<int>(_packetId), _event) >= 0;
+            return !_sent || !_manager.hasPendingOutput(_mailbox.socket);
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            _mailbox.drainWaiter = handle;
+        }
+
+        bool await_resume() const
+        {
+            return _sent && !_mailbox.closed;
+        }
+
+    private:
+        TcpManager &_manager;
+        SessionMailbox &_mailbox;
+        uint32_t _packetId;
+        EventType _event;
+        bool _sent = false;
+};
+
+/**
+ * @brief Handle on a client for a session coroutine, so the logic of a session
+ * can be written sequentially without a thread per client:
+ *
+ *     NetTask runSession(NetSession client) {
+ *         while (auto move = co_await client.recv<MoveEvent>(MOVE_ID)) {
+ *             co_await client.send(ACK_ID, AckEvent{});
+ *             co_await client.sleep_for(std::chrono::milliseconds(50));
+ *         }
+ *     }
+ *
+ * Must be created on the loop thread, typically in the connect handler.
+ * While a copy of it lives, usually the one in the coroutine frame, the packets of the client
+ * go to the session instead of the EventRegistry. They go back to the registry once the coroutine ended.
+ */
+class NetSession {
+    public:
+        /**
+         * @param inboxCapacity The packets kept for later recv() calls, see SessionOverflow for the ones beyond.
+         */
+        NetSession(TcpManager &manager, const int &socket, const size_t &inboxCapacity = 256,
+                   const SessionOverflow &overflow = SessionOverflow::Drop)
+                   : _manager(&manager), _mailbox(manager.attachSession(socket, inboxCapacity, overflow))
+        {
+
+        }
+
+        /**
+         * @brief Wait for the next packet with the given id, the other packets are kept for later calls.
+         * @return The event, or std::nullopt once the client is disconnected.
+         */
+        template<typename EventType>
+        RecvAwaiter<EventType> recv(const uint32_t &packetId)
+        {
+            return {*_mailbox, packetId};
+        }
+
+        /**
+         * @brief Send an event, waiting for the output to drain if the socket is full.
+         * @return false once the client is disconnected.
+         */
+        template<typename EventType>
+        SendAwaiter<EventType> send(const uint32_t &packetId, const EventType &event)
+        {
+            return {*_manager, *_mailbox, packetId, event};
+        }
+
+        /**
+         * @brief Wait for a duration, ended early once the client is disconnected or the manager stopped.
+         * @return false once the client is disconnected.
+         */
+        template<typename Rep, typename Period>
+        SleepAwaiter sleep_for(const std::chrono::duration<Rep, Period> &duration)
+        {
+            return {_manager->getEventLoop(),
+                    EventLoop::Clock::now() + std::chrono::duration_cast<EventLoop::Clock::duration>(duration),
+                    _mailbox.get()};
+        }
+
+        int getSocket() const
+        {
+            return _mailbox->socket;
+        }
+
+        bool isConnected() const
+        {
+            return !_mailbox->closed;
+        }
+
+    private:
+        TcpManager *_manager;
+        std::shared_ptr<SessionMailbox> _mailbox;
+};
@@ -0,0 +1,681 @@
+//
+// Created by Florian Damiot on 19/10/2026.
+//
+
+#pragma once
+
+#include "./EventLoop.hpp"
+#include "./EventRegistry.hpp"
+#include "./NetworkUtils.hpp"
+#include "./DatagramAggregator.hpp"
+#include "./LatestValueChannel.hpp"
+#include "./ThreadConfig.hpp"
+#include "./SessionResume.hpp"
+#include "./ClockSync.hpp"
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <netinet/tcp.h>
+#include <sys/uio.h>
+
+/**
+ * @brief Event loop threads shared by many NetworkManagerClient,
+ * so thousands of clients (bots, load tests, headless clients) run on a few threads.
+ * Must outlive its clients.
+ */
+class NetworkClientGroup {
+    public:
+        explicit NetworkClientGroup(const size_t &threadCount = 1, const ThreadPlacement &placement = {"net-client"})
+        {
+            const NumaTopology topology = NumaTopology::detect();
+            for (size_t i = 0; i < std::max<size_t>(threadCount, 1); i++)
+                _loops.push_back(std::make_unique<EventLoop>());
+            for (size_t i = 0; i < _loops.size(); i++) {
+                ThreadPlacement loopPlacement = placement;
+                loopPlacement.name += "-" + std::to_string(i);
+                _threads.emplace_back([this, i, loopPlacement, topology] {
+                    applyThreadPlacement(loopPlacement, topology);
+                    _loops[i]->run();
+                });
+            }
+        }
+
+        ~NetworkClientGroup()
+        {
+            for (auto &loop : _loops)
+                loop->stop();
+            for (auto &thread : _threads)
+                thread.join();
+        }
+
+        NetworkClientGroup(const NetworkClientGroup &) = delete;
+        NetworkClientGroup &operator=(const NetworkClientGroup &) = delete;
+
+        /**
+         * @brief The loop of the next client, clients are spread round robin.
+         */
+        EventLoop &nextLoop()
+        {
+            return *_loops[_next.fetch_add(1, std::memory_order_relaxed) % _loops.size()];
+        }
+
+        size_t getThreadCount() const
+        {
+            return _threads.size();
+        }
+
+    private:
+        std::vector<std::unique_ptr<EventLoop>> _loops;
+        std::vector<std::thread> _threads;
+        std::atomic<size_t> _next = 0;
+};
+
+/**
+ * @brief Client of a NewNetworkManager server, using the same event loop, framing and EventRegistry.
+ *
+ * connect() does not block, and send() can be called right away from any thread:
+ * packets are written without waiting for any answer, what the socket cannot take yet
+ * (or everything while connecting) is queued and written in order once it is writable.
+ * Once connected, the client binds its UDP socket to its TCP connection on the server,
+ * so the server knows which UDP endpoint belongs to which client.
+ * Handlers and connection events run on the loop thread of the client.
+ */
+class NetworkManagerClient {
+    public:
+        /**
+         * @brief Construct a client running on a loop of a shared group.
+         * @param host The address of the server.
+         * @param tcpPort The TCP port of the server.
+         * @param udpPort The UDP port of the server.
+         * @param group The threads running the client.
+         */
+        NetworkManagerClient(std::string host, const unsigned int &tcpPort, const unsigned int &udpPort,
+                             NetworkClientGroup &group)
+                             : _host(std::move(host)), _tcpPort(tcpPort), _udpPort(udpPort), _loop(group.nextLoop())
+        {
+
+        }
+
+        /**
+         * @brief Construct a client with its own loop thread.
+         */
+        NetworkManagerClient(std::string host, const unsigned int &tcpPort, const unsigned int &udpPort)
+                             : _ownedGroup(std::make_unique<NetworkClientGroup>(1)), _host(std::move(host)),
+                               _tcpPort(tcpPort), _udpPort(udpPort), _loop(_ownedGroup->nextLoop())
+        {
+
+        }
+
+        ~NetworkManagerClient()
+        {
+            if (_loop.isInLoopThread()) {
+                closeConnection();
+                return;
+            }
+            disconnect();
+            // Once the tasks posted before run, the loop no longer references the client
+            std::promise<void> done;
+            _loop.post([&done] { done.set_value(); });
+            done.get_future().wait();
+        }
+
+        NetworkManagerClient(const NetworkManagerClient &) = delete;
+        NetworkManagerClient &operator=(const NetworkManagerClient &) = delete;
+
+        /**
+         * @brief Start connecting to the server, without blocking.
+         * @return Becomes true once connected, false if the connection failed.
+         */
+        std::future<bool> connect() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_state != State::Disconnected)
+                throw std::runtime_error("NetworkManagerClient already connected");
+
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = inet_addr(_host == "localhost" ? "127.0.0.1" : _host.c_str());
+            address.sin_port = htons(_tcpPort);
+            _connected = std::promise<bool>();
+            std::future<bool> connected = _connected.get_future();
+
+            _socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            _udpSocket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (_socket == -1 || _udpSocket == -1) {
+                closeSockets();
+                _connected.set_value(false);
+                return connected;
+            }
+            const int noDelay = 1;
+            setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+            if (::connect(_socket, (const struct sockaddr *) &address, sizeof(address)) < 0 && errno != EINPROGRESS) {
+                closeSockets();
+                _connected.set_value(false);
+                return connected;
+            }
+            // A connected UDP socket only receives from the server, and send() needs no address
+            _udpAddress = address;
+            _udpAddress.sin_port = htons(_udpPort);
+            ::connect(_udpSocket, (const struct sockaddr *) &_udpAddress, sizeof(_udpAddress));
+
+            // The session request and the bind token go first, before anything sent while connecting
+            if (_resumeSessions) {
+                const SessionRequest request{_sessionToken, _received};
+                appendOutput(SESSION_PACKET_ID, std::span<const std::byte>(reinterpret_cast<const std::byte *>(&request),
+                                                                           sizeof(request)));
+            }
+            _udpBindToken = generateBindToken();
+            appendOutput(UDP_BIND_PACKET_ID, std::span<const std::byte>(reinterpret_cast<const std::byte *>(&_udpBindToken),
+                                                                        sizeof(_udpBindToken)));
+            _udpBound = false;
+            _state = State::Connecting;
+            const int tcpSocket = _socket;
+            const int udpSocket = _udpSocket;
+            _loop.post([this, tcpSocket, udpSocket] {
+                // The server numbers the states of a new connection from the start again
+                _stateReceiver = LatestValueReceiver();
+                _loop.add(tcpSocket, EPOLLOUT, [this](uint32_t events) { handleTcpEvents(events); });
+                _loop.add(udpSocket, EPOLLIN, [this](uint32_t) { handleDatagrams(); });
+            });
+            return connected;
+        }
+
+        /**
+         * @brief Close the connection, can be called from any thread.
+         * The disconnect handler runs on the loop thread if the client was connected.
+         */
+        void disconnect() {
+            if (_loop.isInLoopThread())
+                closeConnection();
+            else
+                _loop.post([this] { closeConnection(); });
+        }
+
+        /**
+         * @brief Forget the states received for an entity once it despawned, can be called from any thread.
+         * The server numbers them from the start again if it comes back, see UdpManager::forgetState().
+         */
+        void forgetState(const uint32_t &entityId) {
+            if (_loop.isInLoopThread())
+                _stateReceiver.forget(_udpAddress, entityId);
+            else
+                _loop.post([this, entityId] { _stateReceiver.forget(_udpAddress, entityId); });
+        }
+
+        /**
+         * @brief Send an event over TCP, can be called from any thread, even while connecting.
+         * Does not wait for the socket: what it cannot take is queued behind the previous packets.
+         * @return The number of bytes sent or queued, -1 if the client is disconnected.
+         */
+        template<typename EventType>
+        ssize_t send(const uint32_t &eventId, const EventType &event) {
+            PacketBuffer data = _eventRegistry.serializeData(event);
+            std::lock_guard<std::mutex> lock(_mutex);
+            return sendPacket(eventId, data);
+        }
+
+        /**
+         * @brief Queue an event for the server over UDP, sent with the others on the next flushUdp().
+         */
+        template<typename EventType>
+        void sendUdp(const uint32_t &eventId, const EventType &event) {
+            PacketBuffer data = _eventRegistry.serializeData(event);
+            std::lock_guard<std::mutex> lock(_udpMutex);
+            _aggregator.enqueue(_udpAddress, eventId, data);
+        }
+
+        /**
+         * @brief Send the UDP events queued since the last flush, in as few datagrams as possible.
+         * @return The number of datagrams sent.
+         */
+        size_t flushUdp() {
+            std::lock_guard<std::mutex> lock(_udpMutex);
+            return _aggregator.flush([this](const sockaddr_in &, std::span<const std::byte> datagram) {
+                ::send(_udpSocket, datagram.data(), datagram.size(), MSG_NOSIGNAL);
+            });
+        }
+
+        void setOnConnectEvent(const std::function<void()> &onConnectEvent) {
+            _onConnectHandler = onConnectEvent;
+        }
+
+        void setOnDisconnectEvent(const std::function<void()> &onDisconnectEvent) {
+            _onDisconnectHandler = onDisconnectEvent;
+        }
+
+        /**
+         * @brief Resume the session on the next connect() instead of starting a new one,
+         * for a server with session resumption, see SessionResume.hpp. Must be called before connect().
+         */
+        void setSessionResumption(const bool &enabled) {
+            _resumeSessions = enabled;
+        }
+
+        /**
+         * @brief Called on the loop thread once the server started or resumed the session.
+         * A resumed session received the packets it missed right after, and no full state is needed.
+         */
+        void setOnSessionEvent(const std::function<void(bool resumed)> &onSessionEvent) {
+            _onSessionHandler = onSessionEvent;
+        }
+
+        // Getters
+
+        bool isConnected() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _state == State::Connected;
+        }
+
+        /**
+         * @brief Check if the server confirmed the UDP endpoint of the client.
+         */
+        bool isUdpBound() const {
+            return _udpBound;
+        }
+
+        /**
+         * @brief Smoothed RTT to the server, 0 until the server measured it, see ClockSync.hpp.
+         */
+        uint64_t getRttNs() const {
+            return _rttNs;
+        }
+
+        /**
+         * @brief This clock minus the server clock, both steady clocks.
+         */
+        int64_t getClockOffsetNs() const {
+            return _clockOffsetNs;
+        }
+
+        /**
+         * @brief The current time of the server clock, estimated from the offset.
+         */
+        uint64_t getServerTimeNs() const {
+            return steadyNowNs() - static_cast<uint64_t>(_clockOffsetNs.load());
+        }
+
+        /**
+         * @brief The current tick of the server, 0 until the first ping of the server.
+         */
+        uint64_t getServerTick() const {
+            const ServerClock clock{_serverEpochNs, _serverTickNs};
+            return clock.tickNs == 0 ? 0 : clock.tickAt(getServerTimeNs());
+        }
+
+        EventRegistry &getEventRegistry() {
+            return _eventRegistry;
+        }
+
+        EventLoop &getEventLoop() {
+            return _loop;
+        }
+
+    private:
+        enum class State {
+            Disconnected,
+            Connecting,
+            Connected
+        };
+
+        static uint64_t generateBindToken() {
+            thread_local std::mt19937_64 generator(std::random_device{}());
+            uint64_t token = 0;
+            while (token == 0)
+                token = generator();
+            return token;
+        }
+
+        void handleTcpEvents(const uint32_t events) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_state == State::Connecting) {
+                int error = 0;
+                socklen_t size = sizeof(error);
+                getsockopt(_socket, SOL_SOCKET, SO_ERROR, &error, &size);
+                if (error != 0 || (events & (EPOLLERR | EPOLLHUP))) {
+                    lock.unlock();
+                    closeConnection();
+                    return;
+                }
+                _state = State::Connected;
+                flushOutput();
+                lock.unlock();
+                sendBindDatagram();
+                _connected.set_value(true);
+                if (_onConnectHandler)
+                    _onConnectHandler();
+                return;
+            }
+            if ((events & (EPOLLERR | EPOLLHUP)) && !(events & EPOLLIN)) {
+                lock.unlock();
+                closeConnection();
+                return;
+            }
+            if (events & EPOLLOUT)
+                flushOutput();
+            lock.unlock();
+            if (events & EPOLLIN)
+                receivePackets();
+        }
+
+        /**
+         * Read everything available and dispatch every complete packet, on the loop thread.
+         */
+        void receivePackets() {
+            while (true) {
+                if (_input.capacity() == 0) {
+                    _input = PacketBufferPool::getDefault().acquire(BUFFER_SIZE);
+                    _input.resize(0);
+                }
+                const size_t filled = _input.size();
+                const ssize_t result = recv(_socket, _input.data() + filled, _input.capacity() - filled, 0);
+                if (result < 0 && errno == EINTR)
+                    continue;
+                if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    break;
+                if (result <= 0) {
+                    closeConnection();
+                    return;
+                }
+                _input.resize(filled + result);
+                _dispatching = true;
+                _closed = false;
+                // A handler closing the connection stops the dispatch, the rest of the buffer belongs to it
+                const bool valid = consumePackets(_input, [this](uint32_t packetId, std::span<const std::byte> payload) {
+                    if (packetId == HEARTBEAT_PACKET_ID) {
+                        // Answer so the server sees the client alive even when it has nothing to say
+                        std::lock_guard<std::mutex> lock(_mutex);
+                        sendPacket(HEARTBEAT_PACKET_ID, {});
+                    } else if (packetId == UDP_BIND_PACKET_ID) {
+                        _udpBound = true;
+                        _loop.cancel(_bindTimer);
+                    } else if (packetId == SESSION_PACKET_ID) {
+                        handleSessionGrant(payload);
+                    } else if (packetId < FIRST_RESERVED_PACKET_ID) {
+                        if (_resumeSessions && ++_received - _acknowledged >= SessionAckEvery)
+                            acknowledgeSession();
+                        _eventRegistry.dispatch(packetId, payload);
+                    }
+                }, _closed);
+                _dispatching = false;
+                if (_closed) {
+                    _input.reset();
+                    return;
+                }
+                if (!valid) {
+                    closeConnection();
+                    return;
+                }
+            }
+            if (_input.empty())
+                _input.reset();
+        }
+
+        void handleDatagrams() {
+            std::array<std::byte, BUFFER_SIZE> buffer;
+            while (true) {
+                const ssize_t result = recv(_udpSocket, buffer.data(), buffer.size(), MSG_DONTWAIT);
+                if (result < 0)
+                    return;
+                const uint64_t receiveNs = steadyNowNs();
+                DatagramAggregator::split(std::span<const std::byte>(buffer.data(), result),
+                    [this, receiveNs](uint32_t packetId, DatagramMessageKind kind, std::span<const std::byte> data) {
+                        if (packetId == CLOCK_SYNC_PACKET_ID) {
+                            handleClockPing(data, receiveNs);
+                            return;
+                        }
+                        if (kind == DatagramMessageKind::State) {
+                            StateHeader header{};
+                            size_t headerSize;
+                            if (!header.read(data, headerSize) || !_stateReceiver.accept(_udpAddress, header))
+                                return;
+                            data = data.subspan(headerSize);
+                        }
+                        _eventRegistry.dispatch(packetId, data);
+                    });
+            }
+        }
+
+        /**
+         * Answer a ping of the server right away, and keep what it measured so far.
+         */
+        void handleClockPing(std::span<const std::byte> payload, const uint64_t &receiveNs) {
+            ClockPing ping;
+            if (payload.size() != sizeof(ping))
+                return;
+            memcpy(&ping, payload.data(), sizeof(ping));
+            _rttNs = ping.smoothedRttNs;
+            _clockOffsetNs = ping.offsetNs;
+            _serverEpochNs = ping.epochNs;
+            _serverTickNs = ping.tickNs;
+
+            ClockPong pong;
+            pong.socket = ping.socket;
+            pong.serverSendNs = ping.serverSendNs;
+            pong.clientReceiveNs = receiveNs;
+            DatagramAggregator answer;
+            pong.clientSendNs = steadyNowNs();
+            answer.enqueue(_udpAddress, CLOCK_SYNC_PACKET_ID,
+                           std::span<const std::byte>(reinterpret_cast<const std::byte *>(&pong), sizeof(pong)));
+            answer.flush([this](const sockaddr_in &, std::span<const std::byte> datagram) {
+                ::send(_udpSocket, datagram.data(), datagram.size(), MSG_NOSIGNAL);
+            });
+        }
+
+        void handleSessionGrant(std::span<const std::byte> payload) {
+            SessionGrant grant;
+            if (!_resumeSessions || payload.size() != sizeof(grant))
+                return;
+            memcpy(&grant, payload.data(), sizeof(grant));
+            _sessionToken = grant.token;
+            // A new session numbers its packets from 0, a resumed one goes on from what we received
+            if (!grant.resumed)
+                _received = 0;
+            _acknowledged = _received;
+            scheduleSessionAck();
+            if (_onSessionHandler)
+                _onSessionHandler(grant.resumed != 0);
+        }
+
+        /**
+         * Tell the server which packets arrived, so it stops keeping them.
+         */
+        void acknowledgeSession() {
+            const uint64_t received = _received;
+            std::lock_guard<std::mutex> lock(_mutex);
+            sendPacket(SESSION_ACK_PACKET_ID, std::span<const std::byte>(reinterpret_cast<const std::byte *>(&received),
+                                                                         sizeof(received)));
+            _acknowledged = received;
+        }
+
+        void scheduleSessionAck() {
+            _sessionAckTimer = _loop.schedule(EventLoop::Clock::now() + SessionAckInterval, [this] {
+                if (_received != _acknowledged)
+                    acknowledgeSession();
+                scheduleSessionAck();
+            });
+        }
+
+        /**
+         * Send the bind token over UDP until the server confirms it over TCP, datagrams may be lost.
+         */
+        void sendBindDatagram() {
+            if (_udpBound || _state != State::Connected)
+                return;
+            DatagramAggregator bind;
+            bind.enqueue(_udpAddress, UDP_BIND_PACKET_ID,
+                         std::span<const std::byte>(reinterpret_cast<const std::byte *>(&_udpBindToken), sizeof(_udpBindToken)));
+            bind.flush([this](const sockaddr_in &, std::span<const std::byte> datagram) {
+                ::send(_udpSocket, datagram.data(), datagram.size(), MSG_NOSIGNAL);
+            });
+            _bindTimer = _loop.schedule(EventLoop::Clock::now() + std::chrono::milliseconds(100), [this] { sendBindDatagram(); });
+        }
+
+        /**
+         * Write a packet, or queue it behind the output already waiting.
+         * Must be called with _mutex locked.
+         */
+        ssize_t sendPacket(const uint32_t &packetId, std::span<const std::byte> data) {
+            const NetPacketHeader header{packetId, static_cast<uint32_t>(data.size())};
+            const size_t total = sizeof(header) + data.size();
+
+            if (_state == State::Disconnected)
+                return (-1);
+            if (_state == State::Connecting || _outputOffset < _output.size()) {
+                appendOutput(packetId, data);
+                return (total);
+            }
+            iovec iov[2] = {{const_cast<NetPacketHeader *>(&header), sizeof(header)},
+                            {const_cast<std::byte *>(data.data()), data.size()}};
+            msghdr message{};
+            message.msg_iov = iov;
+            message.msg_iovlen = 2;
+            const ssize_t result = sendmsg(_socket, &message, MSG_NOSIGNAL);
+            if (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+                return (-1);
+            const size_t sent = result < 0 ? 0 : result;
+            if (sent == total)
+                return (total);
+            // Keep the rest in order and wait for the socket to be writable
+            const auto *headerBytes = reinterpret_cast<const std::byte *>(&header);
+            if (sent < sizeof(header))
+                appendBytes(std::span<const std::byte>(headerBytes + sent, sizeof(header) - sent));
+            appendBytes(data.subspan(sent > sizeof(header) ? sent - sizeof(header) : 0));
+            _loop.modify(_socket, EPOLLIN | EPOLLOUT);
+            return (total);
+        }
+
+        void appendOutput(const uint32_t &packetId, std::span<const std::byte> data) {
+            const NetPacketHeader header{packetId, static_cast<uint32_t>(data.size())};
+            appendBytes(std::span<const std::byte>(reinterpret_cast<const std::byte *>(&header), sizeof(header)));
+            appendBytes(data);
+        }
+
+        void appendBytes(std::span<const std::byte> bytes) {
+            if (bytes.empty())
+                return;
+            if (_output.capacity() == 0) {
+                _output = PacketBufferPool::getDefault().acquire(std::max<size_t>(bytes.size(), BUFFER_SIZE));
+                _output.resize(0);
+            }
+            const size_t current = _output.size();
+            _output.resize(current + bytes.size());
+            memcpy(_output.data() + current, bytes.data(), bytes.size());
+        }
+
+        /**
+         * Write the queued output, must be called with _mutex locked.
+         */
+        void flushOutput() {
+            while (_outputOffset < _output.size()) {
+                const ssize_t result = ::send(_socket, _output.data() + _outputOffset, _output.size() - _outputOffset, MSG_NOSIGNAL);
+                if (result < 0 && errno == EINTR)
+                    continue;
+                if (result < 0) {
+                    _loop.modify(_socket, EPOLLIN | EPOLLOUT);
+                    return;
+                }
+                _outputOffset += result;
+            }
+            _output.reset();
+            _outputOffset = 0;
+            _loop.modify(_socket, EPOLLIN);
+        }
+
+        /**
+         * Close the sockets and fail the pending connect, on the loop thread.
+         */
+        void closeConnection() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_state == State::Disconnected)
+                return;
+            const State previous = _state;
+            _state = State::Disconnected;
+            _loop.remove(_socket);
+            _loop.remove(_udpSocket);
+            _loop.cancel(_bindTimer);
+            _loop.cancel(_sessionAckTimer);
+            closeSockets();
+            _output.reset();
+            _outputOffset = 0;
+            // Still being read if a handler disconnects, receivePackets() releases it then
+            _closed = true;
+            if (!_dispatching)
+                _input.reset();
+            _udpBound = false;
+            lock.unlock();
+            if (previous == State::Connecting)
+                _connected.set_value(false);
+            else if (_onDisconnectHandler)
+                _onDisconnectHandler();
+        }
+
+        void closeSockets() {
+            if (_socket != -1)
+                close(_socket);
+            if (_udpSocket != -1)
+                close(_udpSocket);
+            _socket = -1;
+            _udpSocket = -1;
+        }
+
+    private:
+        // Declared first so the loop outlives everything else
+        std::unique_ptr<NetworkClientGroup> _ownedGroup = nullptr;
+
+        std::string _host;
+        unsigned int _tcpPort;
+        unsigned int _udpPort;
+        EventLoop &_loop;
+
+        // Guards the connection state and the output, send() can be called from any thread
+        std::mutex _mutex;
+        State _state = State::Disconnected;
+        int _socket = -1;
+        PacketBuffer _output;
+        size_t _outputOffset = 0;
+        std::promise<bool> _connected;
+
+        // Only used from the loop thread
+        PacketBuffer _input;
+        EventLoop::TimerId _bindTimer = TimerWheel::InvalidTimer;
+        EventLoop::TimerId _sessionAckTimer = TimerWheel::InvalidTimer;
+        // Set while the input is dispatched, and when a handler closes the connection meanwhile
+        bool _dispatching = false;
+        bool _closed = false;
+
+        // Acknowledged after this many packets, or this long after the first one not acknowledged
+        static constexpr uint64_t SessionAckEvery = 64;
+        static constexpr std::chrono::milliseconds SessionAckInterval{100};
+        bool _resumeSessions = false;
+        std::function<void(bool)> _onSessionHandler = nullptr;
+        // Written on the loop thread, read by connect() once disconnected
+        std::atomic<uint64_t> _sessionToken = 0;
+        std::atomic<uint64_t> _received = 0;
+        uint64_t _acknowledged = 0;
+        LatestValueReceiver _stateReceiver;
+
+        int _udpSocket = -1;
+        sockaddr_in _udpAddress{};
+        uint64_t _udpBindToken = 0;
+        std::atomic<bool> _udpBound = false;
+        std::mutex _udpMutex;
+        // Written on the loop thread from the pings of the server
+        std::atomic<uint64_t> _rttNs = 0;
+        std::atomic<int64_t> _clockOffsetNs = 0;
+        std::atomic<uint64_t> _serverEpochNs = 0;
+        std::atomic<uint64_t> _serverTickNs = 0;
+        DatagramAggregator _aggregator;
+
+        EventRegistry _eventRegistry;
+        std::function<void()> _onConnectHandler = nullptr;
+        std::function<void()> _onDisconnectHandler = nullptr;
+};
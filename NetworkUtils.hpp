@@ -5,13 +5,41 @@
 #pragma once
 
 #define BUFFER_SIZE 4096
-#define MSG_CONFIRM 0
+// Biggest UDP payload that fits an Ethernet frame without IP fragmentation (1500 - 20 - 8)
+#define DATAGRAM_PAYLOAD_SIZE 1472
+// Biggest TCP packet accepted from a client, bigger ones close the connection
+#define MAX_PACKET_SIZE (1024 * 1024)
+
+// Packet ids reserved by the library, never dispatched to the handlers
+// Sent both ways over TCP to detect dead peers
+#define HEARTBEAT_PACKET_ID 0xFFFFFFFFu
+// Ties the UDP endpoint of a client to its TCP connection, see NetworkManagerClient
+#define UDP_BIND_PACKET_ID 0xFFFFFFFEu
+// Starts or resumes a session, see SessionResume.hpp
+#define SESSION_PACKET_ID 0xFFFFFFFDu
+// Number of packets of the session the client received
+#define SESSION_ACK_PACKET_ID 0xFFFFFFFCu
+// RTT and clock offset measure over UDP, see ClockSync.hpp
+#define CLOCK_SYNC_PACKET_ID 0xFFFFFFFBu
+// Every id from this one up is reserved
+#define FIRST_RESERVED_PACKET_ID CLOCK_SYNC_PACKET_ID
+
+#include "./PacketBufferPool.hpp"
 
 #include <arpa/inet.h>
+#include <sys/socket.h>
 #include <unistd.h>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
 #include <vector>
 #include <thread>
 
+#ifndef MSG_CONFIRM
+#define MSG_CONFIRM 0
+#endif
+
 struct NetClient {
     std::string uuid;
 
@@ -19,8 +47,8 @@ struct NetClient {
     std::string ip;
     unsigned int port;
     sockaddr_in address;
-
-    std::thread receiveThread;
+    // UDP endpoint bound by the client, port 0 until then
+    sockaddr_in udpAddress{};
 
     bool operator==(const NetClient &other) const {
         return uuid == other.uuid;
@@ -28,7 +56,56 @@ struct NetClient {
 
 };
 
+/**
+ * Header written in front of every packet sent over TCP.
+ */
+struct NetPacketHeader {
+    uint32_t packetId;
+    uint32_t size;
+};
+
+/**
+ * A packet and its payload, the payload is borrowed from a PacketBufferPool
+ * so a NetPacket can only be moved.
+ */
 struct NetPacket {
     int packetId;
-    std::vector<std::byte> data;
+    PacketBuffer data;
 };
+
+/**
+ * @brief Call onPacket(packetId, payload) for every complete packet of a TCP input buffer,
+ * then move the incomplete packet to its front, growing the buffer if that packet does not fit.
+ * Used by both ends of a connection so they agree on the framing.
+ * @param stop Checked after every packet: once set, it returns right away without touching
+ * the buffer again, which onPacket may have released.
+ * @return false if a packet is bigger than MAX_PACKET_SIZE.
+ */
+template<typename PacketFunction>
+bool consumePackets(PacketBuffer &input, const PacketFunction &onPacket, const bool &stop = false)
+{
+    size_t offset = 0;
+    NetPacketHeader header{};
+
+    while (input.size() - offset >= sizeof(header)) {
+        memcpy(&header, input.data() + offset, sizeof(header));
+        if (header.size > MAX_PACKET_SIZE)
+            return (false);
+        if (input.size() - offset - sizeof(header) < header.size)
+            break;
+        onPacket(header.packetId, std::span<const std::byte>(input.data() + offset + sizeof(header), header.size));
+        if (stop)
+            return (true);
+        offset += sizeof(header) + header.size;
+    }
+    const size_t remaining = input.size() - offset;
+    if (offset > 0 && remaining > 0)
+        memmove(input.data(), input.data() + offset, remaining);
+    input.resize(remaining);
+    if (remaining >= sizeof(header) && sizeof(header) + header.size > input.capacity()) {
+        const size_t current = input.size();
+        input.resize(sizeof(header) + header.size);
+        input.resize(current);
+    }
+    return (true);
+}
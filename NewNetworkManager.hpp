@@ -9,6 +9,10 @@
 #include "./uuid.hpp"
 #include "./TcpManager.hpp"
 #include "./UdpManager.hpp"
+#include "./NetSession.hpp"
+#include "./NetLog.hpp"
+#include "./TrafficReplay.hpp"
+#include "./StatsSegment.hpp"
 
 class NewNetworkManager {
     public:
@@ -19,15 +23,255 @@ class NewNetworkManager {
 
         };
 
-        ~NewNetworkManager() = default;
+        ~NewNetworkManager()
+        {
+            // In the order of stop(), the queued packets and tasks reference the managers
+            if (_tcpManager == nullptr)
+                return;
+            try {
+                stop(std::chrono::milliseconds(0));
+            } catch (const std::exception &error) {
+                NET_LOG_ERROR("Failed to stop network manager: {}", error.what());
+            }
+        }
 
+        /**
+         * @brief Bind the sockets and start the network threads.
+         * Returns once every loop runs, it does not wait for clients.
+         */
         void start() {
-            std::cout << "Starting network manager..." << std::endl;
-            _tcpManager = std::make_shared<TcpManager>(_host, _portTcp);
-            _udpManager = std::make_shared<UdpManager>(_host, _portUdp, _tcpManager);
-            getTcpManager().start();
-            getUdpManager().start();
-            std::cout << "Network manager started for UDP and TCP mode" << std::endl;
+            createManagers();
+            bool tcpStarted = false;
+            try {
+                std::future<void> tcpReady = getTcpManager().start();
+                tcpStarted = true;
+                std::future<void> udpReady = getUdpManager().start();
+                tcpReady.get();
+                udpReady.get();
+            } catch (...) {
+                // Back to the state before start(), so it can be called again
+                if (tcpStarted)
+                    getTcpManager().stop(std::chrono::milliseconds(0));
+                releaseManagers();
+                throw;
+            }
+            startStatsExport();
+            NET_LOG_INFO("Network manager started for UDP and TCP mode");
+        }
+
+        /**
+         * @brief Start from the sockets of a running process calling handOff() with the same path,
+         * instead of binding them, for a restart without downtime.
+         * @param path The Unix socket path given to handOff().
+         * @param configure Called once the managers exist and before they adopt the sockets,
+         * to register the handlers: the handed over clients are announced to the connect handler.
+         * @param timeout How long to wait for the other process to listen on the path.
+         */
+        void startFromHandoff(const std::string &path, const std::function<void(NewNetworkManager &)> &configure = nullptr,
+                              const std::chrono::milliseconds &timeout = std::chrono::seconds(10)) {
+            const int channel = HandoffState::connectChannel(path, timeout);
+            HandoffState state;
+            try {
+                state = HandoffState::receive(channel);
+            } catch (...) {
+                close(channel);
+                throw;
+            }
+            close(channel);
+            if (state.tcpSocket == -1 || state.udpSocket == -1) {
+                state.closeSockets();
+                throw std::runtime_error("Handoff did not contain the TCP and UDP sockets");
+            }
+            createManagers();
+            if (configure)
+                configure(*this);
+            std::future<void> tcpReady = getTcpManager().start(state.tcpSocket, std::move(state.clients),
+                                                               std::move(state.suspendedSessions));
+            std::future<void> udpReady = getUdpManager().start(state.udpSocket);
+            tcpReady.get();
+            udpReady.get();
+            startStatsExport();
+            NET_LOG_INFO("Network manager took over the sockets of the previous process");
+        }
+
+        /**
+         * @brief Give the sockets to a process calling startFromHandoff() with the same path.
+         * Blocks until that process connects, then only stops the network for the time of the transfer:
+         * connections arriving meanwhile wait in the listen backlog and datagrams in the UDP socket.
+         * @param path The Unix socket path to listen on.
+         * @param includeClients Also hand over the connected clients. Otherwise they keep being served
+         * here while the new process accepts the new ones, until stop() is called.
+         */
+        void handOff(const std::string &path, const bool &includeClients = true) {
+            if (_tcpManager == nullptr)
+                throw std::runtime_error("Network manager is not started");
+            const int listener = HandoffState::listenChannel(path);
+            const int channel = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            close(listener);
+            unlink(path.c_str());
+            if (channel == -1)
+                throw std::runtime_error("Failed to accept the process taking over");
+
+            _statsPublisher.stop();
+            HandoffState state = getTcpManager().handOff(includeClients);
+            try {
+                state.udpSocket = getUdpManager().handOff();
+                state.send(channel);
+            } catch (...) {
+                close(channel);
+                // Nothing reached the other process, keep serving as if the handoff never started
+                getTcpManager().cancelHandOff();
+                if (state.udpSocket != -1)
+                    getUdpManager().cancelHandOff(state.udpSocket).get();
+                startStatsExport();
+                throw;
+            }
+            close(channel);
+            getTcpManager().completeHandOff();
+            NET_LOG_INFO("Handed off the sockets and {} clients", state.clients.size());
+            // The other process has its own copies of the sockets
+            state.closeSockets();
+        }
+
+        /**
+         * @brief Stop both managers, then the handler executor once the last handlers ran.
+         * The packets still waiting for poll() are dropped. The manager can be started again afterwards.
+         * @param drainTimeout How long the TCP output waiting for slow clients may delay the shutdown.
+         * @return true if every TCP client received its whole output.
+         */
+        bool stop(const std::chrono::milliseconds &drainTimeout = std::chrono::milliseconds(1000)) {
+            if (_tcpManager == nullptr)
+                throw std::runtime_error("Network manager is not started");
+            _statsPublisher.stop();
+            const bool drained = getTcpManager().stop(drainTimeout);
+            if (getUdpManager().isRunning())
+                getUdpManager().stop();
+            releaseManagers();
+            NET_LOG_INFO("Network manager stopped");
+            return drained;
+        }
+
+        /**
+         * @brief Run the handlers on the thread calling poll() instead of the network threads.
+         * Must be called before start().
+         * @param capacity The number of received packets that can wait for poll().
+         */
+        void enableQueuedDispatch(const size_t &capacity = 65536) {
+            if (_tcpManager != nullptr)
+                throw std::runtime_error("Queued dispatch must be enabled before start()");
+            _dispatchQueue = std::make_unique<DispatchQueue>(capacity);
+        }
+
+        /**
+         * @brief Start a thread pool for the handlers registered with HandlerExecution::Pooled,
+         * without it they run inline. Must be called before start().
+         * @param threadCount The number of threads of the pool.
+         */
+        void enableHandlerExecutor(const size_t &threadCount = std::max(1u, std::thread::hardware_concurrency())) {
+            if (_tcpManager != nullptr)
+                throw std::runtime_error("Handler executor must be enabled before start()");
+            _executorThreadCount = std::max<size_t>(threadCount, 1);
+        }
+
+        /**
+         * @brief Name the network threads, pin them to CPUs and allocate their buffers
+         * on their NUMA node, see ThreadingConfig. Must be called before start().
+         */
+        void setThreadingConfig(const ThreadingConfig &config) {
+            if (_tcpManager != nullptr)
+                throw std::runtime_error("Threading config must be set before start()");
+            _threadingConfig = config;
+        }
+
+        /**
+         * @brief Make the TCP and UDP loops spin instead of blocking while packets keep coming,
+         * for the lowest latency at the cost of a busy CPU per loop. Must be called before start().
+         */
+        void setBusyPoll(const BusyPollConfig &config) {
+            if (_tcpManager != nullptr)
+                throw std::runtime_error("Busy poll must be configured before start()");
+            _busyPoll = config;
+        }
+
+        /**
+         * @brief Timestamp the packets in the kernel to measure their time until the handlers,
+         * and count the datagrams it dropped, see SocketTelemetryConfig and getMetrics().
+         * Must be called before start().
+         */
+        void setSocketTelemetry(const SocketTelemetryConfig &config) {
+            if (_tcpManager != nullptr)
+                throw std::runtime_error("Socket telemetry must be configured before start()");
+            _telemetry = config;
+        }
+
+        /**
+         * @brief Send heartbeats to the TCP clients and disconnect the dead or idle ones,
+         * see KeepAliveConfig. Must be called before start().
+         */
+        void setKeepAlive(const KeepAliveConfig &config) {
+            if (_tcpManager != nullptr)
+                throw std::runtime_error("Keepalive must be configured before start()");
+            _keepAlive = config;
+        }
+
+        /**
+         * @brief Keep the sessions of dropped TCP clients for them to resume,
+         * see SessionResumeConfig. Must be called before start().
+         */
+        void setSessionResumption(const SessionResumeConfig &config) {
+            if (_tcpManager != nullptr)
+                throw std::runtime_error("Session resumption must be configured before start()");
+            _sessionResume = config;
+        }
+
+        /**
+         * @brief Measure the RTT and clock offset of every client over UDP,
+         * see ClockSyncConfig. Must be called before start().
+         */
+        void setClockSync(const ClockSyncConfig &config) {
+            if (_tcpManager != nullptr)
+                throw std::runtime_error("Clock sync must be configured before start()");
+            _clockSync = config;
+        }
+
+        /**
+         * @brief Count the packets sent and received per packet id and transport,
+         * and time their decoding and handlers, see getMetrics(). Must be called before start().
+         */
+        void enableMetrics() {
+            if (_tcpManager != nullptr)
+                throw std::runtime_error("Metrics must be enabled before start()");
+            if (_metrics == nullptr)
+                _metrics = std::make_unique<NetMetrics>();
+        }
+
+        /**
+         * @brief Publish the stats of the server in shared memory for the netstat tool, see StatsExportConfig.
+         * The per packet id stats need enableMetrics(). Must be called before start().
+         */
+        void setStatsExport(const StatsExportConfig &config) {
+            if (_tcpManager != nullptr)
+                throw std::runtime_error("Stats export must be configured before start()");
+            _statsExport = config;
+        }
+
+        /**
+         * @brief Run the handlers of the packets received since the last call, typically once per tick from the game loop.
+         * Only needed when enableQueuedDispatch() was called.
+         * @param maxEvents The maximum number of packets to handle, the others wait for the next call.
+         * @return The number of packets handled.
+         */
+        size_t poll(const size_t &maxEvents = SIZE_MAX) {
+            if (_dispatchQueue == nullptr)
+                return 0;
+            size_t count = 0;
+            QueuedPacket packet;
+            while (count < maxEvents && _dispatchQueue->tryPop(packet)) {
+                packet.registry->dispatchNow(packet.packetId, packet.data, packet.strand, packet.arrivalNs);
+                packet.data.reset();
+                count++;
+            }
+            return count;
         }
 
         // Getters
@@ -44,12 +288,153 @@ class NewNetworkManager {
             return *_udpManager;
         }
 
+        /**
+         * @brief The metrics since enableMetrics(), kept across restarts. Call snapshot() on it to read them.
+         */
+        NetMetrics &getMetrics() {
+            if (_metrics == nullptr)
+                throw std::runtime_error("Metrics are not enabled, did you call enableMetrics() ?");
+            return *_metrics;
+        }
+
+        /**
+         * @brief The capture of the received packets, start() and stop() it at any time,
+         * and replay the file with replayCapture().
+         */
+        TrafficCapture &getCapture() {
+            return _capture;
+        }
+
+    private:
+        void startStatsExport() {
+            if (!_statsExport.enabled)
+                return;
+            StatsExportConfig config = _statsExport;
+            if (config.name.empty())
+                config.name = "/net-stats-" + std::to_string(_portTcp);
+            _statsPublisher.start(config, [this](ServerStats &server, std::vector<PacketStats> &packets) {
+                collectStats(server, packets);
+            }, _threadingConfig.statsPublisher, NumaTopology::detect());
+        }
+
+        /**
+         * Read every counter for the stats publisher thread. Only the clients lock is taken, briefly, for the client count.
+         */
+        void collectStats(ServerStats &server, std::vector<PacketStats> &packets) {
+            server.tcpClients = getTcpManager().getClientCount();
+            if (_dispatchQueue != nullptr) {
+                server.dispatchQueueDepth = _dispatchQueue->sizeApprox();
+                server.dispatchQueueCapacity = _dispatchQueue->capacity();
+            }
+            if (_executor != nullptr) {
+                server.executorPending = _executor->getPendingTasks();
+                server.executorThreads = _executor->getThreadCount();
+            }
+            const PacketBufferPool::Stats pool = PacketBufferPool::getDefault().getStats();
+            server.poolHits = pool.hits;
+            server.poolMisses = pool.misses;
+            server.poolInUse = pool.inUse;
+            server.poolHighWaterMark = pool.highWaterMark;
+            if (_metrics == nullptr)
+                return;
+            server.kernelDropsUdp = _metrics->getKernelDrops(NetTransport::Udp);
+            server.untrackedPackets = _metrics->getUntracked();
+
+            HistogramSnapshot decode, handler, kernelToHandler;
+            for (const PacketMetricsSnapshot &metrics : _metrics->snapshot()) {
+                PacketStats &packet = packets.emplace_back();
+                packet.transport = static_cast<uint8_t>(metrics.transport);
+                packet.packetId = metrics.packetId;
+                packet.received = metrics.received;
+                packet.receivedBytes = metrics.receivedBytes;
+                packet.sent = metrics.sent;
+                packet.sentBytes = metrics.sentBytes;
+                packet.decode = LatencySummary::of(metrics.decode);
+                packet.handler = LatencySummary::of(metrics.handler);
+                packet.kernelToHandler = LatencySummary::of(metrics.kernelToHandler);
+                decode.merge(metrics.decode);
+                handler.merge(metrics.handler);
+                kernelToHandler.merge(metrics.kernelToHandler);
+            }
+            std::copy(decode.buckets.begin(), decode.buckets.end(), server.decode);
+            std::copy(handler.buckets.begin(), handler.buckets.end(), server.handler);
+            std::copy(kernelToHandler.buckets.begin(), kernelToHandler.buckets.end(), server.kernelToHandler);
+        }
+
+        void createManagers() {
+            NET_LOG_INFO("Starting network manager...");
+            const NumaTopology topology = NumaTopology::detect();
+            NET_LOG_INFO("Topology: {}", topology.describe());
+            if (_executorThreadCount > 0)
+                _executor = std::make_unique<HandlerExecutor>(_executorThreadCount, 4096, _threadingConfig.executor);
+            _tcpManager = std::make_shared<TcpManager>(_host, _portTcp);
+            _udpManager = std::make_shared<UdpManager>(_host, _portUdp, _tcpManager);
+            getTcpManager().setThreadPlacement(_threadingConfig.tcpLoop, topology);
+            getUdpManager().setThreadPlacement(_threadingConfig.udpReceive, topology);
+            getTcpManager().setBusyPoll(_busyPoll);
+            getUdpManager().setBusyPoll(_busyPoll);
+            getTcpManager().setSocketTelemetry(_telemetry);
+            getUdpManager().setSocketTelemetry(_telemetry);
+            getTcpManager().setKeepAlive(_keepAlive);
+            getTcpManager().setSessionResumption(_sessionResume);
+            getTcpManager().setClockSync(_clockSync);
+            if (_executor != nullptr) {
+                getTcpManager().getEventRegistry().setExecutor(_executor.get());
+                getUdpManager().getEventRegistry().setExecutor(_executor.get());
+            }
+            if (_dispatchQueue != nullptr) {
+                getTcpManager().getEventRegistry().setDispatchQueue(_dispatchQueue.get());
+                getUdpManager().getEventRegistry().setDispatchQueue(_dispatchQueue.get());
+            }
+            if (_metrics != nullptr) {
+                getTcpManager().setMetrics(_metrics.get());
+                getUdpManager().setMetrics(_metrics.get());
+            }
+            getTcpManager().setCapture(&_capture);
+            getUdpManager().setCapture(&_capture);
+        }
+
+        /**
+         * Drop the managers once their threads are stopped, the executor last.
+         */
+        void releaseManagers() {
+            // The network threads are gone, nothing dispatches anymore.
+            // Every packet and task left references the registries of the managers, they go first.
+            getTcpManager().getEventRegistry().setDispatchQueue(nullptr);
+            getUdpManager().getEventRegistry().setDispatchQueue(nullptr);
+            if (_dispatchQueue != nullptr) {
+                QueuedPacket packet;
+                while (_dispatchQueue->tryPop(packet))
+                    packet.data.reset();
+            }
+            // Runs the pooled handlers still queued before returning
+            _executor = nullptr;
+            _udpManager = nullptr;
+            _tcpManager = nullptr;
+        }
+
     private:
         // Constructor variables
         std::string _host;
         unsigned int _portTcp;
         unsigned int _portUdp;
+        ThreadingConfig _threadingConfig{};
+        size_t _executorThreadCount = 0;
+        BusyPollConfig _busyPoll;
+        SocketTelemetryConfig _telemetry;
+        KeepAliveConfig _keepAlive;
+        SessionResumeConfig _sessionResume;
+        ClockSyncConfig _clockSync;
+        StatsExportConfig _statsExport;
         // Variables
+        // Declared first, the handlers still draining on the executor record to them
+        std::unique_ptr<NetMetrics> _metrics = nullptr;
+        TrafficCapture _capture;
+        // Declared before the managers so they are destroyed after them
+        std::unique_ptr<HandlerExecutor> _executor = nullptr;
+        std::unique_ptr<DispatchQueue> _dispatchQueue = nullptr;
         std::shared_ptr<TcpManager> _tcpManager = nullptr;
         std::shared_ptr<UdpManager> _udpManager = nullptr;
+        // Declared after the managers so it is destroyed, and stops reading them, first
+        StatsPublisher _statsPublisher;
 };
@@ -0,0 +1,533 @@
+//
+// Created by Florian Damiot on 19/10/2026.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <unistd.h>
+
+class PacketBufferPool;
+
+/**
+ * @brief Move-only handle on a buffer borrowed from a PacketBufferPool.
+ * The buffer goes back to its pool when the handle is destroyed.
+ */
+class PacketBuffer {
+    public:
+        PacketBuffer() = default;
+
+        PacketBuffer(const PacketBuffer &) = delete;
+        PacketBuffer &operator=(const PacketBuffer &) = delete;
+
+        PacketBuffer(PacketBuffer &&other) noexcept
+        {
+            swap(other);
+        }
+
+        PacketBuffer &operator=(PacketBuffer &&other) noexcept
+        {
+            if (this != &other) {
+                reset();
+                swap(other);
+            }
+            return *this;
+        }
+
+        ~PacketBuffer()
+        {
+            reset();
+        }
+
+        std::byte *data() { return _data; }
+        const std::byte *data() const { return _data; }
+        size_t size() const { return _size; }
+        size_t capacity() const { return _capacity; }
+        bool empty() const { return _size == 0; }
+
+        std::byte *begin() { return _data; }
+        std::byte *end() { return _data + _size; }
+        const std::byte *begin() const { return _data; }
+        const std::byte *end() const { return _data + _size; }
+
+        operator std::span<const std::byte>() const { return {_data, _size}; }
+        operator std::span<std::byte>() { return {_data, _size}; }
+
+        /**
+         * @brief Change the size of the buffer, a bigger buffer is borrowed
+         * from the same pool when the capacity is exceeded.
+         * @param size The new size.
+         */
+        inline void resize(const size_t &size);
+
+        /**
+         * @brief Give the buffer back to its pool, the handle becomes empty.
+         */
+        inline void reset();
+
+    private:
+        friend class PacketBufferPool;
+
+        void swap(PacketBuffer &other) noexcept
+        {
+            std::swap(_pool, other._pool);
+            std::swap(_data, other._data);
+            std::swap(_size, other._size);
+            std::swap(_capacity, other._capacity);
+            std::swap(_sizeClass, other._sizeClass);
+        }
+
+        PacketBufferPool *_pool = nullptr;
+        std::byte *_data = nullptr;
+        uint32_t _size = 0;
+        uint32_t _capacity = 0;
+        uint8_t _sizeClass = 0;
+};
+
+/**
+ * @brief Pool of fixed-size buffers used for every packet read, serialized or dispatched.
+ *
+ * Each size class owns an arena reserved once with mmap (optionally backed by huge pages),
+ * so pages are only made resident when a block is first used.
+ * Free blocks are kept in a lock-free stack per class (tagged index to avoid ABA),
+ * in front of which every thread keeps a small cache so most acquire/release never touch shared state.
+ * The statistics are counted per thread too, and only merged by getStats().
+ * A thread keeps a cache for each of the last THREAD_CACHE_POOLS pools it used,
+ * so alternating between a few pools, e.g. its node pool and the shared one, does not flush them.
+ * Requests bigger than the biggest class, or made once the arena of their class is full,
+ * fall back to the heap and count as misses: running out of blocks slows the pool down, it never fails.
+ *
+ * A pool must outlive every thread that used it, since threads give their cache back on exit.
+ */
+class PacketBufferPool {
+    public:
+        static constexpr size_t CLASS_COUNT = 6;
+        static constexpr std::array<size_t, CLASS_COUNT> CLASS_SIZES = {64, 256, 1024, 4096, 16384, 65536};
+        static constexpr size_t THREAD_CACHE_SIZE = 32;
+        static constexpr size_t THREAD_CACHE_POOLS = 4;
+        static constexpr uint8_t OVERSIZE_CLASS = 0xFF;
+
+        struct Config {
+            // Virtual memory reserved for each size class
+            size_t arenaSize = 64 * 1024 * 1024;
+            // Try MAP_HUGETLB first, then fall back to transparent huge pages
+            bool hugePages = false;
+            // NUMA node the arenas are bound to, -1 to let the first thread touching a page decide
+            int numaNode = -1;
+        };
+
+        struct Stats {
+            // Buffers served from a free list
+            uint64_t hits = 0;
+            // Buffers that needed a never used block or a heap allocation
+            uint64_t misses = 0;
+            // Buffers currently borrowed
+            uint64_t inUse = 0;
+            // Most buffers borrowed at once among the calls to getStats()
+            uint64_t highWaterMark = 0;
+        };
+
+        PacketBufferPool() : PacketBufferPool(Config{})
+        {
+
+        }
+
+        explicit PacketBufferPool(const Config &config) : _instance(_nextInstance.fetch_add(1, std::memory_order_relaxed))
+        {
+            for (size_t i = 0; i < CLASS_COUNT; i++)
+                _classes[i].init(CLASS_SIZES[i], config);
+        }
+
+        ~PacketBufferPool()
+        {
+            for (ThreadCache &cache : threadCaches().caches)
+                if (cache.owner == this)
+                    cache.drain();
+        }
+
+        PacketBufferPool(const PacketBufferPool &) = delete;
+        PacketBufferPool &operator=(const PacketBufferPool &) = delete;
+
+        /**
+         * @brief The pool used when none is given: the one set for the calling thread
+         * by setThreadDefault(), or else a pool shared by every thread.
+         */
+        static PacketBufferPool &getDefault()
+        {
+            static PacketBufferPool pool;
+            PacketBufferPool *threadPool = threadDefault();
+            return threadPool != nullptr ? *threadPool : pool;
+        }
+
+        /**
+         * @brief Choose the pool returned by getDefault() on the calling thread,
+         * e.g. a pool on the NUMA node of the thread. nullptr restores the shared pool.
+         */
+        static void setThreadDefault(PacketBufferPool *pool)
+        {
+            threadDefault() = pool;
+        }
+
+        /**
+         * @brief Borrow a buffer of at least the given size.
+         * @param size The size of the returned buffer.
+         */
+        PacketBuffer acquire(const size_t &size)
+        {
+            PacketBuffer buffer;
+            const uint8_t sizeClass = classOf(size);
+            ThreadCache &cache = ownedThreadCache();
+
+            buffer._pool = this;
+            buffer._size = static_cast<uint32_t>(size);
+            buffer._sizeClass = sizeClass;
+            increment(cache.counters->acquired);
+            if (sizeClass == OVERSIZE_CLASS) {
+                increment(cache.counters->misses);
+                buffer._data = new std::byte[size];
+                buffer._capacity = static_cast<uint32_t>(size);
+                return buffer;
+            }
+            SizeClass &sc = _classes[sizeClass];
+            uint32_t index;
+            if (!acquireIndex(cache, sizeClass, index)) {
+                // Arena full, a heap block of the class size, deleted on release like an oversize one
+                increment(cache.counters->misses);
+                buffer._sizeClass = OVERSIZE_CLASS;
+                buffer._data = new std::byte[sc.blockSize];
+                buffer._capacity = static_cast<uint32_t>(sc.blockSize);
+                return buffer;
+            }
+            buffer._data = sc.block(index);
+            buffer._capacity = static_cast<uint32_t>(sc.blockSize);
+            return buffer;
+        }
+
+        /**
+         * @brief Borrow a buffer holding a copy of the given bytes.
+         */
+        PacketBuffer acquire(std::span<const std::byte> bytes)
+        {
+            PacketBuffer buffer = acquire(bytes.size());
+            if (!bytes.empty())
+                std::memcpy(buffer.data(), bytes.data(), bytes.size());
+            return buffer;
+        }
+
+        /**
+         * @brief Merge the statistics counted by every thread.
+         * The high water mark is the most buffers in use seen by this and the previous calls.
+         */
+        Stats getStats() const
+        {
+            Stats stats;
+            uint64_t acquired = 0;
+            uint64_t released = 0;
+
+            {
+                std::lock_guard<std::mutex> lock(_countersMutex);
+                for (const auto &counters : _counters) {
+                    stats.hits += counters->hits.load(std::memory_order_relaxed);
+                    stats.misses += counters->misses.load(std::memory_order_relaxed);
+                    acquired += counters->acquired.load(std::memory_order_relaxed);
+                }
+                // Read after every acquired count, so a buffer released meanwhile is counted as released too
+                // and the difference does not overshoot what was in use, which would stick in the high water mark
+                for (const auto &counters : _counters)
+                    released += counters->released.load(std::memory_order_relaxed);
+            }
+            // Borrowed by one thread and released by another, the sums only match in total
+            stats.inUse = acquired > released ? acquired - released : 0;
+            uint64_t peak = _highWaterMark.load(std::memory_order_relaxed);
+            while (stats.inUse > peak && !_highWaterMark.compare_exchange_weak(peak, stats.inUse, std::memory_order_relaxed));
+            stats.highWaterMark = std::max(peak, stats.inUse);
+            return stats;
+        }
+
+    private:
+        friend class PacketBuffer;
+
+        struct SizeClass {
+            size_t blockSize = 0;
+            uint32_t capacity = 0;
+            std::byte *arena = nullptr;
+            size_t arenaSize = 0;
+            std::unique_ptr<std::atomic<uint32_t>[]> next;
+            // Low 32 bits: index + 1 of the top block (0 when empty), high 32 bits: ABA tag
+            std::atomic<uint64_t> head{0};
+            std::atomic<uint32_t> carved{0};
+
+            void init(const size_t &size, const Config &config)
+            {
+                blockSize = size;
+                capacity = static_cast<uint32_t>(config.arenaSize / size);
+                arenaSize = static_cast<size_t>(capacity) * size;
+                next = std::make_unique<std::atomic<uint32_t>[]>(capacity);
+                void *memory = MAP_FAILED;
+                if (config.hugePages)
+                    memory = mmap(nullptr, arenaSize, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_HUGETLB, -1, 0);
+                if (memory == MAP_FAILED)
+                    memory = mmap(nullptr, arenaSize, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+                if (memory == MAP_FAILED)
+                    throw std::runtime_error("Failed to reserve memory for the packet buffer pool");
+                if (config.hugePages)
+                    madvise(memory, arenaSize, MADV_HUGEPAGE);
+                if (config.numaNode >= 0 && config.numaNode < 64) {
+                    // Prefer rather than bind, so a full node falls back to another one instead of failing
+                    const unsigned long nodeMask = 1UL << config.numaNode;
+                    syscall(SYS_mbind, memory, arenaSize, MPOL_PREFERRED, &nodeMask, 64, 0);
+                }
+                arena = static_cast<std::byte *>(memory);
+            }
+
+            ~SizeClass()
+            {
+                if (arena != nullptr)
+                    munmap(arena, arenaSize);
+            }
+
+            std::byte *block(const uint32_t &index) const
+            {
+                return arena + static_cast<size_t>(index) * blockSize;
+            }
+
+            uint32_t indexOf(const std::byte *data) const
+            {
+                return static_cast<uint32_t>((data - arena) / blockSize);
+            }
+
+            void push(const uint32_t &index)
+            {
+                uint64_t old = head.load(std::memory_order_relaxed);
+                uint64_t desired;
+                do {
+                    next[index].store(static_cast<uint32_t>(old), std::memory_order_relaxed);
+                    desired = ((old >> 32) + 1) << 32 | (index + 1);
+                } while (!head.compare_exchange_weak(old, desired, std::memory_order_release, std::memory_order_relaxed));
+            }
+
+            bool pop(uint32_t &index)
+            {
+                uint64_t old = head.load(std::memory_order_acquire);
+                uint64_t desired;
+                do {
+                    if (static_cast<uint32_t>(old) == 0)
+                        return false;
+                    index = static_cast<uint32_t>(old) - 1;
+                    desired = ((old >> 32) + 1) << 32 | next[index].load(std::memory_order_relaxed);
+                } while (!head.compare_exchange_weak(old, desired, std::memory_order_acquire, std::memory_order_acquire));
+                return true;
+            }
+        };
+
+        // Counted by one thread, read by getStats() from any thread
+        struct Counters {
+            std::atomic<uint64_t> acquired{0};
+            std::atomic<uint64_t> released{0};
+            std::atomic<uint64_t> hits{0};
+            std::atomic<uint64_t> misses{0};
+        };
+
+        // Only its thread writes a counter, a plain store avoids the locked add
+        static void increment(std::atomic<uint64_t> &counter)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        struct ThreadCache {
+            PacketBufferPool *owner = nullptr;
+            Counters *counters = nullptr;
+            std::array<std::array<uint32_t, THREAD_CACHE_SIZE>, CLASS_COUNT> blocks{};
+            std::array<uint32_t, CLASS_COUNT> counts{};
+
+            void drain()
+            {
+                for (size_t i = 0; i < CLASS_COUNT; i++) {
+                    for (uint32_t j = 0; j < counts[i]; j++)
+                        owner->_classes[i].push(blocks[i][j]);
+                    counts[i] = 0;
+                }
+                owner = nullptr;
+                counters = nullptr;
+            }
+
+            ~ThreadCache()
+            {
+                if (owner != nullptr)
+                    drain();
+            }
+        };
+
+        static PacketBufferPool *&threadDefault()
+        {
+            thread_local PacketBufferPool *pool = nullptr;
+            return pool;
+        }
+
+        struct ThreadCaches {
+            std::array<ThreadCache, THREAD_CACHE_POOLS> caches;
+            // The cache used last, checked first
+            size_t current = 0;
+            // Switches between caches, to find the one switched to the longest ago
+            uint64_t switches = 0;
+            std::array<uint64_t, THREAD_CACHE_POOLS> switchedAt{};
+        };
+
+        static ThreadCaches &threadCaches()
+        {
+            thread_local ThreadCaches caches;
+            return caches;
+        }
+
+        /**
+         * The cache of the calling thread for this pool. Without one, it takes a free cache,
+         * or gives the blocks of the cache switched to the longest ago back to their pool.
+         */
+        ThreadCache &ownedThreadCache()
+        {
+            ThreadCaches &caches = threadCaches();
+            if (caches.caches[caches.current].owner == this)
+                return caches.caches[caches.current];
+
+            size_t chosen = 0;
+            for (size_t i = 0; i < THREAD_CACHE_POOLS; i++) {
+                if (caches.caches[i].owner == this) {
+                    chosen = i;
+                    break;
+                }
+                if (caches.caches[chosen].owner != nullptr &&
+                    (caches.caches[i].owner == nullptr || caches.switchedAt[i] < caches.switchedAt[chosen]))
+                    chosen = i;
+            }
+            ThreadCache &cache = caches.caches[chosen];
+            if (cache.owner != this) {
+                if (cache.owner != nullptr)
+                    cache.drain();
+                cache.owner = this;
+                cache.counters = &localCounters();
+            }
+            caches.current = chosen;
+            caches.switchedAt[chosen] = ++caches.switches;
+            return cache;
+        }
+
+        /**
+         * The counters of the calling thread, kept by the pool once the thread exited.
+         */
+        Counters &localCounters()
+        {
+            // Keyed by instance number rather than address, a new pool may reuse a freed address
+            thread_local std::vector<std::pair<uint64_t, Counters *>> counters;
+            for (const auto &[instance, local] : counters)
+                if (instance == _instance)
+                    return *local;
+            std::lock_guard<std::mutex> lock(_countersMutex);
+            _counters.push_back(std::make_unique<Counters>());
+            counters.emplace_back(_instance, _counters.back().get());
+            return *_counters.back();
+        }
+
+        static uint8_t classOf(const size_t &size)
+        {
+            for (size_t i = 0; i < CLASS_COUNT; i++)
+                if (size <= CLASS_SIZES[i])
+                    return static_cast<uint8_t>(i);
+            return OVERSIZE_CLASS;
+        }
+
+        /**
+         * A block of the class, from the thread cache, the free list or never used yet.
+         * @return false if every block of the arena is borrowed.
+         */
+        bool acquireIndex(ThreadCache &cache, const uint8_t &sizeClass, uint32_t &index)
+        {
+            SizeClass &sc = _classes[sizeClass];
+
+            if (cache.counts[sizeClass] > 0) {
+                increment(cache.counters->hits);
+                index = cache.blocks[sizeClass][--cache.counts[sizeClass]];
+                return true;
+            }
+            if (sc.pop(index)) {
+                increment(cache.counters->hits);
+                return true;
+            }
+            index = sc.carved.fetch_add(1, std::memory_order_relaxed);
+            if (index >= sc.capacity) {
+                sc.carved.fetch_sub(1, std::memory_order_relaxed);
+                return false;
+            }
+            increment(cache.counters->misses);
+            return true;
+        }
+
+        void release(PacketBuffer &buffer)
+        {
+            ThreadCache &cache = ownedThreadCache();
+
+            increment(cache.counters->released);
+            if (buffer._sizeClass == OVERSIZE_CLASS) {
+                delete[] buffer._data;
+                return;
+            }
+            SizeClass &sc = _classes[buffer._sizeClass];
+            uint32_t &count = cache.counts[buffer._sizeClass];
+
+            if (count == THREAD_CACHE_SIZE) {
+                // Give half of the cache back so other threads can use it
+                for (size_t i = THREAD_CACHE_SIZE / 2; i < THREAD_CACHE_SIZE; i++)
+                    sc.push(cache.blocks[buffer._sizeClass][i]);
+                count = THREAD_CACHE_SIZE / 2;
+            }
+            cache.blocks[buffer._sizeClass][count++] = sc.indexOf(buffer._data);
+        }
+
+    private:
+        std::array<SizeClass, CLASS_COUNT> _classes;
+        inline static std::atomic<uint64_t> _nextInstance = 1;
+        uint64_t _instance;
+        // One per thread that used the pool, kept once the thread exited
+        std::vector<std::unique_ptr<Counters>> _counters;
+        mutable std::mutex _countersMutex;
+        // Most buffers in use seen by getStats()
+        mutable std::atomic<uint64_t> _highWaterMark{0};
+};
+
+inline void PacketBuffer::reset()
+{
+    if (_pool != nullptr && _data != nullptr)
+        _pool->release(*this);
+    _pool = nullptr;
+    _data = nullptr;
+    _size = 0;
+    _capacity = 0;
+    _sizeClass = 0;
+}
+
+inline void PacketBuffer::resize(const size_t &size)
+{
+    if (size <= _capacity) {
+        _size = static_cast<uint32_t>(size);
+        return;
+    }
+    PacketBufferPool &pool = _pool != nullptr ? *_pool : PacketBufferPool::getDefault();
+    PacketBuffer bigger = pool.acquire(size);
+    if (_size > 0)
+        std::memcpy(bigger.data(), _data, _size);
+    *this = std::move(bigger);
+}
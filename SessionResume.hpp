@@ -0,0 +1,167 @@
+//
+// Created by Florian Damiot on 19/10/2026.
+//
+
+#pragma once
+
+#include "./NetworkUtils.hpp"
+#include "./PacketBufferPool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <span>
+
+/**
+ * @brief Resumption of the sessions of clients whose connection dropped.
+ *
+ * Every packet the server sends to a client is numbered implicitly by its rank on the
+ * TCP stream, and kept until the client acknowledges it. When the connection drops, the
+ * session is kept for the grace period under a token the client received when it started.
+ * A client reconnecting with that token gets its session back (same uuid, interest mask)
+ * and only the packets it did not receive are sent again, instead of the whole world state.
+ * Clients must speak the protocol, as NetworkManagerClient does: the connect handler
+ * only runs once the client sent its SessionRequest.
+ */
+struct SessionResumeConfig {
+    bool enabled = false;
+    // How long a dropped session waits for its client before the disconnect handler runs
+    std::chrono::milliseconds gracePeriod{10000};
+    // Unacknowledged bytes kept per client, the oldest are dropped beyond it
+    // and a client that missed them starts a new session
+    size_t maxReplayBytes = 1024 * 1024;
+};
+
+/**
+ * @brief First packet of a client, SESSION_PACKET_ID from the client.
+ */
+struct SessionRequest {
+    // Token of the session to resume, 0 for a new session
+    uint64_t token = 0;
+    // Packets of that session the client received
+    uint64_t received = 0;
+};
+
+/**
+ * @brief Answer of the server, SESSION_PACKET_ID from the server.
+ * The packets following it are numbered from 0 for a new session,
+ * or from the received count of the request for a resumed one.
+ */
+struct SessionGrant {
+    uint64_t token = 0;
+    uint8_t resumed = 0;
+};
+
+/**
+ * @brief The packets sent to a client and not acknowledged yet, framed as they were sent.
+ */
+class ReplayBuffer {
+    public:
+        /**
+         * @brief Keep a sent packet, it gets the next sequence number.
+         */
+        void append(const NetPacketHeader &header, std::span<const std::byte> data, const size_t &maxBytes)
+        {
+            PacketBuffer packet = PacketBufferPool::getDefault().acquire(sizeof(header) + data.size());
+            memcpy(packet.data(), &header, sizeof(header));
+            if (!data.empty())
+                memcpy(packet.data() + sizeof(header), data.data(), data.size());
+            _bytes += packet.size();
+            _packets.push_back(std::move(packet));
+            _nextSequence++;
+            while (_bytes > maxBytes && !_packets.empty())
+                drop();
+        }
+
+        /**
+         * @brief Drop every packet and number the next one from the given sequence,
+         * to restore a buffer sent by another process, see HandoffSession.
+         */
+        void restartAt(const uint64_t &sequence)
+        {
+            _packets.clear();
+            _bytes = 0;
+            _nextSequence = sequence;
+        }
+
+        /**
+         * @brief Keep a packet already framed, it gets the next sequence number.
+         */
+        void appendFramed(std::span<const std::byte> packet)
+        {
+            _packets.push_back(PacketBufferPool::getDefault().acquire(packet));
+            _bytes += packet.size();
+            _nextSequence++;
+        }
+
+        /**
+         * @brief Forget the packets the client received.
+         * @param received The number of packets the client received, acknowledges every sequence below it.
+         */
+        void acknowledge(const uint64_t &received)
+        {
+            while (!_packets.empty() && firstSequence() < std::min(received, _nextSequence))
+                drop();
+        }
+
+        /**
+         * @brief Check if every packet from the given sequence is still kept.
+         */
+        bool canReplayFrom(const uint64_t &sequence) const
+        {
+            return sequence >= firstSequence() && sequence <= _nextSequence;
+        }
+
+        /**
+         * @brief Call a function with each framed packet from the given sequence, see canReplayFrom().
+         */
+        template<typename PacketFunction>
+        void replayFrom(const uint64_t &sequence, const PacketFunction &onPacket) const
+        {
+            for (size_t i = sequence - firstSequence(); i < _packets.size(); i++)
+                onPacket(std::span<const std::byte>(_packets[i].data(), _packets[i].size()));
+        }
+
+        /**
+         * @brief Sequence number of the next packet sent.
+         */
+        uint64_t nextSequence() const
+        {
+            return _nextSequence;
+        }
+
+        uint64_t firstSequence() const
+        {
+            return _nextSequence - _packets.size();
+        }
+
+        size_t bytes() const
+        {
+            return _bytes;
+        }
+
+    private:
+        void drop()
+        {
+            _bytes -= _packets.front().size();
+            _packets.pop_front();
+        }
+
+    private:
+        std::deque<PacketBuffer> _packets;
+        size_t _bytes = 0;
+        uint64_t _nextSequence = 0;
+};
+
+/**
+ * @brief Session of a connected client.
+ */
+struct ClientSession {
+    // 0 until the client sent its SessionRequest
+    uint64_t token = 0;
+    // Waiting for the SessionRequest, the client gets no broadcast meanwhile
+    bool pending = false;
+    ReplayBuffer replay;
+};
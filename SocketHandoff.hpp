@@ -0,0 +1,404 @@
+//
+// Created by Florian Damiot on 19/10/2026.
+//
+
+#pragma once
+
+#include "./NetworkUtils.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ * @brief The resumable session of a client, see ClientSession, as it travels to the new process.
+ */
+struct HandoffSession {
+    // 0 if the client has no session
+    uint64_t token = 0;
+    bool pending = false;
+    // Sequence number of the first packet of replay
+    uint64_t firstSequence = 0;
+    // Packets not acknowledged yet, framed as they were sent
+    std::vector<std::vector<std::byte>> replay;
+};
+
+/**
+ * @brief A client handed to the new process, with the bytes it had in flight.
+ */
+struct HandoffClient {
+    // client.socket is the file descriptor in the receiving process
+    NetClient client;
+    uint32_t interestMask = 0;
+    // Start of a packet not completely received yet
+    std::vector<std::byte> input;
+    // Bytes queued for the client and not written yet
+    std::vector<std::byte> output;
+    HandoffSession session;
+};
+
+/**
+ * @brief The session of a dropped client still in its grace period, it can resume in the new process.
+ */
+struct HandoffSuspendedSession {
+    // client.socket is meaningless, the connection is gone
+    NetClient client;
+    uint32_t interestMask = 0;
+    HandoffSession session;
+    // What is left of the grace period
+    std::chrono::milliseconds remaining{0};
+};
+
+/**
+ * @brief Everything a restarting server passes to its successor: the listening TCP socket,
+ * the bound UDP socket and optionally the connected clients with the resumable sessions.
+ * The sockets go through a Unix domain socket with SCM_RIGHTS, so they are never closed
+ * and no connection is dropped, the kernel keeps queueing new ones in the listen backlog meanwhile.
+ */
+struct HandoffState {
+    int tcpSocket = -1;
+    int udpSocket = -1;
+    std::vector<HandoffClient> clients;
+    std::vector<HandoffSuspendedSession> suspendedSessions;
+
+    /**
+     * @brief Send the state over a connected Unix socket.
+     */
+    void send(const int &channel) const
+    {
+        std::vector<int> fds;
+        std::vector<std::byte> data;
+
+        appendValue(data, static_cast<uint8_t>((tcpSocket != -1) | ((udpSocket != -1) << 1)));
+        if (tcpSocket != -1)
+            fds.push_back(tcpSocket);
+        if (udpSocket != -1)
+            fds.push_back(udpSocket);
+        appendValue(data, static_cast<uint32_t>(clients.size()));
+        for (const HandoffClient &client : clients) {
+            fds.push_back(client.client.socket);
+            appendClient(data, client.client);
+            appendValue(data, client.interestMask);
+            appendBytes(data, client.input);
+            appendBytes(data, client.output);
+            appendSession(data, client.session);
+        }
+        appendValue(data, static_cast<uint32_t>(suspendedSessions.size()));
+        for (const HandoffSuspendedSession &suspended : suspendedSessions) {
+            appendClient(data, suspended.client);
+            appendValue(data, suspended.interestMask);
+            appendSession(data, suspended.session);
+            appendValue(data, static_cast<int64_t>(suspended.remaining.count()));
+        }
+
+        const Header header{Magic, static_cast<uint32_t>(fds.size()), data.size()};
+        writeAll(channel, std::span<const std::byte>(reinterpret_cast<const std::byte *>(&header), sizeof(header)));
+        // One byte per batch of descriptors, the descriptors travel as its ancillary data
+        for (size_t first = 0; first < fds.size(); first += MaxFdsPerMessage) {
+            const size_t count = std::min(MaxFdsPerMessage, fds.size() - first);
+            std::byte byte{0};
+            iovec iov{&byte, 1};
+            std::vector<char> control(CMSG_SPACE(count * sizeof(int)));
+            msghdr message{};
+            message.msg_iov = &iov;
+            message.msg_iovlen = 1;
+            message.msg_control = control.data();
+            message.msg_controllen = control.size();
+            cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+            memcpy(CMSG_DATA(cmsg), fds.data() + first, count * sizeof(int));
+            if (sendmsg(channel, &message, MSG_NOSIGNAL) != 1)
+                throw std::runtime_error("Failed to send sockets for handoff");
+        }
+        writeAll(channel, data);
+    }
+
+    /**
+     * @brief Receive the state sent by send(), the received sockets belong to the caller.
+     */
+    static HandoffState receive(const int &channel)
+    {
+        Header header{};
+        readAll(channel, std::span<std::byte>(reinterpret_cast<std::byte *>(&header), sizeof(header)));
+        if (header.magic != Magic)
+            throw std::runtime_error("Invalid handoff header");
+
+        ReceivedSockets fds;
+        while (fds.sockets.size() < header.fdCount) {
+            const size_t count = std::min<size_t>(MaxFdsPerMessage, header.fdCount - fds.sockets.size());
+            std::byte byte{};
+            iovec iov{&byte, 1};
+            std::vector<char> control(CMSG_SPACE(count * sizeof(int)));
+            msghdr message{};
+            message.msg_iov = &iov;
+            message.msg_iovlen = 1;
+            message.msg_control = control.data();
+            message.msg_controllen = control.size();
+            if (recvmsg(channel, &message, MSG_CMSG_CLOEXEC) != 1)
+                throw std::runtime_error("Failed to receive sockets for handoff");
+            cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+            if (cmsg == nullptr || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+                throw std::runtime_error("Missing sockets in handoff message");
+            // Kept before checking the truncation, so the ones that did arrive are closed
+            const size_t received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const size_t first = fds.sockets.size();
+            fds.sockets.resize(first + received);
+            memcpy(fds.sockets.data() + first, CMSG_DATA(cmsg), received * sizeof(int));
+            if (message.msg_flags & MSG_CTRUNC)
+                throw std::runtime_error("Missing sockets in handoff message");
+        }
+
+        std::vector<std::byte> data(header.dataSize);
+        readAll(channel, data);
+
+        HandoffState state;
+        size_t offset = 0;
+        const auto sockets = readValue<uint8_t>(data, offset);
+        if (sockets & 1)
+            state.tcpSocket = fds.take();
+        if (sockets & 2)
+            state.udpSocket = fds.take();
+        const auto clientCount = readValue<uint32_t>(data, offset);
+        for (uint32_t i = 0; i < clientCount; i++) {
+            HandoffClient client;
+            client.client = readClient(data, offset);
+            client.client.socket = fds.take();
+            client.interestMask = readValue<uint32_t>(data, offset);
+            client.input = readBytes(data, offset);
+            client.output = readBytes(data, offset);
+            client.session = readSession(data, offset);
+            state.clients.push_back(std::move(client));
+        }
+        const auto suspendedCount = readValue<uint32_t>(data, offset);
+        for (uint32_t i = 0; i < suspendedCount; i++) {
+            HandoffSuspendedSession suspended;
+            suspended.client = readClient(data, offset);
+            suspended.interestMask = readValue<uint32_t>(data, offset);
+            suspended.session = readSession(data, offset);
+            suspended.remaining = std::chrono::milliseconds(readValue<int64_t>(data, offset));
+            state.suspendedSessions.push_back(std::move(suspended));
+        }
+        fds.kept = true;
+        return state;
+    }
+
+    /**
+     * @brief Close the sockets of the state, once they were sent.
+     */
+    void closeSockets()
+    {
+        if (tcpSocket != -1)
+            close(tcpSocket);
+        if (udpSocket != -1)
+            close(udpSocket);
+        for (const HandoffClient &client : clients)
+            close(client.client.socket);
+        tcpSocket = -1;
+        udpSocket = -1;
+        clients.clear();
+    }
+
+    /**
+     * @brief Listen on a Unix socket path for the process taking over, replacing any stale socket file.
+     */
+    static int listenChannel(const std::string &path)
+    {
+        const sockaddr_un address = unixAddress(path);
+        const int channel = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (channel == -1)
+            throw std::runtime_error("Failed to create handoff socket");
+        unlink(path.c_str());
+        if (bind(channel, (const struct sockaddr *) &address, sizeof(address)) < 0 || ::listen(channel, 1) < 0) {
+            close(channel);
+            throw std::runtime_error("Failed to listen on handoff socket " + path);
+        }
+        return channel;
+    }
+
+    /**
+     * @brief Connect to the process handing its sockets over, retrying until it listens.
+     */
+    static int connectChannel(const std::string &path, const std::chrono::milliseconds &timeout)
+    {
+        const sockaddr_un address = unixAddress(path);
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+        while (true) {
+            const int channel = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (channel == -1)
+                throw std::runtime_error("Failed to create handoff socket");
+            if (connect(channel, (const struct sockaddr *) &address, sizeof(address)) == 0)
+                return channel;
+            close(channel);
+            if (std::chrono::steady_clock::now() >= deadline)
+                throw std::runtime_error("Failed to connect to handoff socket " + path);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    private:
+        // "HOFF", guards against connecting to an unrelated socket
+        static constexpr uint32_t Magic = 0x46464F48;
+        // SCM_MAX_FD is 253 on Linux
+        static constexpr size_t MaxFdsPerMessage = 250;
+
+        struct Header {
+            uint32_t magic;
+            uint32_t fdCount;
+            uint64_t dataSize;
+        };
+
+        // Closes the received sockets if receive() throws, and the ones no field took otherwise
+        struct ReceivedSockets {
+            std::vector<int> sockets;
+            size_t taken = 0;
+            bool kept = false;
+
+            ~ReceivedSockets()
+            {
+                for (size_t i = kept ? taken : 0; i < sockets.size(); i++)
+                    close(sockets[i]);
+            }
+
+            int take()
+            {
+                if (taken >= sockets.size())
+                    throw std::runtime_error("Missing sockets in handoff state");
+                return sockets[taken++];
+            }
+        };
+
+        static sockaddr_un unixAddress(const std::string &path)
+        {
+            sockaddr_un address{};
+            if (path.size() >= sizeof(address.sun_path))
+                throw std::runtime_error("Handoff socket path too long: " + path);
+            address.sun_family = AF_UNIX;
+            memcpy(address.sun_path, path.c_str(), path.size() + 1);
+            return address;
+        }
+
+        template<typename T>
+        static void appendValue(std::vector<std::byte> &out, const T &value)
+        {
+            const auto *bytes = reinterpret_cast<const std::byte *>(&value);
+            out.insert(out.end(), bytes, bytes + sizeof(T));
+        }
+
+        static void appendBytes(std::vector<std::byte> &out, std::span<const std::byte> bytes)
+        {
+            appendValue(out, static_cast<uint32_t>(bytes.size()));
+            out.insert(out.end(), bytes.begin(), bytes.end());
+        }
+
+        static void appendString(std::vector<std::byte> &out, const std::string &value)
+        {
+            appendBytes(out, std::span<const std::byte>(reinterpret_cast<const std::byte *>(value.data()), value.size()));
+        }
+
+        // Everything but the socket, it travels as a descriptor
+        static void appendClient(std::vector<std::byte> &out, const NetClient &client)
+        {
+            appendString(out, client.uuid);
+            appendString(out, client.ip);
+            appendValue(out, client.port);
+            appendValue(out, client.address);
+            appendValue(out, client.udpAddress);
+        }
+
+        static void appendSession(std::vector<std::byte> &out, const HandoffSession &session)
+        {
+            appendValue(out, session.token);
+            appendValue(out, static_cast<uint8_t>(session.pending));
+            appendValue(out, session.firstSequence);
+            appendValue(out, static_cast<uint32_t>(session.replay.size()));
+            for (const std::vector<std::byte> &packet : session.replay)
+                appendBytes(out, packet);
+        }
+
+        template<typename T>
+        static T readValue(std::span<const std::byte> data, size_t &offset)
+        {
+            T value;
+            if (data.size() - offset < sizeof(T))
+                throw std::runtime_error("Truncated handoff state");
+            memcpy(&value, data.data() + offset, sizeof(T));
+            offset += sizeof(T);
+            return value;
+        }
+
+        static std::vector<std::byte> readBytes(std::span<const std::byte> data, size_t &offset)
+        {
+            const auto size = readValue<uint32_t>(data, offset);
+            if (data.size() - offset < size)
+                throw std::runtime_error("Truncated handoff state");
+            std::vector<std::byte> bytes(data.begin() + offset, data.begin() + offset + size);
+            offset += size;
+            return bytes;
+        }
+
+        static std::string readString(std::span<const std::byte> data, size_t &offset)
+        {
+            const std::vector<std::byte> bytes = readBytes(data, offset);
+            return {reinterpret_cast<const char *>(bytes.data()), bytes.size()};
+        }
+
+        static NetClient readClient(std::span<const std::byte> data, size_t &offset)
+        {
+            NetClient client;
+            client.uuid = readString(data, offset);
+            client.ip = readString(data, offset);
+            client.port = readValue<unsigned int>(data, offset);
+            client.address = readValue<sockaddr_in>(data, offset);
+            client.udpAddress = readValue<sockaddr_in>(data, offset);
+            return client;
+        }
+
+        static HandoffSession readSession(std::span<const std::byte> data, size_t &offset)
+        {
+            HandoffSession session;
+            session.token = readValue<uint64_t>(data, offset);
+            session.pending = readValue<uint8_t>(data, offset) != 0;
+            session.firstSequence = readValue<uint64_t>(data, offset);
+            const auto count = readValue<uint32_t>(data, offset);
+            for (uint32_t i = 0; i < count; i++)
+                session.replay.push_back(readBytes(data, offset));
+            return session;
+        }
+
+        static void writeAll(const int &channel, std::span<const std::byte> bytes)
+        {
+            while (!bytes.empty()) {
+                const ssize_t result = ::send(channel, bytes.data(), bytes.size(), MSG_NOSIGNAL);
+                if (result < 0 && errno == EINTR)
+                    continue;
+                if (result <= 0)
+                    throw std::runtime_error("Failed to send handoff state");
+                bytes = bytes.subspan(result);
+            }
+        }
+
+        static void readAll(const int &channel, std::span<std::byte> bytes)
+        {
+            while (!bytes.empty()) {
+                const ssize_t result = recv(channel, bytes.data(), bytes.size(), 0);
+                if (result < 0 && errno == EINTR)
+                    continue;
+                if (result <= 0)
+                    throw std::runtime_error("Failed to receive handoff state");
+                bytes = bytes.subspan(result);
+            }
+        }
+};
@@ -0,0 +1,70 @@
+//
+// Created by Florian Damiot on 19/10/2026.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <sys/socket.h>
+
+/**
+ * @brief What the kernel reports about the packets it receives, to tell the network apart from our own queueing.
+ */
+struct SocketTelemetryConfig {
+    // SO_TIMESTAMPNS: the time the kernel received each read, recorded as NetMetrics kernelToHandler
+    bool timestamps = false;
+    // SO_RXQ_OVFL: the datagrams the kernel dropped because the socket buffer was full, UDP only
+    bool dropCounts = false;
+};
+
+/**
+ * @brief Set the telemetry options of a socket.
+ * @param datagram Whether it is a UDP socket, TCP never drops to a full socket buffer.
+ * @return false if the kernel refused one of them.
+ */
+inline bool applySocketTelemetry(const int &socket, const SocketTelemetryConfig &config, const bool &datagram)
+{
+    const int enable = 1;
+    bool applied = true;
+
+    if (config.timestamps)
+        applied &= setsockopt(socket, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) == 0;
+    if (config.dropCounts && datagram)
+        applied &= setsockopt(socket, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable)) == 0;
+    return applied;
+}
+
+/**
+ * @brief The telemetry of one read, parsed from the control messages of recvmsg().
+ */
+struct ReceiveTelemetry {
+    // Kernel receive time on the wall clock, 0 if not reported
+    uint64_t kernelNs = 0;
+    // Datagrams dropped by the socket since its creation, only reported once there was one
+    bool hasDrops = false;
+    uint32_t drops = 0;
+
+    // Room for every control message parse() reads
+    static constexpr size_t ControlSize = CMSG_SPACE(sizeof(timespec)) + CMSG_SPACE(sizeof(uint32_t));
+
+    static ReceiveTelemetry parse(msghdr &message)
+    {
+        ReceiveTelemetry telemetry;
+
+        for (cmsghdr *control = CMSG_FIRSTHDR(&message); control != nullptr; control = CMSG_NXTHDR(&message, control)) {
+            if (control->cmsg_level != SOL_SOCKET)
+                continue;
+            if (control->cmsg_type == SO_TIMESTAMPNS) {
+                timespec time{};
+                memcpy(&time, CMSG_DATA(control), sizeof(time));
+                telemetry.kernelNs = static_cast<uint64_t>(time.tv_sec) * 1000000000ull + time.tv_nsec;
+            } else if (control->cmsg_type == SO_RXQ_OVFL) {
+                memcpy(&telemetry.drops, CMSG_DATA(control), sizeof(telemetry.drops));
+                telemetry.hasDrops = true;
+            }
+        }
+        return telemetry;
+    }
+};
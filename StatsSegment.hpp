@@ -0,0 +1,416 @@
+//
+// Created by Florian Damiot on 19/10/2026.
+//
+
+#pragma once
+
+#include "./NetMetrics.hpp"
+#include "./ThreadConfig.hpp"
+#include "./NetLog.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Publish the live stats of the server in a shared memory segment, read by the netstat tool.
+ */
+struct StatsExportConfig {
+    bool enabled = false;
+    // Name of the POSIX shared memory object, "/net-stats-<TCP port>" if empty
+    std::string name;
+    // Time between two publications, the rates are computed over it
+    std::chrono::milliseconds interval{500};
+    // Packet ids exported at most, the ones received the most are kept
+    uint32_t maxPacketIds = 256;
+};
+
+/**
+ * @brief Percentiles of a LatencyHistogram, in nanoseconds.
+ */
+struct LatencySummary {
+    uint64_t count = 0;
+    uint64_t mean = 0;
+    uint64_t p50 = 0;
+    uint64_t p99 = 0;
+    uint64_t p999 = 0;
+    uint64_t max = 0;
+
+    static LatencySummary of(const HistogramSnapshot &histogram)
+    {
+        return {histogram.count, histogram.mean(), histogram.percentile(0.5),
+                histogram.percentile(0.99), histogram.percentile(0.999), histogram.percentile(1)};
+    }
+};
+
+/**
+ * @brief Stats of one packet id on one transport.
+ */
+struct PacketStats {
+    uint8_t transport = 0;
+    uint8_t unused[3]{};
+    uint32_t packetId = 0;
+    uint64_t received = 0;
+    uint64_t receivedBytes = 0;
+    uint64_t sent = 0;
+    uint64_t sentBytes = 0;
+    // Over the last interval
+    double receivedPerSecond = 0;
+    double sentPerSecond = 0;
+    LatencySummary decode;
+    LatencySummary handler;
+    LatencySummary kernelToHandler;
+};
+
+/**
+ * @brief Stats of the whole server. The histograms merge every packet id, in LatencyHistogram buckets.
+ */
+struct ServerStats {
+    // Wall clock
+    uint64_t publishedNs = 0;
+    uint64_t startedNs = 0;
+    uint64_t tcpClients = 0;
+    // Packets waiting for poll(), when queued dispatch is enabled
+    uint64_t dispatchQueueDepth = 0;
+    uint64_t dispatchQueueCapacity = 0;
+    // Tasks waiting for a thread of the handler executor
+    uint64_t executorPending = 0;
+    uint64_t executorThreads = 0;
+    // The default PacketBufferPool
+    uint64_t poolHits = 0;
+    uint64_t poolMisses = 0;
+    uint64_t poolInUse = 0;
+    uint64_t poolHighWaterMark = 0;
+    uint64_t kernelDropsUdp = 0;
+    // Records the metrics did not keep, see NetMetrics::getUntracked()
+    uint64_t untrackedPackets = 0;
+    uint64_t packetCount = 0;
+    uint64_t decode[LatencyHistogram::BucketCount]{};
+    uint64_t handler[LatencyHistogram::BucketCount]{};
+    uint64_t kernelToHandler[LatencyHistogram::BucketCount]{};
+};
+
+/**
+ * @brief Start of the segment, followed by a ServerStats and the PacketStats of packetCapacity ids.
+ * A reader refuses a segment whose magic, version or sizes do not match its own.
+ */
+struct StatsSegmentHeader {
+    // "NSTS"
+    static constexpr uint32_t Magic = 0x5354534E;
+    static constexpr uint32_t CurrentVersion = 1;
+
+    uint32_t magic = Magic;
+    uint32_t version = CurrentVersion;
+    uint32_t headerSize = sizeof(StatsSegmentHeader);
+    uint32_t serverStatsSize = sizeof(ServerStats);
+    uint32_t packetStatsSize = sizeof(PacketStats);
+    uint32_t packetCapacity = 0;
+    uint64_t pid = 0;
+    // Seqlock: odd while the server writes, see StatsSegmentReader::read()
+    alignas(64) uint64_t sequence = 0;
+
+    static size_t segmentSize(const uint32_t &packetCapacity)
+    {
+        return sizeof(StatsSegmentHeader) + sizeof(ServerStats) + packetCapacity * sizeof(PacketStats);
+    }
+};
+
+/**
+ * @brief Server side of the segment. Publishing is a plain copy between two increments
+ * of the sequence, readers never block it and it never waits for them.
+ */
+class StatsSegmentWriter {
+    public:
+        StatsSegmentWriter() = default;
+        StatsSegmentWriter(const StatsSegmentWriter &) = delete;
+        StatsSegmentWriter &operator=(const StatsSegmentWriter &) = delete;
+
+        ~StatsSegmentWriter()
+        {
+            close();
+        }
+
+        /**
+         * @brief Create the segment, replacing one left by a previous server of the same name.
+         */
+        void open(const std::string &name, const uint32_t &packetCapacity)
+        {
+            close();
+            const size_t size = StatsSegmentHeader::segmentSize(packetCapacity);
+            const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd == -1)
+                throw std::runtime_error("Failed to create stats segment " + name);
+            if (ftruncate(fd, static_cast<off_t>(size)) == -1) {
+                ::close(fd);
+                shm_unlink(name.c_str());
+                throw std::runtime_error("Failed to size stats segment " + name);
+            }
+            void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (data == MAP_FAILED) {
+                shm_unlink(name.c_str());
+                throw std::runtime_error("Failed to map stats segment " + name);
+            }
+            _data = static_cast<std::byte *>(data);
+            _size = size;
+            _name = name;
+            StatsSegmentHeader header;
+            header.packetCapacity = packetCapacity;
+            header.pid = static_cast<uint64_t>(getpid());
+            memcpy(_data, &header, sizeof(header));
+        }
+
+        /**
+         * @brief Unmap and remove the segment, the readers keep their mapping until they close it.
+         */
+        void close()
+        {
+            if (_data == nullptr)
+                return;
+            munmap(_data, _size);
+            shm_unlink(_name.c_str());
+            _data = nullptr;
+        }
+
+        /**
+         * @brief Replace the content of the segment, the packets beyond its capacity are left out.
+         */
+        void publish(const ServerStats &server, std::span<const PacketStats> packets)
+        {
+            auto *header = reinterpret_cast<StatsSegmentHeader *>(_data);
+            const size_t count = std::min<size_t>(packets.size(), header->packetCapacity);
+            std::atomic_ref<uint64_t> sequence(header->sequence);
+            const uint64_t current = sequence.load(std::memory_order_relaxed);
+
+            sequence.store(current + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            memcpy(_data + sizeof(StatsSegmentHeader), &server, sizeof(server));
+            reinterpret_cast<ServerStats *>(_data + sizeof(StatsSegmentHeader))->packetCount = count;
+            if (count != 0)
+                memcpy(_data + sizeof(StatsSegmentHeader) + sizeof(ServerStats), packets.data(), count * sizeof(PacketStats));
+            sequence.store(current + 2, std::memory_order_release);
+        }
+
+        bool isOpen() const
+        {
+            return _data != nullptr;
+        }
+
+    private:
+        std::byte *_data = nullptr;
+        size_t _size = 0;
+        std::string _name;
+};
+
+/**
+ * @brief Reader side of the segment, for another process. Reading takes no lock,
+ * and makes no system call unless it catches the server writing.
+ */
+class StatsSegmentReader {
+    public:
+        explicit StatsSegmentReader(const std::string &name)
+        {
+            const int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+            if (fd == -1)
+                throw std::runtime_error("No stats segment " + name + ", is the server exporting its stats?");
+            struct stat status{};
+            if (fstat(fd, &status) == -1 || static_cast<size_t>(status.st_size) < sizeof(StatsSegmentHeader)) {
+                ::close(fd);
+                throw std::runtime_error("Stats segment " + name + " is too small");
+            }
+            void *data = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (data == MAP_FAILED)
+                throw std::runtime_error("Failed to map stats segment " + name);
+            _data = static_cast<const std::byte *>(data);
+            _size = status.st_size;
+
+            memcpy(&_header, _data, sizeof(_header));
+            if (_header.magic != StatsSegmentHeader::Magic || _header.version != StatsSegmentHeader::CurrentVersion
+                || _header.headerSize != sizeof(StatsSegmentHeader) || _header.serverStatsSize != sizeof(ServerStats)
+                || _header.packetStatsSize != sizeof(PacketStats)
+                || StatsSegmentHeader::segmentSize(_header.packetCapacity) > _size) {
+                munmap(const_cast<std::byte *>(_data), _size);
+                throw std::runtime_error("Stats segment " + name + " has an incompatible layout, version "
+                                         + std::to_string(_header.version) + " where "
+                                         + std::to_string(StatsSegmentHeader::CurrentVersion) + " is expected");
+            }
+        }
+
+        StatsSegmentReader(const StatsSegmentReader &) = delete;
+        StatsSegmentReader &operator=(const StatsSegmentReader &) = delete;
+
+        ~StatsSegmentReader()
+        {
+            munmap(const_cast<std::byte *>(_data), _size);
+        }
+
+        /**
+         * @brief Copy the last publication, retrying while the server writes a new one.
+         * @return false if no complete publication could be read, e.g. the server died while writing.
+         */
+        bool read(ServerStats &server, std::vector<PacketStats> &packets, const size_t &attempts = 1000) const
+        {
+            std::atomic_ref<uint64_t> sequence(const_cast<StatsSegmentHeader *>(
+                reinterpret_cast<const StatsSegmentHeader *>(_data))->sequence);
+
+            for (size_t attempt = 0; attempt < attempts; attempt++) {
+                const uint64_t before = sequence.load(std::memory_order_acquire);
+                if (before == 0 || before % 2 != 0) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                memcpy(&server, _data + sizeof(StatsSegmentHeader), sizeof(server));
+                const size_t count = std::min<size_t>(server.packetCount, _header.packetCapacity);
+                packets.resize(count);
+                if (count != 0)
+                    memcpy(packets.data(), _data + sizeof(StatsSegmentHeader) + sizeof(ServerStats), count * sizeof(PacketStats));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (sequence.load(std::memory_order_relaxed) == before)
+                    return true;
+            }
+            return false;
+        }
+
+        const StatsSegmentHeader &getHeader() const
+        {
+            return _header;
+        }
+
+    private:
+        const std::byte *_data = nullptr;
+        size_t _size = 0;
+        StatsSegmentHeader _header;
+};
+
+/**
+ * @brief Thread publishing the stats on an interval, off the network threads.
+ * The collect function fills the counters, the publisher adds the rates.
+ */
+class StatsPublisher {
+    public:
+        using CollectFunction = std::function<void(ServerStats &, std::vector<PacketStats> &)>;
+
+        StatsPublisher() = default;
+        StatsPublisher(const StatsPublisher &) = delete;
+        StatsPublisher &operator=(const StatsPublisher &) = delete;
+
+        ~StatsPublisher()
+        {
+            stop();
+        }
+
+        void start(const StatsExportConfig &config, const CollectFunction &collect,
+                   const ThreadPlacement &placement, const NumaTopology &topology)
+        {
+            if (_thread.joinable())
+                throw std::runtime_error("Stats publisher already started");
+            _writer.open(config.name, config.maxPacketIds);
+            _config = config;
+            _collect = collect;
+            _stopping = false;
+            _previous.clear();
+            _startedNs = wallNowNs();
+            _thread = std::thread([this, placement, topology] {
+                const std::string applied = applyThreadPlacement(placement, topology);
+                NET_LOG_INFO("Publishing stats in {} {}", _config.name, applied);
+                run();
+            });
+        }
+
+        /**
+         * @brief Stop publishing and remove the segment.
+         */
+        void stop()
+        {
+            if (!_thread.joinable())
+                return;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stopping = true;
+            }
+            _wake.notify_one();
+            _thread.join();
+            _writer.close();
+        }
+
+    private:
+        static uint64_t wallNowNs()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (!_stopping) {
+                lock.unlock();
+                publish();
+                lock.lock();
+                _wake.wait_for(lock, _config.interval, [this] { return _stopping; });
+            }
+        }
+
+        void publish()
+        {
+            _server = ServerStats{};
+            _packets.clear();
+            _collect(_server, _packets);
+            _server.startedNs = _startedNs;
+            _server.publishedNs = wallNowNs();
+
+            const double elapsed = static_cast<double>(_server.publishedNs - _previousNs) / 1e9;
+            for (PacketStats &packet : _packets) {
+                const uint64_t key = (static_cast<uint64_t>(packet.transport) << 32) | packet.packetId;
+                auto [previous, inserted] = _previous.try_emplace(key, Counters{});
+                if (!inserted && elapsed > 0) {
+                    packet.receivedPerSecond = static_cast<double>(packet.received - previous->second.received) / elapsed;
+                    packet.sentPerSecond = static_cast<double>(packet.sent - previous->second.sent) / elapsed;
+                }
+                previous->second = {packet.received, packet.sent};
+            }
+            _previousNs = _server.publishedNs;
+            // The busiest ids first, so the segment keeps them when there are too many
+            std::sort(_packets.begin(), _packets.end(), [](const PacketStats &a, const PacketStats &b) {
+                return a.received + a.sent > b.received + b.sent;
+            });
+            _writer.publish(_server, _packets);
+        }
+
+    private:
+        struct Counters {
+            uint64_t received = 0;
+            uint64_t sent = 0;
+        };
+
+        StatsExportConfig _config;
+        CollectFunction _collect;
+        StatsSegmentWriter _writer;
+        std::thread _thread;
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        bool _stopping = false;
+
+        // Only used by the publisher thread
+        ServerStats _server;
+        std::vector<PacketStats> _packets;
+        std::unordered_map<uint64_t, Counters> _previous;
+        uint64_t _previousNs = 0;
+        uint64_t _startedNs = 0;
+};
@@ -6,18 +6,51 @@
 
 #include "./NewNetworkManager.hpp"
 #include "./EventRegistry.hpp"
+#include "./EventLoop.hpp"
+#include "./NetworkUtils.hpp"
+#include "./uuid.hpp"
+#include "./ClientTable.hpp"
+#include "./NetCoroutine.hpp"
+#include "./ThreadConfig.hpp"
+#include "./SocketHandoff.hpp"
+#include "./SessionResume.hpp"
+#include "./NetLog.hpp"
+#include "./ClockSync.hpp"
+#include "./DatagramAggregator.hpp"
+#include "./SocketTelemetry.hpp"
+#include "./InterestGrid.hpp"
 
 #include <iostream>
 #include <string>
 #include <unordered_map>
 #include <mutex>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <chrono>
 #include <future>
 #include <utility>
 #include <memory>
+#include <optional>
+#include <random>
 #include <vector>
 
+/**
+ * @brief Detection of dead and idle clients.
+ * A heartbeat is sent to every client each interval: on a half-open connection it stays
+ * unacknowledged and the kernel aborts the connection after unackedTimeout (TCP_USER_TIMEOUT).
+ * A client that sent nothing, not even its own heartbeats, for idleTimeout is disconnected.
+ */
+struct KeepAliveConfig {
+    bool enabled = false;
+    std::chrono::milliseconds heartbeatInterval{1000};
+    std::chrono::milliseconds idleTimeout{10000};
+    std::chrono::milliseconds unackedTimeout{5000};
+};
+
 class TcpManager {
     public:
 
@@ -29,88 +62,303 @@ class TcpManager {
         TcpManager(std::string host,
                    const unsigned int &port) :
                    _host(std::move(host)), _port(port) {
-            std::cout << "Creating TCP manager on " << _host << ":" << _port << std::endl;
+            NET_LOG_DEBUG("Creating TCP manager on {}:{}", _host, _port);
         }
 
         ~TcpManager()
         {
-            std::cout << "Destroying TCP manager" << std::endl;
+            NET_LOG_DEBUG("Destroying TCP manager");
+            if (_started)
+                stop(std::chrono::milliseconds(0));
         }
 
-        void start() {
+        /**
+         * @brief Bind the server socket and start the event loop thread, without waiting for clients.
+         * Throws if the socket cannot be bound.
+         * @return Ready once the event loop runs and accepts connections.
+         */
+        std::future<void> start() {
+            std::lock_guard<std::mutex> lock(_threadsMutex);
             if (_started)
                 throw std::runtime_error("TcpManager already started");
-            _started = true;
 
-            std::cout << "Starting TCP server on " << _host << ":" << _port << "..." << std::endl;
-            _serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+            NET_LOG_INFO("Starting TCP server on {}:{}...", _host, _port);
+            _serverSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
             if (_serverSocket == -1)
                 throw std::runtime_error("Failed to create socket for TCP server");
-            std::cout << "Created socket for TCP server" << std::endl;
+            NET_LOG_DEBUG("Created socket for TCP server");
+            const int reuse = 1;
+            setsockopt(_serverSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+            // Accepted sockets inherit the busy poll options of the listening socket
+            if (!applyBusyPollOptions(_serverSocket, _busyPoll))
+                NET_LOG_WARN("Failed to set busy poll options on TCP socket");
             sockaddr_in sockaddr{};
             sockaddr.sin_family = AF_INET;
             sockaddr.sin_addr.s_addr = _host == "localhost" ? INADDR_ANY : inet_addr(_host.c_str());
             sockaddr.sin_port = htons(_port);
-            if (bind(_serverSocket, (struct sockaddr *) &sockaddr, sizeof(sockaddr)) < 0)
+            if (bind(_serverSocket, (struct sockaddr *) &sockaddr, sizeof(sockaddr)) < 0) {
+                closeServerSocket();
                 throw std::runtime_error("Failed to bind socket for TCP server, port already in use");
-            std::cout << "Bound socket for TCP server" << std::endl;
-            if (listen(_serverSocket, 3) < 0)
+            }
+            NET_LOG_DEBUG("Bound socket for TCP server");
+            if (listen(_serverSocket, SOMAXCONN) < 0) {
+                closeServerSocket();
                 throw std::runtime_error("Failed to listen on socket for TCP server");
-            std::cout << "Listening on socket for TCP server with socket" << _serverSocket << "..." << std::endl;
-            startAcceptConnectionAsync();
-            sleep(100);
-            std::cout << "All TCP server started" << std::endl;
+            }
+            NET_LOG_INFO("Listening on socket for TCP server with socket {}...", _serverSocket);
+            return startLoop();
+        }
+
+        /**
+         * @brief Start from the listening socket and the clients handed over by a previous process,
+         * see HandoffState. The handed over clients are announced to the connect handler,
+         * except the ones that did not send their SessionRequest yet.
+         * @param serverSocket The listening socket, owned by the manager from now on.
+         * @param clients The clients, with the bytes they had in flight and their session.
+         * @param suspendedSessions The sessions of dropped clients, they can resume here until their grace period ends.
+         * @return Ready once the event loop runs and every client is adopted.
+         */
+        std::future<void> start(const int &serverSocket, std::vector<HandoffClient> clients,
+                                std::vector<HandoffSuspendedSession> suspendedSessions = {}) {
+            std::lock_guard<std::mutex> lock(_threadsMutex);
+            if (_started)
+                throw std::runtime_error("TcpManager already started");
+
+            NET_LOG_INFO("Starting TCP server on {}:{} from a handed over socket with {} clients...",
+                         _host, _port, clients.size());
+            _serverSocket = serverSocket;
+            fcntl(_serverSocket, F_SETFL, fcntl(_serverSocket, F_GETFL) | O_NONBLOCK);
+            _loop.post([this, clients = std::move(clients), suspendedSessions = std::move(suspendedSessions)]() mutable {
+                for (HandoffClient &client : clients)
+                    adoptClient(std::move(client));
+                const auto now = EventLoop::Clock::now();
+                for (HandoffSuspendedSession &handoff : suspendedSessions) {
+                    SuspendedSession suspended;
+                    suspended.client = std::move(handoff.client);
+                    suspended.interestMask = handoff.interestMask;
+                    suspended.session = importSession(handoff.session);
+                    suspended.expiry = now + handoff.remaining;
+                    adoptSuspendedSession(std::move(suspended));
+                }
+            });
+            return startLoop();
         }
 
-        void stop() {
+        /**
+         * @brief Stop using the listening socket and optionally the clients, and give them
+         * to the caller to send to the process taking over, see HandoffState.
+         * The manager keeps serving the clients not handed over until stop().
+         * Their state is kept until completeHandOff(), or cancelHandOff() if the transfer failed.
+         * Must not be called from the event loop thread.
+         * @param includeClients Hand the connected clients over too.
+         * @return The sockets, owned by the caller once the handoff is complete.
+         */
+        HandoffState handOff(const bool &includeClients) {
+            std::lock_guard<std::mutex> lock(_threadsMutex);
             if (!_started)
                 throw std::runtime_error("TcpManager is not started");
-            // lock with threadLock
+            if (_loop.isInLoopThread())
+                throw std::runtime_error("TcpManager cannot hand off from its event loop thread");
+            std::promise<HandoffState> exported;
+            std::future<HandoffState> state = exported.get_future();
+            // On the loop thread, so no byte is read or written while the state is copied
+            _loop.post([this, includeClients, &exported] { exported.set_value(exportState(includeClients)); });
+            return state.get();
+        }
+
+        /**
+         * @brief Forget what handOff() took once the process taking over received it.
+         * The coroutine sessions of the handed over clients end. The suspended sessions went
+         * to the other process with the clients, they end here without them.
+         */
+        void completeHandOff() {
+            runOnLoop([this] {
+                if (!_handoff.active)
+                    return;
+                // Their client reconnects to the other process
+                for (auto &[token, suspended] : _suspendedSessions)
+                    _loop.cancel(suspended.expiryTimer);
+                _suspendedSessions.clear();
+                // Coroutines cannot move to the other process, they end as if their client left
+                if (_handoff.includeClients)
+                    closeSessions();
+                _handoff = PendingHandoff();
+            });
+        }
+
+        /**
+         * @brief Serve the listening socket and the clients taken by handOff() again,
+         * after the transfer to the other process failed. The clients are not announced again.
+         */
+        void cancelHandOff() {
+            runOnLoop([this] {
+                if (!_handoff.active)
+                    return;
+                _serverSocket = _handoff.serverSocket;
+                _loop.add(_serverSocket, EPOLLIN, [this](uint32_t) { acceptConnections(); });
+                std::lock_guard<std::mutex> lock(_clientsMutex);
+                for (auto &[hot, cold] : _handoff.clients) {
+                    const int socket = hot.socket;
+                    _loop.add(socket, (hot.flags & CLIENT_FLAG_OUTPUT_PENDING) ? EPOLLIN | EPOLLOUT : EPOLLIN,
+                              [this, socket](uint32_t events) { handleConnectionEvents(socket, events); });
+                    // A new heartbeat, counting the transfer as activity
+                    const uint32_t index = insertClient(cold.client);
+                    cold.keepAliveTimer = _clients.cold(index).keepAliveTimer;
+                    cold.lastReceive = _clients.cold(index).lastReceive;
+                    _clients.hot(index) = hot;
+                    _clients.cold(index) = std::move(cold);
+                }
+                _udpBindTokens = std::move(_handoff.udpBindTokens);
+                _sessionTokens = std::move(_handoff.sessionTokens);
+                for (auto &[token, suspended] : _handoff.suspendedSessions)
+                    adoptSuspendedSession(std::move(suspended));
+                _handoff = PendingHandoff();
+                NET_LOG_INFO("Handoff cancelled, serving the listening socket and the clients again");
+            });
+        }
+
+        /**
+         * @brief Stop accepting clients, let the queued output drain until the deadline,
+         * then close every socket and join the event loop thread.
+         * Must not be called from the event loop thread.
+         * @param drainTimeout How long the output waiting for slow clients may delay the shutdown.
+         * @return true if every client received its whole output.
+         */
+        bool stop(const std::chrono::milliseconds &drainTimeout = std::chrono::milliseconds(1000)) {
             std::lock_guard<std::mutex> lock(_threadsMutex);
-            // set started to false
+            if (!_started)
+                throw std::runtime_error("TcpManager is not started");
+            if (_loop.isInLoopThread())
+                throw std::runtime_error("TcpManager cannot be stopped from its event loop thread");
             _started = false;
-            // close server socket
-            close(_serverSocket);
-            // clear connections
+
+            _loop.post([this] { closeServerSocket(); });
+            const auto deadline = EventLoop::Clock::now() + drainTimeout;
+            bool drained = !hasAnyPendingOutput();
+            while (!drained && EventLoop::Clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                drained = !hasAnyPendingOutput();
+            }
+            _loop.stop();
+            _loopThread.join();
+            _loop.cancel(_clockTimer);
+            _clockTimer = TimerWheel::InvalidTimer;
+
+            // The loop thread is gone, nothing else touches the sockets and the clients now
+            closeServerSocket();
+            if (_reserveFd != -1)
+                close(_reserveFd);
+            _reserveFd = -1;
+            for (const ClientTable::Hot &hot : _clients.hot()) {
+                _loop.remove(hot.socket);
+                close(hot.socket);
+            }
+            closeSessions();
+            std::lock_guard<std::mutex> clientsLock(_clientsMutex);
             _clients.clear();
-            // release lock
-            _threadsMutex.unlock();
-        }
-
-        // template<typename EventType>
-        // ssize_t sendEvent(int socket, const int eventId, const EventType event)
-        // {
-        //     std::vector<std::byte> data = _eventRegistry.serializeData(event);
-        //     ssize_t result = send(socket, reinterpret_cast<const char*>(data.data()), data.size(), 0);
-        //     if (result == -1) {
-        //         std::cerr << "Error: Failed to send message to client" << std::endl;
-        //     }
-        //     std::cout << "Sent message to client with " << result << " bytes" << std::endl;
-        //     return (result);
-        // }
-
-        // template<class EventType>
-        // void broadcastExcept(int socketExcept, unsigned int eventId, EventType &event)
-        // {
-        //     std::vector<std::byte> data = _eventRegistry.serializeData(event);
-        //     // get list of all key of _connections
-        //     std::vector<int> keys;
-        //     for (auto const& [key, val] : _connections) {
-        //         if (key != socketExcept)
-        //             sendEvent(key, eventId, event);
-        //     }
-        // }
-
-        // template<typename EvenType>
-        // void broadcast(unsigned int eventId, EvenType event)
-        // {
-        //     std::vector<std::byte> data = _eventRegistry.serializeData(event);
-        //     // get list of all key of _connections
-        //     std::vector<int> keys;
-        //     for (auto const& [key, val] : _connections) {
-        //         sendEvent(key, eventId, event);
-        //     }
-        // }
+            _udpBindTokens.clear();
+            _sessionTokens.clear();
+            _suspendedSessions.clear();
+            NET_LOG_INFO("TCP server stopped");
+            return drained;
+        }
+
+        /**
+         * @brief Send an event to a client, what the socket cannot take right now
+         * is kept in a pooled buffer and written once the socket is writable.
+         * @param socket The socket of the client.
+         * @param eventId The id of the packet.
+         * @param event The event to send.
+         * @return The number of bytes sent or queued, -1 if the client is unknown or the socket failed.
+         */
+        template<typename EventType>
+        ssize_t sendEvent(int socket, const int eventId, const EventType event)
+        {
+            PacketBuffer data = _eventRegistry.serializeData(event);
+            std::lock_guard<std::mutex> lock(_clientsMutex);
+            const int64_t index = _clients.find(socket);
+            if (index == -1)
+                return (-1);
+            return (sendPacket(index, eventId, data));
+        }
+
+        /**
+         * @brief Send an event to every client whose interest mask shares a bit with the given one, except one.
+         */
+        template<class EventType>
+        void broadcastExcept(int socketExcept, unsigned int eventId, EventType &event,
+                             const uint32_t &interestMask = CLIENT_INTEREST_ALL)
+        {
+            PacketBuffer data = _eventRegistry.serializeData(event);
+            std::lock_guard<std::mutex> lock(_clientsMutex);
+            std::span<ClientTable::Hot> clients = _clients.hot();
+            for (uint32_t i = 0; i < clients.size(); i++) {
+                if (clients[i].socket != socketExcept && (clients[i].interestMask & interestMask) != 0)
+                    sendPacket(i, eventId, data);
+            }
+        }
+
+        /**
+         * @brief Send an event to every client whose interest mask shares a bit with the given one.
+         */
+        template<typename EvenType>
+        void broadcast(unsigned int eventId, EvenType event,
+                       const uint32_t &interestMask = CLIENT_INTEREST_ALL)
+        {
+            PacketBuffer data = _eventRegistry.serializeData(event);
+            std::lock_guard<std::mutex> lock(_clientsMutex);
+            std::span<ClientTable::Hot> clients = _clients.hot();
+            for (uint32_t i = 0; i < clients.size(); i++) {
+                if ((clients[i].interestMask & interestMask) != 0)
+                    sendPacket(i, eventId, data);
+            }
+        }
+
+        /**
+         * @brief Send an event to the clients of the grid within a radius of a position, instead of to every client.
+         * @param grid The positions of the clients, identified by their socket.
+         */
+        template<typename EventType>
+        void broadcastNear(const InterestGrid &grid, const WorldPosition &position, const float &radius,
+                           unsigned int eventId, const EventType &event)
+        {
+            PacketBuffer data = _eventRegistry.serializeData(event);
+            std::lock_guard<std::mutex> lock(_clientsMutex);
+            grid.forEachClientNear(position, radius, [this, &eventId, &data](const int &socket) {
+                const int64_t index = _clients.find(socket);
+                if (index != -1)
+                    sendPacket(index, eventId, data);
+            });
+        }
+
+        /**
+         * @brief Send an update of an entity to the clients of the grid seeing it.
+         */
+        template<typename EventType>
+        void broadcastToWatchers(const InterestGrid &grid, const uint32_t &entity, unsigned int eventId, const EventType &event)
+        {
+            PacketBuffer data = _eventRegistry.serializeData(event);
+            std::lock_guard<std::mutex> lock(_clientsMutex);
+            grid.forEachWatcher(entity, [this, &eventId, &data](const int &socket) {
+                const int64_t index = _clients.find(socket);
+                if (index != -1)
+                    sendPacket(index, eventId, data);
+            });
+        }
+
+        /**
+         * @brief Choose which broadcasts a client receives, see broadcast().
+         * @return false if the client is unknown.
+         */
+        bool setClientInterestMask(int socket, const uint32_t &interestMask)
+        {
+            std::lock_guard<std::mutex> lock(_clientsMutex);
+            const int64_t index = _clients.find(socket);
+            if (index == -1)
+                return (false);
+            _clients.hot(index).interestMask = interestMask;
+            return (true);
+        }
 
         // Set the handler
 
@@ -124,44 +372,819 @@ class TcpManager {
             _onDisconnectHandler = std::make_shared<std::function<void(const NetClient&)>>(onClientDisconnectEvent);
         }
 
+        /**
+         * @brief Called instead of the connect handler when a client resumes its session,
+         * with its new socket and the number of packets of the session it received:
+         * the packets numbered below it (see getSessionSequence()) are valid delta baselines.
+         */
+        void setOnClientResumeEvent(const std::function<void(const NetClient&, uint64_t)> &onClientResumeEvent)
+        {
+            _onResumeHandler = std::make_shared<std::function<void(const NetClient&, uint64_t)>>(onClientResumeEvent);
+        }
+
+        // Getters
+
+        EventRegistry &getEventRegistry() {
+            return _eventRegistry;
+        }
+
+        /**
+         * @brief Keep the sessions of dropped clients for them to resume, must be called before start().
+         */
+        void setSessionResumption(const SessionResumeConfig &config) {
+            _sessionResume = config;
+        }
+
+        /**
+         * @brief Get the sequence number the next packet sent to a client gets, see setOnClientResumeEvent().
+         * @return false if the client is unknown.
+         */
+        bool getSessionSequence(const int &socket, uint64_t &sequence) {
+            std::lock_guard<std::mutex> lock(_clientsMutex);
+            const int64_t index = _clients.find(socket);
+            if (index == -1)
+                return false;
+            sequence = _clients.cold(index).session.replay.nextSequence();
+            return true;
+        }
+
+        /**
+         * @brief Count the packets sent and received per packet id, and time their handlers,
+         * must be called before start().
+         * @param metrics The metrics, it must outlive the manager, or nullptr to stop measuring.
+         */
+        void setMetrics(NetMetrics *metrics) {
+            _metrics = metrics;
+            _eventRegistry.setMetrics(metrics, NetTransport::Tcp);
+        }
+
+        /**
+         * @brief Record the packets received into the capture while it is started, must be called before start().
+         * @param capture The capture, it must outlive the manager, or nullptr.
+         */
+        void setCapture(TrafficCapture *capture) {
+            _capture = capture;
+            _eventRegistry.setCapture(capture, NetTransport::Tcp);
+        }
+
+        /**
+         * @brief Send heartbeats and disconnect dead or idle clients, must be called before start().
+         */
+        void setKeepAlive(const KeepAliveConfig &config) {
+            _keepAlive = config;
+        }
+
+        /**
+         * @brief Spin on the sockets instead of blocking in epoll, must be called before start().
+         */
+        void setBusyPoll(const BusyPollConfig &config) {
+            _busyPoll = config;
+            _loop.setBusyPoll(config);
+        }
+
+        /**
+         * @brief Timestamp the reads of the clients in the kernel, see SocketTelemetryConfig.
+         * Must be called before start().
+         */
+        void setSocketTelemetry(const SocketTelemetryConfig &config) {
+            _telemetry = config;
+        }
+
+        /**
+         * @brief Name and pin the event loop thread, must be called before start().
+         */
+        void setThreadPlacement(const ThreadPlacement &placement, const NumaTopology &topology) {
+            _placement = placement;
+            _topology = topology;
+        }
+
+        EventLoop &getEventLoop() {
+            return _loop;
+        }
+
+        /**
+         * @brief Check if bytes sent to a client still wait for the socket to be writable.
+         */
+        bool hasPendingOutput(int socket) {
+            std::lock_guard<std::mutex> lock(_clientsMutex);
+            const int64_t index = _clients.find(socket);
+            return index != -1 && (_clients.hot(index).flags & CLIENT_FLAG_OUTPUT_PENDING);
+        }
+
+        /**
+         * @brief Bind the UDP endpoint a datagram carrying a bind token came from to the TCP client
+         * that sent the same token, and confirm it to the client over TCP. Can be called from any thread.
+         */
+        void bindUdpEndpoint(const uint64_t &token, const sockaddr_in &from) {
+            _loop.post([this, token, from] {
+                auto it = _udpBindTokens.find(token);
+                if (it == _udpBindTokens.end())
+                    return;
+                std::unique_lock<std::mutex> lock(_clientsMutex);
+                const int64_t index = _clients.find(it->second);
+                if (index == -1)
+                    return;
+                const sockaddr_in previous = _clients.cold(index).client.udpAddress;
+                // Sent again for every bind datagram, the client stops once one confirmation arrives
+                _clients.cold(index).client.udpAddress = from;
+                sendPacket(index, UDP_BIND_PACKET_ID, {});
+                lock.unlock();
+                if (DatagramAggregator::endpointKey(previous) == DatagramAggregator::endpointKey(from))
+                    return;
+                // The new endpoint may be reused from a client gone without a word, its sequences start over
+                releaseUdpEndpoint(previous);
+                releaseUdpEndpoint(from);
+            });
+        }
+
+        /**
+         * @brief Get the UDP endpoint bound by a client.
+         * @return false if the client is unknown or did not bind an endpoint yet.
+         */
+        bool getUdpAddress(const int &socket, sockaddr_in &address) {
+            std::lock_guard<std::mutex> lock(_clientsMutex);
+            const int64_t index = _clients.find(socket);
+            if (index == -1 || _clients.cold(index).client.udpAddress.sin_port == 0)
+                return false;
+            address = _clients.cold(index).client.udpAddress;
+            return true;
+        }
+
+        /**
+         * @brief Get the UDP endpoints of many clients at once, skipping those without one.
+         */
+        void getUdpAddresses(std::span<const int> sockets, std::vector<sockaddr_in> &addresses) {
+            std::lock_guard<std::mutex> lock(_clientsMutex);
+            for (const int &socket : sockets) {
+                const int64_t index = _clients.find(socket);
+                if (index != -1 && _clients.cold(index).client.udpAddress.sin_port != 0)
+                    addresses.push_back(_clients.cold(index).client.udpAddress);
+            }
+        }
+
+        /**
+         * @brief Ping the clients over UDP to measure their RTT and clock offset, see ClockSync.hpp.
+         * Must be called before start().
+         */
+        void setClockSync(const ClockSyncConfig &config) {
+            _clockSync = config;
+        }
+
+        /**
+         * @brief Set the UDP socket the pings are sent from, -1 to stop pinging.
+         * Called by the UdpManager, waits for the event loop to stop using the previous socket.
+         */
+        void setClockSocket(const int &socket) {
+            runOnLoop([this, socket] { _clockSocket = socket; });
+        }
+
+        /**
+         * @brief Called on the loop thread with the UDP endpoint of a client that disconnected
+         * or bound another one, for the UdpManager to forget the state it keeps for it.
+         * Waits for the event loop to stop using the previous function.
+         */
+        void setOnUdpEndpointReleased(const std::function<void(const sockaddr_in &)> &onUdpEndpointReleased) {
+            runOnLoop([this, &onUdpEndpointReleased] { _onUdpEndpointReleased = onUdpEndpointReleased; });
+        }
+
+        /**
+         * @brief Add the sample of a pong, called by the UdpManager receiving it.
+         * Ignored unless it comes from the UDP endpoint of the client it names.
+         */
+        void handleClockPong(const ClockPong &pong, const sockaddr_in &from, const uint64_t &receiveNs) {
+            std::lock_guard<std::mutex> lock(_clientsMutex);
+            const int64_t index = _clients.find(static_cast<int>(pong.socket));
+            if (index == -1)
+                return;
+            ClientTable::Cold &cold = _clients.cold(index);
+            if (cold.client.udpAddress.sin_port != from.sin_port || cold.client.udpAddress.sin_addr.s_addr != from.sin_addr.s_addr)
+                return;
+            cold.clock.addSample(pong.serverSendNs, pong.clientReceiveNs, pong.clientSendNs, receiveNs);
+        }
+
+        /**
+         * @brief Get the RTT and clock offset estimates of a client.
+         * @return false if the client is unknown.
+         */
+        bool getClientClock(const int &socket, ClientClock &clock) {
+            std::lock_guard<std::mutex> lock(_clientsMutex);
+            const int64_t index = _clients.find(socket);
+            if (index == -1)
+                return false;
+            clock = _clients.cold(index).clock;
+            return true;
+        }
+
+        /**
+         * @brief Convert a time of the client clock, e.g. sent in an event, to a server tick.
+         * Nothing is converted for the handlers, they call this on the times they read.
+         * @return false if the client is unknown or was never measured.
+         */
+        bool toServerTick(const int &socket, const uint64_t &clientNs, uint64_t &tick) {
+            ClientClock clock;
+            if (!getClientClock(socket, clock) || clock.getSampleCount() == 0)
+                return false;
+            tick = clock.toServerTick(clientNs, _serverClock);
+            return true;
+        }
+
+        /**
+         * @brief The server ticks, counted from start().
+         */
+        const ServerClock &getServerClock() const {
+            return _serverClock;
+        }
+
+        /**
+         * @brief Check if bytes sent to any client still wait for the socket to be writable.
+         */
+        bool hasAnyPendingOutput() {
+            std::lock_guard<std::mutex> lock(_clientsMutex);
+            for (const ClientTable::Hot &hot : _clients.hot())
+                if (hot.flags & CLIENT_FLAG_OUTPUT_PENDING)
+                    return true;
+            return false;
+        }
+
+        /**
+         * @brief Route the packets of a client to a session coroutine instead of the EventRegistry,
+         * see NetSession. Must be called from the loop thread, e.g. in the connect handler.
+         * The packets go back to the registry once the caller released the mailbox.
+         * @param socket The socket of the client.
+         * @param inboxCapacity The packets kept while no recv() waits for them.
+         * @param overflow What happens to the packets arriving while the inbox is full.
+         * @return The mailbox of the session, already closed if the client is unknown.
+         */
+        std::shared_ptr<SessionMailbox> attachSession(int socket, const size_t &inboxCapacity = 256,
+                                                      const SessionOverflow &overflow = SessionOverflow::Drop) {
+            auto mailbox = std::make_shared<SessionMailbox>();
+            mailbox->socket = socket;
+            mailbox->inboxCapacity = inboxCapacity;
+            mailbox->overflow = overflow;
+            std::lock_guard<std::mutex> lock(_clientsMutex);
+            if (_clients.find(socket) == -1)
+                mailbox->closed = true;
+            else
+                _sessions[socket] = mailbox;
+            return mailbox;
+        }
+
+        size_t getClientCount() {
+            std::lock_guard<std::mutex> lock(_clientsMutex);
+            return _clients.size();
+        }
+
     // For private methods only
     private:
+        // Session of a dropped client, kept until it resumes or its grace period ends
+        struct SuspendedSession {
+            NetClient client;
+            uint32_t interestMask = CLIENT_INTEREST_ALL;
+            ClientSession session;
+            EventLoop::Clock::time_point expiry;
+            uint64_t expiryTimer = 0;
+        };
+
+
+        /**
+         * Run a task on the loop thread and wait for it, or right away if the loop does not run.
+         */
+        template<typename Function>
+        void runOnLoop(const Function &task) {
+            if (_loop.isInLoopThread()) {
+                task();
+                return;
+            }
+            // Held so stop() does not stop the loop before it ran the task
+            std::lock_guard<std::mutex> lock(_threadsMutex);
+            if (!_started) {
+                task();
+                return;
+            }
+            std::promise<void> done;
+            std::future<void> ran = done.get_future();
+            _loop.post([&task, &done] {
+                task();
+                done.set_value();
+            });
+            ran.wait();
+        }
+
+        /**
+         * Tell the UdpManager a UDP endpoint is no longer bound to this client.
+         * Must be called from the loop thread without _clientsMutex, the UdpManager locks its own state.
+         */
+        void releaseUdpEndpoint(const sockaddr_in &endpoint) {
+            if (endpoint.sin_port != 0 && _onUdpEndpointReleased)
+                _onUdpEndpointReleased(endpoint);
+        }
+
+        std::future<void> startLoop() {
+            _ready = std::promise<void>();
+            std::future<void> ready = _ready.get_future();
+            // Posted tasks run once the loop runs
+            _loop.post([this] { _ready.set_value(); });
+            _serverClock = {steadyNowNs(), static_cast<uint64_t>(std::max<int64_t>(_clockSync.tick.count(), 1))};
+            if (_clockSync.enabled)
+                _loop.post([this] { clockSyncTick(); });
+            // Kept free to accept and drop connections once the process runs out of descriptors
+            if (_reserveFd == -1)
+                _reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            startAcceptConnectionAsync();
+            _started = true;
+            return ready;
+        }
+
+        /**
+         * Take the listening socket and the clients out of the loop, keeping their state
+         * in _handoff until the handoff completes or is cancelled.
+         */
+        HandoffState exportState(const bool &includeClients) {
+            HandoffState state;
+
+            // The new process accepts from the same socket, pending connections wait in its backlog
+            _loop.cancel(_acceptRetryTimer);
+            _acceptRetryTimer = TimerWheel::InvalidTimer;
+            _loop.remove(_serverSocket);
+            state.tcpSocket = _serverSocket;
+            _handoff = PendingHandoff();
+            _handoff.active = true;
+            _handoff.includeClients = includeClients;
+            _handoff.serverSocket = _serverSocket;
+            _serverSocket = -1;
+            if (!includeClients)
+                return state;
+            std::lock_guard<std::mutex> lock(_clientsMutex);
+            for (uint32_t index = 0; index < _clients.size(); index++) {
+                const ClientTable::Hot &hot = _clients.hot(index);
+                ClientTable::Cold &cold = _clients.cold(index);
+                HandoffClient client;
+                client.client = cold.client;
+                client.interestMask = hot.interestMask;
+                client.input.assign(cold.input.begin(), cold.input.end());
+                if (hot.outputOffset < cold.output.size())
+                    client.output.assign(cold.output.begin() + hot.outputOffset, cold.output.end());
+                client.session = exportSession(cold.session);
+                _loop.remove(hot.socket);
+                _loop.cancel(cold.keepAliveTimer);
+                state.clients.push_back(std::move(client));
+                _handoff.clients.emplace_back(hot, std::move(cold));
+            }
+            _clients.clear();
+            _handoff.udpBindTokens = std::exchange(_udpBindTokens, {});
+            _handoff.sessionTokens = std::exchange(_sessionTokens, {});
+            // Their grace period goes on in the other process, it must not end here meanwhile
+            const auto now = EventLoop::Clock::now();
+            for (auto &[token, suspended] : _suspendedSessions) {
+                _loop.cancel(suspended.expiryTimer);
+                HandoffSuspendedSession handoff;
+                handoff.client = suspended.client;
+                handoff.interestMask = suspended.interestMask;
+                handoff.session = exportSession(suspended.session);
+                handoff.remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::max<EventLoop::Clock::duration>(suspended.expiry - now, EventLoop::Clock::duration::zero()));
+                state.suspendedSessions.push_back(std::move(handoff));
+            }
+            _handoff.suspendedSessions = std::exchange(_suspendedSessions, {});
+            return state;
+        }
+
+        /**
+         * The session of a client, nullptr if it has none or its coroutine ended.
+         * Only used from the loop thread.
+         */
+        std::shared_ptr<SessionMailbox> findSession(const int &socket) {
+            auto it = _sessions.find(socket);
+            if (it == _sessions.end())
+                return nullptr;
+            std::shared_ptr<SessionMailbox> mailbox = it->second.lock();
+            if (mailbox == nullptr)
+                _sessions.erase(it);
+            return mailbox;
+        }
+
+        /**
+         * End every session as if its client left.
+         */
+        void closeSessions() {
+            // Closing resumes the coroutines, which may attach again
+            const auto sessions = std::exchange(_sessions, {});
+            for (const auto &[socket, session] : sessions)
+                if (std::shared_ptr<SessionMailbox> mailbox = session.lock())
+                    mailbox->close();
+        }
+
+        void adoptClient(HandoffClient handoff) {
+            const int socket = handoff.client.socket;
+            _loop.add(socket, EPOLLIN, [this, socket](uint32_t events) {
+                handleConnectionEvents(socket, events);
+            });
+            std::unique_lock<std::mutex> lock(_clientsMutex);
+            const uint32_t index = insertClient(std::move(handoff.client));
+            _clients.hot(index).interestMask = handoff.interestMask;
+            if (!handoff.input.empty()) {
+                PacketBuffer &input = _clients.cold(index).input;
+                input = PacketBufferPool::getDefault().acquire(std::max<size_t>(BUFFER_SIZE, handoff.input.size()));
+                input.resize(handoff.input.size());
+                memcpy(input.data(), handoff.input.data(), handoff.input.size());
+                // Only the start of a packet is in it, this just grows the buffer to fit the whole packet
+                dispatchPackets(input, socket);
+            }
+            // What the previous process could not write goes out before anything new
+            if (!handoff.output.empty()) {
+                _clients.cold(index).output = PacketBufferPool::getDefault().acquire(handoff.output);
+                _clients.hot(index).flags |= CLIENT_FLAG_OUTPUT_PENDING;
+                _loop.modify(socket, EPOLLIN | EPOLLOUT);
+            }
+            ClientSession &session = _clients.cold(index).session;
+            session = importSession(handoff.session);
+            if (session.token != 0)
+                _sessionTokens[session.token] = socket;
+            const bool announced = !session.pending;
+            lock.unlock();
+            // The others are announced once they sent their SessionRequest
+            if (announced && _onConnectHandler)
+                (*_onConnectHandler)(_clients.cold(index).client);
+        }
+
+        static HandoffSession exportSession(const ClientSession &session) {
+            HandoffSession handoff;
+            handoff.token = session.token;
+            handoff.pending = session.pending;
+            handoff.firstSequence = session.replay.firstSequence();
+            session.replay.replayFrom(handoff.firstSequence, [&handoff](std::span<const std::byte> packet) {
+                handoff.replay.emplace_back(packet.begin(), packet.end());
+            });
+            return handoff;
+        }
+
+        static ClientSession importSession(const HandoffSession &handoff) {
+            ClientSession session;
+            session.token = handoff.token;
+            session.pending = handoff.pending;
+            session.replay.restartAt(handoff.firstSequence);
+            for (const std::vector<std::byte> &packet : handoff.replay)
+                session.replay.appendFramed(packet);
+            return session;
+        }
+
+        void closeServerSocket() {
+            if (_serverSocket == -1)
+                return;
+            _loop.cancel(_acceptRetryTimer);
+            _acceptRetryTimer = TimerWheel::InvalidTimer;
+            _loop.remove(_serverSocket);
+            close(_serverSocket);
+            _serverSocket = -1;
+        }
 
         void startAcceptConnectionAsync() {
+            _loop.add(_serverSocket, EPOLLIN, [this](uint32_t) { acceptConnections(); });
+            _loopThread = std::thread([this] {
+                const std::string applied = applyThreadPlacement(_placement, _topology);
+                NET_LOG_INFO("Starting event loop thread {}", applied);
+                _loop.run();
+            });
+            NET_LOG_DEBUG("Started event loop thread with thread id {}", _loopThread.get_id());
+        }
 
-            std::thread t([] {
-                std::cout << "Starting accept thread" << std::endl;
-                while (true) {
-                    std::cout << "Waiting for incoming connection..." << std::endl;
-                }
-                //while (true) {
-                //    sockaddr_in client_address{};
-                //    socklen_t client_address_size = sizeof(client_address);
-                //    int client_socket = accept(servSock, reinterpret_cast<sockaddr *>(&client_address), &client_address_size);
-                //    if (client_socket == -1) {
-                //        std::cerr << "Error: Failed to accept incoming connection" << std::endl;
-                //        continue;
-                //    }
-                //    std::cout << "Accepted connection from " << inet_ntoa(client_address.sin_addr) << ":" << ntohs(client_address.sin_port) << std::endl;
-                //    // Start read thread
-                //    std::thread t([&client_socket, this] { handleIncomingMessagesHandler(client_socket); });
-                //}
+        void acceptConnections() {
+            while (true) {
+                sockaddr_in client_address{};
+                socklen_t client_address_size = sizeof(client_address);
+                int client_socket = accept4(_serverSocket, reinterpret_cast<sockaddr *>(&client_address),
+                                            &client_address_size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (client_socket == -1) {
+                    const int error = errno;
+                    if (error == EINTR || error == ECONNABORTED)
+                        continue;
+                    if (error == EAGAIN || error == EWOULDBLOCK)
+                        return;
+                    if (error == EMFILE || error == ENFILE) {
+                        // The pending connection keeps the level triggered listener readable, it must leave the backlog
+                        const int dropError = dropPendingConnection();
+                        if (dropError == 0)
+                            continue;
+                        // Descriptors are allocated before the backlog is checked, it may just be empty
+                        if (dropError == EAGAIN || dropError == EWOULDBLOCK)
+                            return;
+                    }
+                    if (error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM) {
+                        pauseAccepting(error);
+                        return;
+                    }
+                    NET_LOG_ERROR("Failed to accept incoming connection: {}", strerror(error));
+                    return;
+                }
+                _droppingConnections = false;
+                const int noDelay = 1;
+                setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+                if (!applySocketTelemetry(client_socket, _telemetry, false))
+                    NET_LOG_WARN("Failed to enable kernel timestamps on client socket {}", client_socket);
+                NET_LOG_DEBUG("Accepted connection from {}:{}", inet_ntoa(client_address.sin_addr), ntohs(client_address.sin_port));
+
+                NetClient client;
+                client.uuid = generateRandomUuid();
+                client.socket = client_socket;
+                client.ip = inet_ntoa(client_address.sin_addr);
+                client.port = ntohs(client_address.sin_port);
+                client.address = client_address;
+                _loop.add(client_socket, EPOLLIN, [this, client_socket](uint32_t events) {
+                    handleConnectionEvents(client_socket, events);
+                });
+                onConnectClient(std::move(client));
+            }
+        }
+
+        /**
+         * Accept the pending connection with the reserve descriptor and close it right away.
+         * @return 0 once a connection was dropped, else the error of accept, EMFILE without a reserve descriptor.
+         */
+        int dropPendingConnection() {
+            if (_reserveFd == -1)
+                return EMFILE;
+            close(_reserveFd);
+            const int dropped = accept4(_serverSocket, nullptr, nullptr, SOCK_CLOEXEC);
+            const int error = dropped == -1 ? errno : 0;
+            if (dropped != -1)
+                close(dropped);
+            _reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            if (dropped == -1)
+                return error;
+            if (!_droppingConnections)
+                NET_LOG_WARN("Out of file descriptors, dropping incoming connections");
+            _droppingConnections = true;
+            return 0;
+        }
+
+        /**
+         * Stop watching the listener until the retry delay passed, the connections wait in the backlog.
+         */
+        void pauseAccepting(const int &error) {
+            if (_acceptRetryTimer != TimerWheel::InvalidTimer)
+                return;
+            NET_LOG_WARN("Failed to accept incoming connection: {}, retrying in {}ms", strerror(error), ACCEPT_RETRY_DELAY.count());
+            _loop.modify(_serverSocket, 0);
+            _acceptRetryTimer = _loop.schedule(EventLoop::Clock::now() + ACCEPT_RETRY_DELAY, [this] {
+                _acceptRetryTimer = TimerWheel::InvalidTimer;
+                if (_reserveFd == -1)
+                    _reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                if (_serverSocket != -1)
+                    _loop.modify(_serverSocket, EPOLLIN);
             });
-            std::cout << "Started accept thread with thread id " << t.get_id() << std::endl;
         }
 
-        void handleIncomingMessagesHandler(const int sock) const {
-            std::cout << "Starting message handler thread for " << sock << std::endl;
+        void handleConnectionEvents(const int sock, const uint32_t events) {
+            int64_t index;
+            {
+                std::lock_guard<std::mutex> lock(_clientsMutex);
+                index = _clients.find(sock);
+                if (index == -1)
+                    return;
+            }
+            // Only the loop thread inserts or erases clients, the index stays valid here
+            if ((events & (EPOLLERR | EPOLLHUP)) && !(events & EPOLLIN)) {
+                onDisconnectClient(sock);
+                return;
+            }
+            if (events & EPOLLOUT) {
+                bool drained;
+                {
+                    std::lock_guard<std::mutex> lock(_clientsMutex);
+                    drained = flushOutput(index);
+                }
+                // Resume a waiting session without the lock, it may send again
+                if (drained)
+                    if (std::shared_ptr<SessionMailbox> session = findSession(sock))
+                        session->drained();
+            }
+            if (events & EPOLLIN) {
+                if (_keepAlive.enabled)
+                    _clients.cold(index).lastReceive = EventLoop::Clock::now();
+                handleIncomingMessagesHandler(sock, _clients.cold(index).input);
+            }
+        }
+
+        /**
+         * Read everything available on the socket and dispatch every complete packet.
+         * Called from the loop thread only, so the input buffer needs no lock.
+         */
+        void handleIncomingMessagesHandler(const int sock, PacketBuffer &input) {
+
             while (true) {
-                char buffer[BUFFER_SIZE] = {0};
-                const ssize_t recv_result = recv(sock, buffer, BUFFER_SIZE, 0);
-                if (recv_result <= 0)
+                if (input.capacity() == 0) {
+                    input = PacketBufferPool::getDefault().acquire(BUFFER_SIZE);
+                    input.resize(0);
+                }
+                const size_t filled = input.size();
+                iovec iov{input.data() + filled, input.capacity() - filled};
+                alignas(cmsghdr) std::byte control[ReceiveTelemetry::ControlSize];
+                msghdr message{};
+                message.msg_iov = &iov;
+                message.msg_iovlen = 1;
+                if (_telemetry.timestamps) {
+                    message.msg_control = control;
+                    message.msg_controllen = sizeof(control);
+                }
+                const ssize_t recv_result = recvmsg(sock, &message, 0);
+                if (recv_result < 0 && errno == EINTR)
+                    continue;
+                if (recv_result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
                     break;
-                std::cout << "Received " << recv_result << " bytes from " << sock << std::endl;
+                if (recv_result <= 0) {
+                    onDisconnectClient(sock);
+                    return;
+                }
+                NET_LOG_TRACE("Received {} bytes from {}", recv_result, sock);
+                input.resize(filled + recv_result);
+                // The kernel reports the time of the last segment read, a packet is complete once it arrived
+                const uint64_t arrivalNs = _telemetry.timestamps ? ReceiveTelemetry::parse(message).kernelNs : 0;
+                if (!dispatchPackets(input, sock, arrivalNs)) {
+                    onDisconnectClient(sock);
+                    return;
+                }
+            }
+            // Drained, give the buffer back until the socket is readable again
+            if (input.empty())
+                input.reset();
+        }
+
+        /**
+         * Remember the token a client will send over UDP to bind its endpoint, see bindUdpEndpoint().
+         */
+        void registerUdpBindToken(const int sock, std::span<const std::byte> payload) {
+            uint64_t token;
+            if (payload.size() != sizeof(token))
+                return;
+            memcpy(&token, payload.data(), sizeof(token));
+            std::lock_guard<std::mutex> lock(_clientsMutex);
+            const int64_t index = _clients.find(sock);
+            if (index == -1 || token == 0 || _udpBindTokens.contains(token))
+                return;
+            _udpBindTokens.erase(_clients.cold(index).udpBindToken);
+            _clients.cold(index).udpBindToken = token;
+            _udpBindTokens[token] = sock;
+        }
+
+        /**
+         * Dispatch every complete packet of the buffer and move the incomplete one to its front,
+         * growing the buffer if that packet does not fit.
+         * @return false if the client sent a packet bigger than MAX_PACKET_SIZE,
+         * or filled the inbox of a session set to SessionOverflow::Disconnect.
+         */
+        bool dispatchPackets(PacketBuffer &input, const uint64_t &strand, const uint64_t &arrivalNs = 0) {
+            bool overflowed = false;
+
+            const bool valid = consumePackets(input, [this, &strand, &arrivalNs, &overflowed](uint32_t packetId,
+                                                                                      std::span<const std::byte> payload) {
+                // Heartbeats only refresh the idle timeout, which reading them already did
+                if (packetId == HEARTBEAT_PACKET_ID)
+                    return;
+                if (packetId == UDP_BIND_PACKET_ID) {
+                    registerUdpBindToken(static_cast<int>(strand), payload);
+                    return;
+                }
+                if (packetId == SESSION_PACKET_ID) {
+                    handleSessionRequest(static_cast<int>(strand), payload);
+                    return;
+                }
+                if (packetId == SESSION_ACK_PACKET_ID) {
+                    acknowledgeSession(static_cast<int>(strand), payload);
+                    return;
+                }
+                // Looked up for every packet, the coroutine may end on any of them.
+                // Held while pushing, the mailbox must outlive the coroutine it resumes.
+                if (std::shared_ptr<SessionMailbox> session = findSession(static_cast<int>(strand))) {
+                    // The coroutine reads it without the registry, count it here
+                    if (_metrics != nullptr)
+                        if (PacketMetrics *metrics = _metrics->local(NetTransport::Tcp, packetId))
+                            metrics->addReceived(payload.size());
+                    if (_capture != nullptr)
+                        _capture->record(NetTransport::Tcp, packetId, payload, strand);
+                    if (!session->push(packetId, payload)) {
+                        NET_LOG_DEBUG("Session inbox of client {} is full, packet {} dropped", strand, packetId);
+                        overflowed = session->overflow == SessionOverflow::Disconnect;
+                    }
+                }
+                else
+                    _eventRegistry.dispatch(packetId, payload, strand, arrivalNs);
+            }, overflowed);
+            return valid && !overflowed;
+        }
+
+        /**
+         * Write a packet to a client, or queue it behind the output already waiting.
+         * Must be called with _clientsMutex locked.
+         */
+        ssize_t sendPacket(const uint32_t &index, const uint32_t &packetId, std::span<const std::byte> data) {
+            ClientTable::Hot &hot = _clients.hot(index);
+            const NetPacketHeader header{packetId, static_cast<uint32_t>(data.size())};
+            const auto *headerBytes = reinterpret_cast<const std::byte *>(&header);
+            const size_t total = sizeof(header) + data.size();
+            size_t sent = 0;
+
+            if (_metrics != nullptr)
+                if (PacketMetrics *metrics = _metrics->local(NetTransport::Tcp, packetId))
+                    metrics->addSent(data.size());
+            // Kept before writing, a packet lost with the connection is replayed on resume
+            ClientSession &session = _clients.cold(index).session;
+            if (session.token != 0 && packetId < FIRST_RESERVED_PACKET_ID)
+                session.replay.append(header, data, _sessionResume.maxReplayBytes);
+            if (!(hot.flags & CLIENT_FLAG_OUTPUT_PENDING)) {
+                iovec iov[2] = {{const_cast<std::byte *>(headerBytes), sizeof(header)},
+                                {const_cast<std::byte *>(data.data()), data.size()}};
+                msghdr message{};
+                message.msg_iov = iov;
+                message.msg_iovlen = 2;
+                const ssize_t result = sendmsg(hot.socket, &message, MSG_NOSIGNAL);
+                if (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                    NET_LOG_ERROR("Failed to send message to client {}: {}", hot.socket, strerror(errno));
+                    return (-1);
+                }
+                sent = result < 0 ? 0 : result;
+                if (sent == total)
+                    return (total);
+            }
+            // Keep what the socket did not take and wait for it to be writable
+            PacketBuffer &output = _clients.cold(index).output;
+            if (sent < sizeof(header))
+                appendOutput(output, std::span<const std::byte>(headerBytes + sent, sizeof(header) - sent));
+            const size_t dataSent = sent > sizeof(header) ? sent - sizeof(header) : 0;
+            appendOutput(output, data.subspan(dataSent));
+            if (!(hot.flags & CLIENT_FLAG_OUTPUT_PENDING)) {
+                hot.flags |= CLIENT_FLAG_OUTPUT_PENDING;
+                _loop.modify(hot.socket, EPOLLIN | EPOLLOUT);
+            }
+            return (total);
+        }
+
+        static void appendOutput(PacketBuffer &output, std::span<const std::byte> bytes) {
+            if (output.capacity() == 0) {
+                output = PacketBufferPool::getDefault().acquire(bytes.size());
+                output.resize(0);
+            }
+            const size_t current = output.size();
+            output.resize(current + bytes.size());
+            memcpy(output.data() + current, bytes.data(), bytes.size());
+        }
+
+        /**
+         * Queue bytes already framed behind the output of a client, written once the socket is writable.
+         * Must be called with _clientsMutex locked.
+         */
+        void queueOutput(const uint32_t &index, std::span<const std::byte> bytes) {
+            ClientTable::Hot &hot = _clients.hot(index);
+            appendOutput(_clients.cold(index).output, bytes);
+            if (!(hot.flags & CLIENT_FLAG_OUTPUT_PENDING)) {
+                hot.flags |= CLIENT_FLAG_OUTPUT_PENDING;
+                _loop.modify(hot.socket, EPOLLIN | EPOLLOUT);
             }
+        }
+
+        /**
+         * Write the queued output, the buffer goes back to the pool once everything is written.
+         * Must be called with _clientsMutex locked.
+         * @return true if the whole output was written.
+         */
+        bool flushOutput(const uint32_t &index) {
+            ClientTable::Hot &hot = _clients.hot(index);
+            PacketBuffer &output = _clients.cold(index).output;
 
-            // Remove the disconnected connection from the connections map
-            //onDisconnectClient(netClient);
+            while (hot.outputOffset < output.size()) {
+                const ssize_t result = ::send(hot.socket, output.data() + hot.outputOffset,
+                                              output.size() - hot.outputOffset, MSG_NOSIGNAL);
+                if (result < 0 && errno == EINTR)
+                    continue;
+                if (result < 0)
+                    return (false);
+                hot.outputOffset += result;
+            }
+            output.reset();
+            hot.outputOffset = 0;
+            hot.flags &= ~CLIENT_FLAG_OUTPUT_PENDING;
+            _loop.modify(hot.socket, EPOLLIN);
+            return (true);
+        }
+
+        /**
+         * Heartbeat timer of a client: disconnect it if it was idle too long, otherwise send a heartbeat.
+         * Checking the last receive time when the timer fires avoids rescheduling it on every packet.
+         */
+        void keepAliveTick(const int sock) {
+            std::unique_lock<std::mutex> lock(_clientsMutex);
+            const int64_t index = _clients.find(sock);
+            if (index == -1)
+                return;
+            const auto now = EventLoop::Clock::now();
+            if (now - _clients.cold(index).lastReceive >= _keepAlive.idleTimeout) {
+                lock.unlock();
+                NET_LOG_INFO("Client {} timed out", sock);
+                onDisconnectClient(sock);
+                return;
+            }
+            sendPacket(index, HEARTBEAT_PACKET_ID, {});
+            _clients.cold(index).keepAliveTimer = _loop.schedule(now + _keepAlive.heartbeatInterval,
+                                                                 [this, sock] { keepAliveTick(sock); });
         }
 
         /**
@@ -169,32 +1192,254 @@ class TcpManager {
          * This method add the client to the list of clients and call the onConnectClient method.
          * @param client
          */
-        void onConnectClient(const NetClient &client)
+        void onConnectClient(NetClient client)
         {
             std::unique_lock<std::mutex> lock(_clientsMutex);
-            //_clients.push_back(client);
+            const uint32_t index = insertClient(std::move(client));
+            if (_sessionResume.enabled) {
+                // Announced once the client says whether it starts or resumes a session
+                _clients.cold(index).session.pending = true;
+                _clients.hot(index).interestMask = 0;
+                return;
+            }
             lock.unlock();
+            // Only the loop thread inserts or erases clients, the index stays valid here
             if (_onConnectHandler)
-                (*_onConnectHandler)(client);
+                (*_onConnectHandler)(_clients.cold(index).client);
+        }
+
+        /**
+         * Add a client to the table and start its heartbeat.
+         * Must be called with _clientsMutex locked.
+         */
+        uint32_t insertClient(NetClient client)
+        {
+            const uint32_t index = _clients.insert(std::move(client));
+            if (_keepAlive.enabled) {
+                const int socket = _clients.hot(index).socket;
+                const auto unacked = static_cast<unsigned int>(_keepAlive.unackedTimeout.count());
+                setsockopt(socket, IPPROTO_TCP, TCP_USER_TIMEOUT, &unacked, sizeof(unacked));
+                _clients.cold(index).lastReceive = EventLoop::Clock::now();
+                _clients.cold(index).keepAliveTimer = _loop.schedule(EventLoop::Clock::now() + _keepAlive.heartbeatInterval,
+                                                                     [this, socket] { keepAliveTick(socket); });
+            }
+            return index;
+        }
+
+        /**
+         * Ping a slice of the clients, every client is pinged once per interval
+         * without a burst of datagrams at each interval.
+         */
+        void clockSyncTick() {
+            const auto slice = std::chrono::milliseconds(100);
+            const uint32_t slices = static_cast<uint32_t>(std::max<int64_t>(_clockSync.interval / slice, 1));
+
+            if (_clockSocket != -1) {
+                // Copied under the lock, the threads sending packets must not wait behind the syscalls
+                _clockTargets.clear();
+                {
+                    std::lock_guard<std::mutex> lock(_clientsMutex);
+                    for (uint32_t index = _clockSlice; index < _clients.size(); index += slices) {
+                        const ClientTable::Cold &cold = _clients.cold(index);
+                        if (cold.client.udpAddress.sin_port == 0)
+                            continue;
+                        ClockPing ping;
+                        ping.socket = static_cast<uint32_t>(_clients.hot(index).socket);
+                        ping.smoothedRttNs = cold.clock.getSmoothedRttNs();
+                        ping.offsetNs = cold.clock.getOffsetNs();
+                        ping.epochNs = _serverClock.epochNs;
+                        ping.tickNs = _serverClock.tickNs;
+                        _clockTargets.emplace_back(cold.client.udpAddress, ping);
+                    }
+                }
+                for (auto &[address, ping] : _clockTargets) {
+                    ping.serverSendNs = steadyNowNs();
+                    _clockPings.enqueue(address, CLOCK_SYNC_PACKET_ID,
+                                        std::span<const std::byte>(reinterpret_cast<const std::byte *>(&ping), sizeof(ping)));
+                    _clockPings.flush([this](const sockaddr_in &to, std::span<const std::byte> datagram) {
+                        sendto(_clockSocket, datagram.data(), datagram.size(), 0, (const struct sockaddr *) &to, sizeof(to));
+                    });
+                }
+            }
+            _clockSlice = (_clockSlice + 1) % slices;
+            _clockTimer = _loop.schedule(EventLoop::Clock::now() + std::min<EventLoop::Clock::duration>(_clockSync.interval, slice),
+                                         [this] { clockSyncTick(); });
         }
 
         /**
          * This method is called when the server disconnect a client.
          * This method remove the client from the list of clients and call the onDisconnectClient method.
-         * @param client
+         * @param sock
          */
-        void onDisconnectClient(const NetClient &client)
+        void onDisconnectClient(const int sock)
         {
             std::unique_lock<std::mutex> lock(_clientsMutex);
-            auto erased = _clients.erase(std::remove(_clients.begin(), _clients.end(), client), _clients.end());
-            if (erased == _clients.end())
-                std::cerr << "Error: Failed to remove client from list" << std::endl;
-            int result = close(client.socket);
+            ClientTable::Cold removed;
+            const int64_t index = _clients.find(sock);
+            const uint32_t interestMask = index == -1 ? 0 : _clients.hot(index).interestMask;
+            if (!_clients.erase(sock, removed)) {
+                NET_LOG_ERROR("Failed to remove client {} from list", sock);
+                return;
+            }
+            _loop.remove(sock);
+            _loop.cancel(removed.keepAliveTimer);
+            _udpBindTokens.erase(removed.udpBindToken);
+            if (removed.session.token != 0)
+                _sessionTokens.erase(removed.session.token);
+            int result = close(sock);
             if (result == -1)
-                std::cerr << "Error: Failed to close socket" << std::endl;
+                NET_LOG_ERROR("Failed to close socket {}", sock);
             lock.unlock();
+            releaseUdpEndpoint(removed.client.udpAddress);
+            if (std::shared_ptr<SessionMailbox> mailbox = findSession(sock)) {
+                _sessions.erase(sock);
+                mailbox->close();
+            }
+            // Never announced, or waiting to be resumed
+            if (removed.session.pending)
+                return;
+            if (removed.session.token != 0) {
+                suspendSession(std::move(removed), interestMask);
+                return;
+            }
             if (_onDisconnectHandler)
-                (*_onDisconnectHandler)(client);
+                (*_onDisconnectHandler)(removed.client);
+        }
+
+        /**
+         * Start or resume the session of a client, from its first packet.
+         * The session may still belong to a connected client, when the old connection
+         * died without the server noticing yet: the new one takes it over and the old one is closed.
+         */
+        void handleSessionRequest(const int sock, std::span<const std::byte> payload) {
+            SessionRequest request;
+            if (!_sessionResume.enabled || payload.size() != sizeof(request))
+                return;
+            memcpy(&request, payload.data(), sizeof(request));
+
+            std::unique_lock<std::mutex> lock(_clientsMutex);
+            int64_t index = _clients.find(sock);
+            if (index == -1 || !_clients.cold(index).session.pending)
+                return;
+            ClientTable::Cold &cold = _clients.cold(index);
+            std::optional<SuspendedSession> previous;
+            std::optional<NetClient> expired;
+            int takenOver = -1;
+
+            if (auto suspended = _suspendedSessions.find(request.token); suspended != _suspendedSessions.end()) {
+                _loop.cancel(suspended->second.expiryTimer);
+                previous = std::move(suspended->second);
+                _suspendedSessions.erase(suspended);
+            } else if (auto live = _sessionTokens.find(request.token); live != _sessionTokens.end()) {
+                const int64_t old = _clients.find(live->second);
+                if (old != -1) {
+                    ClientTable::Cold &oldCold = _clients.cold(old);
+                    previous = SuspendedSession{oldCold.client, _clients.hot(old).interestMask, std::move(oldCold.session)};
+                    // Closed once this dispatch is done, the table must not change under it:
+                    // silently if its session moves here, as a disconnect otherwise
+                    oldCold.session = ClientSession();
+                    takenOver = live->second;
+                    _loop.remove(takenOver);
+                    _loop.cancel(oldCold.keepAliveTimer);
+                }
+                _sessionTokens.erase(live);
+            }
+
+            if (previous && previous->session.replay.canReplayFrom(request.received)) {
+                cold.client.uuid = previous->client.uuid;
+                cold.session = std::move(previous->session);
+                cold.session.pending = false;
+                cold.session.replay.acknowledge(request.received);
+                _clients.hot(index).interestMask = previous->interestMask;
+                _sessionTokens[request.token] = sock;
+                if (takenOver != -1)
+                    _clients.cold(_clients.find(takenOver)).session.pending = true;
+                const SessionGrant grant{request.token, 1};
+                sendPacket(index, SESSION_PACKET_ID, asBytes(grant));
+                // Behind the grant, the packets the client missed, as they were sent
+                cold.session.replay.replayFrom(request.received, [this, &index](std::span<const std::byte> packet) {
+                    queueOutput(index, packet);
+                });
+                const NetClient client = cold.client;
+                lock.unlock();
+                if (takenOver != -1)
+                    _loop.post([this, takenOver] { onDisconnectClient(takenOver); });
+                if (_onResumeHandler)
+                    (*_onResumeHandler)(client, request.received);
+                else if (_onConnectHandler)
+                    (*_onConnectHandler)(client);
+                return;
+            }
+            // The client missed packets no longer kept, the old session ends
+            if (previous && takenOver == -1)
+                expired = std::move(previous->client);
+
+            cold.session = ClientSession();
+            cold.session.token = generateSessionToken();
+            _sessionTokens[cold.session.token] = sock;
+            _clients.hot(index).interestMask = CLIENT_INTEREST_ALL;
+            const SessionGrant grant{cold.session.token, 0};
+            sendPacket(index, SESSION_PACKET_ID, asBytes(grant));
+            const NetClient client = cold.client;
+            lock.unlock();
+            if (takenOver != -1)
+                _loop.post([this, takenOver] { onDisconnectClient(takenOver); });
+            if (expired && _onDisconnectHandler)
+                (*_onDisconnectHandler)(*expired);
+            if (_onConnectHandler)
+                (*_onConnectHandler)(client);
+        }
+
+        void acknowledgeSession(const int sock, std::span<const std::byte> payload) {
+            uint64_t received;
+            if (payload.size() != sizeof(received))
+                return;
+            memcpy(&received, payload.data(), sizeof(received));
+            std::lock_guard<std::mutex> lock(_clientsMutex);
+            const int64_t index = _clients.find(sock);
+            if (index != -1)
+                _clients.cold(index).session.replay.acknowledge(received);
+        }
+
+        /**
+         * Keep the session of a dropped client until it resumes or the grace period ends.
+         */
+        void suspendSession(ClientTable::Cold removed, const uint32_t &interestMask) {
+            SuspendedSession suspended;
+            suspended.client = std::move(removed.client);
+            suspended.interestMask = interestMask;
+            suspended.session = std::move(removed.session);
+            suspended.expiry = EventLoop::Clock::now() + _sessionResume.gracePeriod;
+            adoptSuspendedSession(std::move(suspended));
+        }
+
+        /**
+         * Keep a suspended session until its expiry, the disconnect handler runs then.
+         */
+        void adoptSuspendedSession(SuspendedSession suspended) {
+            const uint64_t token = suspended.session.token;
+            suspended.expiryTimer = _loop.schedule(suspended.expiry, [this, token] {
+                auto it = _suspendedSessions.find(token);
+                if (it == _suspendedSessions.end())
+                    return;
+                const NetClient client = std::move(it->second.client);
+                _suspendedSessions.erase(it);
+                if (_onDisconnectHandler)
+                    (*_onDisconnectHandler)(client);
+            });
+            _suspendedSessions[token] = std::move(suspended);
+        }
+
+        uint64_t generateSessionToken() {
+            uint64_t token = 0;
+            while (token == 0 || _suspendedSessions.contains(token))
+                token = (static_cast<uint64_t>(_sessionTokenSource()) << 32) | _sessionTokenSource();
+            return token;
+        }
+
+        template<typename T>
+        static std::span<const std::byte> asBytes(const T &value) {
+            return {reinterpret_cast<const std::byte *>(&value), sizeof(value)};
         }
 
     // For private variables only
@@ -205,11 +1450,65 @@ class TcpManager {
 
         // Internal state
         bool _started = false;
+        std::promise<void> _ready;
         int _serverSocket = -1;
+        // How long the listener is not watched after accept failed for lack of resources
+        static constexpr std::chrono::milliseconds ACCEPT_RETRY_DELAY{100};
+        // Spare descriptor closed to accept and drop a connection when out of descriptors, only used from the event loop
+        int _reserveFd = -1;
+        bool _droppingConnections = false;
+        EventLoop::TimerId _acceptRetryTimer = TimerWheel::InvalidTimer;
+
+        EventLoop _loop;
+        std::thread _loopThread;
+        ThreadPlacement _placement{"net-tcp"};
+        BusyPollConfig _busyPoll;
+        SocketTelemetryConfig _telemetry;
+        KeepAliveConfig _keepAlive;
+        NumaTopology _topology = NumaTopology::detect();
 
-        std::vector<NetClient> _clients{};
+        // Only the loop thread inserts or erases clients
+        ClientTable _clients{};
+        // Clients read by a session coroutine while it runs, only used from the loop thread
+        std::unordered_map<int, std::weak_ptr<SessionMailbox>> _sessions{};
+        // UDP bind token to client socket, only used from the loop thread
+        std::unordered_map<uint64_t, int> _udpBindTokens{};
+        // Session token to the socket of the connected client holding it, only used from the loop thread
+        std::unordered_map<uint64_t, int> _sessionTokens{};
         std::mutex _clientsMutex;
 
+        SessionResumeConfig _sessionResume;
+        NetMetrics *_metrics = nullptr;
+        TrafficCapture *_capture = nullptr;
+        ClockSyncConfig _clockSync;
+        ServerClock _serverClock;
+        // UDP socket of the UdpManager, only used from the event loop
+        int _clockSocket = -1;
+        // Set by the UdpManager, only used from the event loop
+        std::function<void(const sockaddr_in &)> _onUdpEndpointReleased = nullptr;
+        uint32_t _clockSlice = 0;
+        EventLoop::TimerId _clockTimer = TimerWheel::InvalidTimer;
+        DatagramAggregator _clockPings;
+        // The clients pinged by the current slice, kept between ticks so it does not allocate
+        std::vector<std::pair<sockaddr_in, ClockPing>> _clockTargets;
+        // Sessions of dropped clients by token, only used from the loop thread
+        std::unordered_map<uint64_t, SuspendedSession> _suspendedSessions{};
+        // Tokens are the only proof of identity of a resuming client, they must not be predictable
+        std::random_device _sessionTokenSource;
+
+        // What handOff() took out of the loop, only used from the loop thread
+        struct PendingHandoff {
+            bool active = false;
+            bool includeClients = false;
+            int serverSocket = -1;
+            std::vector<std::pair<ClientTable::Hot, ClientTable::Cold>> clients;
+            std::unordered_map<uint64_t, int> udpBindTokens;
+            std::unordered_map<uint64_t, int> sessionTokens;
+            std::unordered_map<uint64_t, SuspendedSession> suspendedSessions;
+        };
+        PendingHandoff _handoff;
+
+        // Held by start() and stop()
         std::mutex _threadsMutex;
 
         // Event from Game
@@ -218,5 +1517,6 @@ class TcpManager {
         // Event from network
         std::shared_ptr<std::function<void(const NetClient&)>> _onConnectHandler = nullptr;
         std::shared_ptr<std::function<void(const NetClient&)>> _onDisconnectHandler = nullptr;
+        std::shared_ptr<std::function<void(const NetClient&, uint64_t)>> _onResumeHandler = nullptr;
 
 };
@@ -0,0 +1,181 @@
+//
+// Created by Florian Damiot on 19/10/2026.
+//
+
+#pragma once
+
+#include "./PacketBufferPool.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+
+/**
+ * @brief Where a network thread runs.
+ */
+struct ThreadPlacement {
+    // Name shown by ps/top/perf, truncated to 15 characters
+    std::string name;
+    // CPUs the thread is pinned to, empty to let the scheduler choose
+    std::vector<int> cpus{};
+    // NUMA node of the buffers the thread allocates, -1 to use the node of its first CPU
+    int numaNode = -1;
+};
+
+/**
+ * @brief Placement of every thread started by a NewNetworkManager.
+ */
+struct ThreadingConfig {
+    ThreadPlacement tcpLoop{"net-tcp"};
+    ThreadPlacement udpReceive{"net-udp"};
+    // Shared by every executor thread, each gets its index appended to the name
+    ThreadPlacement executor{"net-exec"};
+    ThreadPlacement statsPublisher{"net-stats"};
+};
+
+/**
+ * @brief NUMA nodes of the machine and their CPUs, read from sysfs.
+ * A machine without NUMA information is reported as a single node holding every CPU.
+ */
+class NumaTopology {
+    public:
+        static NumaTopology detect()
+        {
+            NumaTopology topology;
+
+            for (int node = 0;; node++) {
+                std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+                if (!file)
+                    break;
+                std::string list;
+                std::getline(file, list);
+                topology._nodes.push_back(parseCpuList(list));
+            }
+            if (topology._nodes.empty()) {
+                std::vector<int> cpus;
+                for (unsigned int cpu = 0; cpu < std::thread::hardware_concurrency(); cpu++)
+                    cpus.push_back(static_cast<int>(cpu));
+                topology._nodes.push_back(cpus);
+            }
+            return topology;
+        }
+
+        /**
+         * @brief Find the node of a CPU.
+         * @return The node, or -1 if the CPU is unknown.
+         */
+        int nodeOfCpu(const int &cpu) const
+        {
+            for (size_t node = 0; node < _nodes.size(); node++)
+                for (const int &nodeCpu : _nodes[node])
+                    if (nodeCpu == cpu)
+                        return static_cast<int>(node);
+            return -1;
+        }
+
+        const std::vector<int> &cpusOfNode(const int &node) const
+        {
+            return _nodes.at(node);
+        }
+
+        size_t getNodeCount() const
+        {
+            return _nodes.size();
+        }
+
+        std::string describe() const
+        {
+            std::stringstream ss;
+            ss << _nodes.size() << " NUMA node(s)";
+            for (size_t node = 0; node < _nodes.size(); node++)
+                ss << ", node " << node << ": " << _nodes[node].size() << " CPU(s)";
+            return ss.str();
+        }
+
+        /**
+         * @brief Parse a sysfs CPU list such as "0-3,8-11".
+         */
+        static std::vector<int> parseCpuList(const std::string &list)
+        {
+            std::vector<int> cpus;
+            std::stringstream ss(list);
+            std::string range;
+
+            while (std::getline(ss, range, ',')) {
+                if (range.empty())
+                    continue;
+                const size_t dash = range.find('-');
+                const int first = std::stoi(range.substr(0, dash));
+                const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+                for (int cpu = first; cpu <= last; cpu++)
+                    cpus.push_back(cpu);
+            }
+            return cpus;
+        }
+
+    private:
+        std::vector<std::vector<int>> _nodes;
+};
+
+/**
+ * @brief The buffer pool whose memory is bound to a NUMA node, created on first use.
+ */
+inline PacketBufferPool &getNodeBufferPool(const int &node)
+{
+    // Pools are never destroyed, threads may give buffers back until the process exits
+    static std::mutex mutex;
+    static std::map<int, PacketBufferPool *> pools;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    PacketBufferPool *&pool = pools[node];
+    if (pool == nullptr) {
+        PacketBufferPool::Config config;
+        config.numaNode = node;
+        pool = new PacketBufferPool(config);
+    }
+    return *pool;
+}
+
+/**
+ * @brief Apply a placement to the calling thread: name, CPU affinity,
+ * and the node-local buffer pool used by PacketBufferPool::getDefault() on this thread.
+ * @param placement The placement to apply.
+ * @param topology The topology used to find the node of the CPUs.
+ * @return A line describing the placement, for the startup report.
+ */
+inline std::string applyThreadPlacement(const ThreadPlacement &placement, const NumaTopology &topology)
+{
+    std::stringstream report;
+
+    pthread_setname_np(pthread_self(), placement.name.substr(0, 15).c_str());
+    report << placement.name << ":";
+    if (!placement.cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (const int &cpu : placement.cpus)
+            CPU_SET(cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            report << " failed to pin to";
+        else
+            report << " pinned to";
+        for (const int &cpu : placement.cpus)
+            report << " " << cpu;
+    } else {
+        report << " not pinned";
+    }
+    const int node = placement.numaNode != -1 ? placement.numaNode
+                     : placement.cpus.empty() ? -1 : topology.nodeOfCpu(placement.cpus.front());
+    if (node != -1 && topology.getNodeCount() > 1) {
+        PacketBufferPool::setThreadDefault(&getNodeBufferPool(node));
+        report << ", buffers on node " << node;
+    }
+    return report.str();
+}
@@ -0,0 +1,289 @@
+//
+// Created by Florian Damiot on 19/10/2026.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <vector>
+
+/**
+ * @brief Hierarchical timing wheel, for the thousands of per-client timers
+ * (heartbeats, idle timeouts, retransmits) that would be too expensive in a heap.
+ *
+ * Time is cut in ticks of a fixed resolution. Level 0 holds the timers of the current
+ * 256 ticks, one slot per tick, and each higher level holds 256 slots of 256 times the
+ * previous span. When a level wraps, the next slot of the level above is cascaded down.
+ * Scheduling and cancelling are O(1), every timer of a tick expires in one batch.
+ * Timers live in a reused node array, scheduling does not allocate in steady state.
+ * Not thread safe, owned by the event loop.
+ */
+class TimerWheel {
+    public:
+        using Clock = std::chrono::steady_clock;
+        using Task = std::function<void()>;
+        // Generation in the high bits, node index in the low bits, 0 is never a valid timer
+        using TimerId = uint64_t;
+
+        static constexpr TimerId InvalidTimer = 0;
+
+        explicit TimerWheel(const Clock::duration &resolution = std::chrono::milliseconds(1),
+                            const Clock::time_point &origin = Clock::now())
+                            : _resolution(resolution), _origin(origin)
+        {
+            _heads.fill(NoNode);
+            for (auto &level : _occupied)
+                level.fill(0);
+        }
+
+        TimerWheel(const TimerWheel &) = delete;
+        TimerWheel &operator=(const TimerWheel &) = delete;
+
+        /**
+         * @brief Run a task once the deadline is reached, rounded up to the resolution.
+         * A deadline already reached runs once advance() reaches the next tick.
+         * @return The id to cancel the timer.
+         */
+        TimerId schedule(const Clock::time_point &deadline, Task task)
+        {
+            const uint32_t index = allocateNode();
+            Node &node = _nodes[index];
+            node.tick = std::max(tickOf(deadline), _currentTick + 1);
+            node.task = std::move(task);
+            insert(index);
+            _count++;
+            return (static_cast<uint64_t>(node.generation) << 32) | index;
+        }
+
+        /**
+         * @brief Remove a timer that did not run yet.
+         * @return false if the timer already ran, was cancelled, or is unknown.
+         */
+        bool cancel(const TimerId &id)
+        {
+            const auto index = static_cast<uint32_t>(id);
+            if (index >= _nodes.size() || _nodes[index].generation != static_cast<uint32_t>(id >> 32)
+                || _nodes[index].slot == NoSlot)
+                return false;
+            unlink(index);
+            releaseNode(index);
+            _count--;
+            return true;
+        }
+
+        /**
+         * @brief Run every timer whose deadline is reached.
+         * The tasks may schedule or cancel timers, a timer scheduled for a tick already
+         * reached runs on the next call.
+         * @return The number of timers run.
+         */
+        size_t advance(const Clock::time_point &now)
+        {
+            const uint64_t target = tickOf(now);
+            size_t expired = 0;
+
+            while (_currentTick < target) {
+                if (_count == 0) {
+                    _currentTick = target;
+                    break;
+                }
+                // Nothing happens before the next occupied slot or the next cascade, jump there
+                const uint64_t next = nextEventTick();
+                if (next > target) {
+                    _currentTick = target;
+                    break;
+                }
+                _currentTick = next;
+                for (uint32_t level = Levels - 1; level > 0; level--)
+                    if ((next & ((uint64_t(1) << (SlotBits * level)) - 1)) == 0)
+                        cascade(level, slotOf(next, level));
+                expired += expire(slotOf(next, 0));
+            }
+            return expired;
+        }
+
+        /**
+         * @brief When advance() has something to do next, to bound the wait of the loop.
+         * It may be a cascade running no timer, at most every 256 ticks.
+         * @return The time point, or std::nullopt if no timer is scheduled.
+         */
+        std::optional<Clock::time_point> nextDeadline() const
+        {
+            if (_count == 0)
+                return std::nullopt;
+            return _origin + _resolution * static_cast<Clock::rep>(nextEventTick());
+        }
+
+        size_t size() const
+        {
+            return _count;
+        }
+
+        Clock::duration getResolution() const
+        {
+            return _resolution;
+        }
+
+    private:
+        static constexpr uint32_t SlotBits = 8;
+        static constexpr uint32_t Slots = 1 << SlotBits;
+        // 8 levels of 8 bits cover every 64-bit tick, no timer is ever too far
+        static constexpr uint32_t Levels = 8;
+        static constexpr uint32_t NoNode = UINT32_MAX;
+        static constexpr uint32_t NoSlot = UINT32_MAX;
+        // Pseudo slot holding the batch being expired, so its timers can still be cancelled
+        static constexpr uint32_t ExpiringSlot = Levels * Slots;
+
+        struct Node {
+            uint64_t tick = 0;
+            Task task;
+            uint32_t prev = NoNode;
+            uint32_t next = NoNode;
+            uint32_t slot = NoSlot;
+            uint32_t generation = 1;
+        };
+
+        static uint32_t slotOf(const uint64_t &tick, const uint32_t &level)
+        {
+            return static_cast<uint32_t>(tick >> (SlotBits * level)) & (Slots - 1);
+        }
+
+        uint64_t tickOf(const Clock::time_point &time) const
+        {
+            if (time <= _origin)
+                return 0;
+            // Round up so a timer never runs before its deadline
+            const Clock::duration elapsed = time - _origin;
+            return static_cast<uint64_t>(elapsed / _resolution + (elapsed % _resolution != Clock::duration::zero()));
+        }
+
+        /**
+         * The lowest level whose span still contains the tick,
+         * i.e. the tick and the current tick only differ in that level's bits and below.
+         */
+        void insert(const uint32_t &index)
+        {
+            Node &node = _nodes[index];
+            uint32_t level = 0;
+            while (level < Levels - 1 && (node.tick >> (SlotBits * (level + 1))) != (_currentTick >> (SlotBits * (level + 1))))
+                level++;
+            link(index, level * Slots + slotOf(node.tick, level));
+        }
+
+        void link(const uint32_t &index, const uint32_t &slot)
+        {
+            Node &node = _nodes[index];
+            node.slot = slot;
+            node.prev = NoNode;
+            node.next = _heads[slot];
+            if (node.next != NoNode)
+                _nodes[node.next].prev = index;
+            _heads[slot] = index;
+            if (slot != ExpiringSlot)
+                _occupied[slot / Slots][(slot % Slots) / 64] |= uint64_t(1) << (slot % 64);
+        }
+
+        void unlink(const uint32_t &index)
+        {
+            Node &node = _nodes[index];
+            if (node.prev != NoNode)
+                _nodes[node.prev].next = node.next;
+            else
+                _heads[node.slot] = node.next;
+            if (node.next != NoNode)
+                _nodes[node.next].prev = node.prev;
+            if (_heads[node.slot] == NoNode && node.slot != ExpiringSlot)
+                _occupied[node.slot / Slots][(node.slot % Slots) / 64] &= ~(uint64_t(1) << (node.slot % 64));
+            node.slot = NoSlot;
+        }
+
+        /**
+         * The next tick with level 0 timers in the current rotation, or the start of the next rotation.
+         */
+        uint64_t nextEventTick() const
+        {
+            const uint32_t current = slotOf(_currentTick, 0);
+            for (uint32_t word = (current + 1) / 64; word < Slots / 64; word++) {
+                uint64_t bits = _occupied[0][word];
+                if (word == (current + 1) / 64)
+                    bits &= ~uint64_t(0) << ((current + 1) % 64);
+                if (bits != 0)
+                    return (_currentTick & ~uint64_t(Slots - 1)) | (word * 64 + std::countr_zero(bits));
+            }
+            return (_currentTick | (Slots - 1)) + 1;
+        }
+
+        void cascade(const uint32_t &level, const uint32_t &slot)
+        {
+            uint32_t index = _heads[level * Slots + slot];
+            while (index != NoNode) {
+                const uint32_t next = _nodes[index].next;
+                unlink(index);
+                insert(index);
+                index = next;
+            }
+        }
+
+        size_t expire(const uint32_t &slot)
+        {
+            size_t expired = 0;
+
+            // Move the batch aside, the tasks may schedule into the slot being expired
+            uint32_t index = _heads[slot];
+            while (index != NoNode) {
+                const uint32_t next = _nodes[index].next;
+                unlink(index);
+                link(index, ExpiringSlot);
+                index = next;
+            }
+            while (_heads[ExpiringSlot] != NoNode) {
+                index = _heads[ExpiringSlot];
+                unlink(index);
+                Task task = std::move(_nodes[index].task);
+                releaseNode(index);
+                _count--;
+                task();
+                expired++;
+            }
+            return expired;
+        }
+
+        uint32_t allocateNode()
+        {
+            if (_freeNodes.empty()) {
+                _nodes.emplace_back();
+                return static_cast<uint32_t>(_nodes.size() - 1);
+            }
+            const uint32_t index = _freeNodes.back();
+            _freeNodes.pop_back();
+            return index;
+        }
+
+        void releaseNode(const uint32_t &index)
+        {
+            Node &node = _nodes[index];
+            node.task = nullptr;
+            // A stale id no longer matches, and 0 is skipped so no id is ever InvalidTimer
+            if (++node.generation == 0)
+                node.generation = 1;
+            _freeNodes.push_back(index);
+        }
+
+    private:
+        Clock::duration _resolution;
+        Clock::time_point _origin;
+        uint64_t _currentTick = 0;
+        size_t _count = 0;
+
+        std::vector<Node> _nodes;
+        std::vector<uint32_t> _freeNodes;
+        std::array<uint32_t, Levels * Slots + 1> _heads{};
+        // One bit per slot with timers, to find the next one without walking the slots
+        std::array<std::array<uint64_t, Slots / 64>, Levels> _occupied{};
+};
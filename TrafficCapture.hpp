@@ -0,0 +1,214 @@
+//
+// Created by Florian Damiot on 19/10/2026.
+//
+
+#pragma once
+
+#include "./NetMetrics.hpp"
+#include "./NetLog.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * @brief Layout of a capture file: a CaptureFileHeader, then one CaptureRecord per packet,
+ * each followed by its payload and padded to 8 bytes.
+ */
+struct CaptureFileHeader {
+    // "NCAP"
+    static constexpr uint32_t Magic = 0x5041434E;
+    static constexpr uint32_t CurrentVersion = 1;
+
+    uint32_t magic = Magic;
+    uint32_t version = CurrentVersion;
+    // Wall clock time of the start of the capture, the records are relative to it
+    uint64_t startTimeNs = 0;
+};
+
+struct CaptureRecord {
+    // "PKT!", written last: a record without it was not complete when the capture stopped
+    static constexpr uint32_t Marker = 0x21544B50;
+
+    uint32_t marker;
+    uint8_t transport;
+    uint8_t unused[3];
+    uint32_t packetId;
+    uint32_t size;
+    // Nanoseconds since the start of the capture
+    uint64_t time;
+    // The strand of the packet: the socket of a TCP client, the endpoint key of a UDP one
+    uint64_t client;
+};
+
+/**
+ * @brief A packet read back from a capture file.
+ */
+struct CapturedPacket {
+    uint64_t time = 0;
+    uint64_t client = 0;
+    NetTransport transport = NetTransport::Tcp;
+    uint32_t packetId = 0;
+    std::span<const std::byte> payload;
+};
+
+/**
+ * @brief Records the packets received, as the registries dispatch them, into a memory-mapped file.
+ *
+ * The file is created at its maximum size as a sparse file and mapped once, so recording a packet
+ * is an atomic add to reserve its room and a copy, without lock or system call, from any thread.
+ * Packets arriving once the file is full are counted as dropped. stop() cuts the file to what was written.
+ */
+class TrafficCapture {
+    public:
+        TrafficCapture() = default;
+        TrafficCapture(const TrafficCapture &) = delete;
+        TrafficCapture &operator=(const TrafficCapture &) = delete;
+
+        ~TrafficCapture()
+        {
+            stop();
+        }
+
+        /**
+         * @brief Start recording into a new file, replacing an existing one.
+         * @param maxBytes Size of the file at most, it only takes the disk space actually written.
+         */
+        void start(const std::string &path, const size_t &maxBytes = size_t(1) << 30)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_recording.load())
+                throw std::runtime_error("Traffic capture already started");
+            if (maxBytes < sizeof(CaptureFileHeader))
+                throw std::runtime_error("Traffic capture size too small");
+
+            const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd == -1)
+                throw std::runtime_error("Failed to create capture file " + path);
+            if (ftruncate(fd, static_cast<off_t>(maxBytes)) == -1) {
+                close(fd);
+                throw std::runtime_error("Failed to size capture file " + path);
+            }
+            void *data = mmap(nullptr, maxBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("Failed to map capture file " + path);
+            }
+
+            _fd = fd;
+            _data = static_cast<std::byte *>(data);
+            _capacity = maxBytes;
+            CaptureFileHeader header;
+            header.startTimeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            memcpy(_data, &header, sizeof(header));
+            _offset.store(sizeof(header));
+            _packets.store(0);
+            _dropped.store(0);
+            _start = std::chrono::steady_clock::now();
+            _recording.store(true);
+        }
+
+        /**
+         * @brief Stop recording and close the file, waits for the packets being recorded.
+         */
+        void stop()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_recording.load())
+                return;
+            _recording.store(false);
+            while (_writers.load() != 0)
+                std::this_thread::yield();
+
+            const size_t used = std::min(_offset.load(), _capacity);
+            msync(_data, used, MS_SYNC);
+            munmap(_data, _capacity);
+            if (ftruncate(_fd, static_cast<off_t>(used)) == -1)
+                NET_LOG_WARN("Failed to cut the capture file to {} bytes", used);
+            close(_fd);
+            _data = nullptr;
+            _fd = -1;
+        }
+
+        /**
+         * @brief Record a received packet, does nothing unless started.
+         */
+        void record(const NetTransport &transport, const uint32_t &packetId,
+                    std::span<const std::byte> payload, const uint64_t &client)
+        {
+            if (!_recording.load(std::memory_order_relaxed))
+                return;
+            // Announced before checking again, so stop() waits for this packet or it is not written
+            _writers.fetch_add(1);
+            if (_recording.load()) {
+                const size_t size = (sizeof(CaptureRecord) + payload.size() + 7) & ~size_t(7);
+                const size_t offset = _offset.fetch_add(size, std::memory_order_relaxed);
+                if (offset + size <= _capacity) {
+                    writeRecord(_data + offset, transport, packetId, payload, client);
+                    _packets.fetch_add(1, std::memory_order_relaxed);
+                } else {
+                    _dropped.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            _writers.fetch_sub(1, std::memory_order_release);
+        }
+
+        bool isRecording() const
+        {
+            return _recording.load(std::memory_order_relaxed);
+        }
+
+        uint64_t getPackets() const
+        {
+            return _packets.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Packets not recorded because the file was full.
+         */
+        uint64_t getDropped() const
+        {
+            return _dropped.load(std::memory_order_relaxed);
+        }
+
+    private:
+        void writeRecord(std::byte *destination, const NetTransport &transport, const uint32_t &packetId,
+                         std::span<const std::byte> payload, const uint64_t &client) const
+        {
+            CaptureRecord record{};
+            record.transport = static_cast<uint8_t>(transport);
+            record.packetId = packetId;
+            record.size = static_cast<uint32_t>(payload.size());
+            record.time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - _start).count();
+            record.client = client;
+            memcpy(destination, &record, sizeof(record));
+            if (!payload.empty())
+                memcpy(destination + sizeof(record), payload.data(), payload.size());
+            std::atomic_ref<uint32_t>(reinterpret_cast<CaptureRecord *>(destination)->marker)
+                .store(CaptureRecord::Marker, std::memory_order_release);
+        }
+
+    private:
+        std::mutex _mutex;
+        std::atomic<bool> _recording = false;
+        std::atomic<uint32_t> _writers = 0;
+        std::atomic<size_t> _offset = 0;
+        std::atomic<uint64_t> _packets = 0;
+        std::atomic<uint64_t> _dropped = 0;
+        std::byte *_data = nullptr;
+        size_t _capacity = 0;
+        int _fd = -1;
+        std::chrono::steady_clock::time_point _start;
+};
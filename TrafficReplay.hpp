@@ -0,0 +1,135 @@
+//
+// Created by Florian Damiot on 19/10/2026.
+//
+
+#pragma once
+
+#include "./EventRegistry.hpp"
+#include "./TrafficCapture.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Read-only view of a capture file written by TrafficCapture.
+ */
+class CaptureReader {
+    public:
+        explicit CaptureReader(const std::string &path)
+        {
+            _fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (_fd == -1)
+                throw std::runtime_error("Failed to open capture file " + path);
+            struct stat info{};
+            if (fstat(_fd, &info) == -1 || static_cast<size_t>(info.st_size) < sizeof(CaptureFileHeader)) {
+                close(_fd);
+                throw std::runtime_error("Invalid capture file " + path);
+            }
+            _size = info.st_size;
+            void *data = mmap(nullptr, _size, PROT_READ, MAP_SHARED, _fd, 0);
+            if (data == MAP_FAILED) {
+                close(_fd);
+                throw std::runtime_error("Failed to map capture file " + path);
+            }
+            _data = static_cast<const std::byte *>(data);
+            memcpy(&_header, _data, sizeof(_header));
+            if (_header.magic != CaptureFileHeader::Magic || _header.version != CaptureFileHeader::CurrentVersion) {
+                munmap(const_cast<std::byte *>(_data), _size);
+                close(_fd);
+                throw std::runtime_error("Unsupported capture file " + path);
+            }
+        }
+
+        CaptureReader(const CaptureReader &) = delete;
+        CaptureReader &operator=(const CaptureReader &) = delete;
+
+        ~CaptureReader()
+        {
+            munmap(const_cast<std::byte *>(_data), _size);
+            close(_fd);
+        }
+
+        /**
+         * @brief Call a function with each packet in the order they were recorded.
+         * Stops at the first incomplete record, e.g. when the server crashed while capturing.
+         * @return The number of packets read.
+         */
+        template<typename PacketFunction>
+        size_t forEach(const PacketFunction &onPacket) const
+        {
+            size_t offset = sizeof(CaptureFileHeader);
+            size_t count = 0;
+
+            while (_size - offset >= sizeof(CaptureRecord)) {
+                CaptureRecord record{};
+                memcpy(&record, _data + offset, sizeof(record));
+                if (record.marker != CaptureRecord::Marker || _size - offset - sizeof(record) < record.size)
+                    break;
+                CapturedPacket packet;
+                packet.time = record.time;
+                packet.client = record.client;
+                packet.transport = static_cast<NetTransport>(record.transport);
+                packet.packetId = record.packetId;
+                packet.payload = std::span<const std::byte>(_data + offset + sizeof(record), record.size);
+                onPacket(packet);
+                count++;
+                offset += (sizeof(record) + record.size + 7) & ~size_t(7);
+            }
+            return count;
+        }
+
+        const CaptureFileHeader &getHeader() const
+        {
+            return _header;
+        }
+
+    private:
+        int _fd = -1;
+        const std::byte *_data = nullptr;
+        size_t _size = 0;
+        CaptureFileHeader _header;
+};
+
+enum class ReplaySpeed {
+    Recorded, // Wait between packets as long as they were apart when captured
+    Fast      // Dispatch every packet as soon as the previous one is handled
+};
+
+struct ReplayStats {
+    uint64_t packets = 0;
+    // Packets with a handler type registered for their id
+    uint64_t dispatched = 0;
+    std::chrono::nanoseconds elapsed{0};
+};
+
+/**
+ * @brief Feed a capture to the handlers registered in the registries, on the calling thread and without network,
+ * e.g. to compare the cost of handler or decode changes on real traffic.
+ * Register the handlers exactly as the server does, the packets keep their recorded client as strand.
+ */
+inline ReplayStats replayCapture(const CaptureReader &reader, EventRegistry &tcpRegistry, EventRegistry &udpRegistry,
+                                 const ReplaySpeed &speed = ReplaySpeed::Fast)
+{
+    ReplayStats stats;
+    const auto start = std::chrono::steady_clock::now();
+
+    reader.forEach([&](const CapturedPacket &packet) {
+        if (speed == ReplaySpeed::Recorded)
+            std::this_thread::sleep_until(start + std::chrono::nanoseconds(packet.time));
+        EventRegistry &registry = packet.transport == NetTransport::Udp ? udpRegistry : tcpRegistry;
+        if (registry.dispatchNow(packet.packetId, packet.payload, packet.client))
+            stats.dispatched++;
+        stats.packets++;
+    });
+    stats.elapsed = std::chrono::steady_clock::now() - start;
+    return stats;
+}
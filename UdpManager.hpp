@@ -5,6 +5,11 @@
 #pragma once
 
 #include "./TcpManager.hpp"
+#include "./DatagramAggregator.hpp"
+#include "./LatestValueChannel.hpp"
+#include "./BusyPoll.hpp"
+#include "./SocketTelemetry.hpp"
+#include "./NetLog.hpp"
 #include <iostream>
 #include <utility>
 #include <vector>
@@ -13,8 +18,12 @@
 #include <unordered_map>
 #include <chrono>
 #include <ctime>
+#include <cerrno>
+#include <cstring>
 #include <algorithm>
 #include <functional>
+#include <future>
+#include <atomic>
 #include <sys/socket.h>
 
 class UdpManager {
@@ -25,21 +34,29 @@ class UdpManager {
                   : _host(std::move(host)), _port(port), _tcpManager(tcpManager) {
 
         }
-        ~UdpManager() = default;
+        ~UdpManager() {
+            if (_running)
+                stop();
+        }
 
-        void start() {
+        /**
+         * @brief Bind the socket and start the receive thread.
+         * @return Ready once the receive thread runs.
+         * @throw std::runtime_error if the socket cannot be created or bound.
+         */
+        std::future<void> start() {
+            if (_running)
+                throw std::runtime_error("UdpManager already started");
 
-            int sockfd;
-            struct sockaddr_in servaddr, cliaddr;
+            struct sockaddr_in servaddr;
 
             // Creating socket file descriptor
-            if ( (sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ) {
-                perror("socket creation failed");
-                exit(EXIT_FAILURE);
+            if ( (_socket = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ) {
+                _socket = -1;
+                throw std::runtime_error("Failed to create socket for UDP server");
             }
 
             memset(&servaddr, 0, sizeof(servaddr));
-            memset(&cliaddr, 0, sizeof(cliaddr));
 
             // Filling server information
             servaddr.sin_family    = AF_INET; // IPv4
@@ -47,45 +64,415 @@ class UdpManager {
             servaddr.sin_port = htons(_port);
 
             // Bind the socket with the server address
-            if ( bind(sockfd, (const struct sockaddr *)&servaddr,
+            if ( bind(_socket, (const struct sockaddr *)&servaddr,
                       sizeof(servaddr)) < 0 )
             {
-                perror("bind failed");
-                exit(EXIT_FAILURE);
+                close(_socket);
+                _socket = -1;
+                throw std::runtime_error("Failed to bind socket for UDP server, port already in use");
             }
+            if (!applyBusyPollOptions(_socket, _busyPoll))
+                NET_LOG_WARN("Failed to set busy poll options on UDP socket");
+            _socketDrops = 0;
+            return startReceiveThread();
+        }
 
-            std::thread t([this, &cliaddr, &sockfd] { startReceive(cliaddr, sockfd); });
-            t.detach();
+        /**
+         * @brief Start from the socket bound by a previous process, see HandoffState.
+         * @param socket The bound socket, owned by the manager from now on.
+         * @return Ready once the receive thread runs.
+         */
+        std::future<void> start(const int &socket) {
+            if (_running)
+                throw std::runtime_error("UdpManager already started");
+            _socket = socket;
+            _socketDrops = 0;
+            return startReceiveThread();
         }
 
-    private:
-        void startReceive(sockaddr_in cliaddr, const int &sockfd) {
-            std::cout << "Start receiving UDP packets" << std::endl;
-            while (true) {
-                socklen_t len;
-                int n;
-
-                len = sizeof(cliaddr);  //len is value/result
-
-                const char *hello = "Hello from server";
-                char buffer[BUFFER_SIZE];
-                n = recvfrom(sockfd, (char *)buffer, BUFFER_SIZE, MSG_WAITALL, ( struct sockaddr *) &cliaddr, &len);
-                buffer[n] = '\0';
-                printf("Client : %s\n", buffer);
-                sendto(sockfd, (const char *)hello, strlen(hello), MSG_CONFIRM, (const struct sockaddr *) &cliaddr,
-                       len);
-                std::cout<<"Hello message sent."<<std::endl;
+        /**
+         * @brief Receive again on the socket given by handOff(), after the transfer to the other process failed.
+         * @return Ready once the receive thread runs.
+         */
+        std::future<void> cancelHandOff(const int &socket) {
+            if (_running)
+                throw std::runtime_error("UdpManager already started");
+            // Same socket, the kernel keeps counting its drops from where we left
+            _socket = socket;
+            return startReceiveThread();
+        }
+
+        /**
+         * @brief Send what is still queued, stop receiving and give the bound socket to the caller,
+         * to send to the process taking over. The datagrams not read yet stay in the socket for it.
+         * @return The socket, owned by the caller.
+         */
+        int handOff() {
+            if (!_running)
+                throw std::runtime_error("UdpManager is not started");
+            if (_tcpManager != nullptr) {
+                _tcpManager->setClockSocket(-1);
+                _tcpManager->setOnUdpEndpointReleased(nullptr);
+            }
+            flush();
+            _running = false;
+            // shutdown() would also stop the other process, wake recvfrom with an empty datagram instead
+            sockaddr_in self{};
+            socklen_t size = sizeof(self);
+            getsockname(_socket, (struct sockaddr *) &self, &size);
+            if (self.sin_addr.s_addr == INADDR_ANY)
+                self.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            const int waker = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+            sendto(waker, nullptr, 0, 0, (const struct sockaddr *) &self, sizeof(self));
+            close(waker);
+            _receiveThread.join();
+            const int socket = _socket;
+            _socket = -1;
+            return socket;
+        }
+
+        bool isRunning() const {
+            return _running;
+        }
+
+        /**
+         * @brief Send what is still queued, then close the socket and join the receive thread.
+         */
+        void stop() {
+            if (!_running)
+                throw std::runtime_error("UdpManager is not started");
+            if (_tcpManager != nullptr) {
+                _tcpManager->setClockSocket(-1);
+                _tcpManager->setOnUdpEndpointReleased(nullptr);
+            }
+            flush();
+            _running = false;
+            // Wakes up a blocking recvfrom, which then returns 0
+            shutdown(_socket, SHUT_RD);
+            _receiveThread.join();
+            close(_socket);
+            _socket = -1;
+            NET_LOG_INFO("UDP server stopped");
+        }
+
+        /**
+         * @brief Queue an event for a client, it is sent on the next flush()
+         * together with every other event queued for this client.
+         * @param to The UDP address of the client.
+         * @param eventId The id of the packet.
+         * @param event The event to send.
+         */
+        template<typename EventType>
+        void send(const sockaddr_in &to, unsigned int eventId, const EventType &event) {
+            PacketBuffer dataBytes = _eventRegistry.serializeData(event);
+            countSent(eventId, dataBytes.size());
+            std::lock_guard<std::mutex> lock(_aggregatorMutex);
+            _aggregator.enqueue(to, eventId, dataBytes);
+        }
+
+        /**
+         * @brief Set the latest state of an entity field for a client.
+         * Only the newest value set before the next flush() is sent,
+         * and the client drops any state older than the one it already applied.
+         * @param to The UDP address of the client.
+         * @param eventId The id of the packet.
+         * @param entityId The entity the state belongs to.
+         * @param field The field of the entity, e.g. position or animation.
+         * @param event The state to send.
+         */
+        template<typename EventType>
+        void sendState(const sockaddr_in &to, unsigned int eventId,
+                       const uint32_t &entityId, const uint16_t &field, const EventType &event) {
+            PacketBuffer dataBytes = _eventRegistry.serializeData(event);
+            countSent(eventId, dataBytes.size());
+            std::lock_guard<std::mutex> lock(_aggregatorMutex);
+            _stateSender.set(to, eventId, entityId, field, dataBytes);
+        }
+
+        /**
+         * @brief Forget the state of an entity for a client, once it left its view:
+         * nothing is kept for it until the next sendState(). The client forgets it too, see
+         * NetworkManagerClient::forgetState(), on the reliable despawn it receives.
+         */
+        void forgetState(const sockaddr_in &to, const uint32_t &entityId) {
+            std::lock_guard<std::mutex> lock(_aggregatorMutex);
+            _stateSender.forget(to, entityId);
+        }
+
+        /**
+         * @brief Forget the state of an entity for every client, once it despawned.
+         */
+        void forgetState(const uint32_t &entityId) {
+            std::lock_guard<std::mutex> lock(_aggregatorMutex);
+            _stateSender.forget(entityId);
+        }
+
+        /**
+         * @brief Queue an event for the clients of the grid within a radius of a position, see InterestGrid.
+         * @param grid The positions of the clients, identified by their TCP socket.
+         */
+        template<typename EventType>
+        void sendNear(const InterestGrid &grid, const WorldPosition &position, const float &radius,
+                      unsigned int eventId, const EventType &event) {
+            PacketBuffer dataBytes = _eventRegistry.serializeData(event);
+            std::lock_guard<std::mutex> lock(_aggregatorMutex);
+            _interestSockets.clear();
+            grid.forEachClientNear(position, radius, [this](const int &socket) { _interestSockets.push_back(socket); });
+            for (const sockaddr_in &to : resolveInterestSockets()) {
+                countSent(eventId, dataBytes.size());
+                _aggregator.enqueue(to, eventId, dataBytes);
             }
         }
 
+        /**
+         * @brief Set the latest state of an entity field for the clients of the grid seeing the entity, see sendState().
+         */
         template<typename EventType>
-        void send(unsigned int eventId, const EventType &event) {
-            std::vector<std::byte> dataBytes = _eventRegistry.serializeData(event);
+        void sendStateToWatchers(const InterestGrid &grid, unsigned int eventId,
+                                 const uint32_t &entityId, const uint16_t &field, const EventType &event) {
+            PacketBuffer dataBytes = _eventRegistry.serializeData(event);
+            std::lock_guard<std::mutex> lock(_aggregatorMutex);
+            _interestSockets.clear();
+            grid.forEachWatcher(entityId, [this](const int &socket) { _interestSockets.push_back(socket); });
+            for (const sockaddr_in &to : resolveInterestSockets()) {
+                countSent(eventId, dataBytes.size());
+                _stateSender.set(to, eventId, entityId, field, dataBytes);
+            }
+        }
+
+        /**
+         * @brief Send every event queued since the last flush, should be called once at the end of each tick.
+         * @return The number of datagrams sent.
+         */
+        size_t flush() {
+            std::lock_guard<std::mutex> lock(_aggregatorMutex);
+            _stateSender.drainInto(_aggregator);
+            return _aggregator.flush([this](const sockaddr_in &to, std::span<const std::byte> datagram) {
+                if (sendto(_socket, datagram.data(), datagram.size(), 0, (const struct sockaddr *) &to, sizeof(to)) < 0)
+                    NET_LOG_ERROR("Failed to send datagram: {}", strerror(errno));
+            });
+        }
+
+        /**
+         * @brief Count the events sent and received per packet id, and time their handlers,
+         * must be called before start().
+         * @param metrics The metrics, it must outlive the manager, or nullptr to stop measuring.
+         */
+        void setMetrics(NetMetrics *metrics) {
+            _metrics = metrics;
+            _eventRegistry.setMetrics(metrics, NetTransport::Udp);
+        }
+
+        /**
+         * @brief Timestamp the datagrams in the kernel and count those it dropped,
+         * see SocketTelemetryConfig. Must be called before start().
+         */
+        void setSocketTelemetry(const SocketTelemetryConfig &config) {
+            _telemetry = config;
+        }
+
+        /**
+         * @brief Record the events received into the capture while it is started, must be called before start().
+         * @param capture The capture, it must outlive the manager, or nullptr.
+         */
+        void setCapture(TrafficCapture *capture) {
+            _eventRegistry.setCapture(capture, NetTransport::Udp);
+        }
+
+        /**
+         * @brief Spin on non-blocking reads instead of blocking in recvfrom, must be called before start().
+         */
+        void setBusyPoll(const BusyPollConfig &config) {
+            _busyPoll = config;
+        }
+
+        /**
+         * @brief Name and pin the receive thread, must be called before start().
+         */
+        void setThreadPlacement(const ThreadPlacement &placement, const NumaTopology &topology) {
+            _placement = placement;
+            _topology = topology;
+        }
+
+        // Getters
+
+        EventRegistry &getEventRegistry() {
+            return _eventRegistry;
+        }
+
+    private:
+        // The UDP endpoints of _interestSockets, must be called with _aggregatorMutex locked
+        const std::vector<sockaddr_in> &resolveInterestSockets() {
+            _interestAddresses.clear();
+            if (_tcpManager != nullptr)
+                _tcpManager->getUdpAddresses(_interestSockets, _interestAddresses);
+            return _interestAddresses;
+        }
+
+        // Counted when queued, a state overwritten before the flush is counted anyway
+        void countSent(const uint32_t &eventId, const size_t &bytes) {
+            if (_metrics != nullptr)
+                if (PacketMetrics *metrics = _metrics->local(NetTransport::Udp, eventId))
+                    metrics->addSent(bytes);
+        }
+
+        /**
+         * Forget what is kept for an endpoint no client uses anymore, called from the TCP event loop.
+         * The receive thread forgets its sequences before reading the next datagram.
+         */
+        void releaseEndpoint(const sockaddr_in &endpoint) {
+            {
+                std::lock_guard<std::mutex> lock(_aggregatorMutex);
+                _stateSender.erase(endpoint);
+                _aggregator.erase(endpoint);
+            }
+            std::lock_guard<std::mutex> lock(_releasedMutex);
+            _releasedEndpoints.push_back(endpoint);
+            _hasReleasedEndpoints.store(true, std::memory_order_release);
+        }
+
+        void forgetReleasedEndpoints() {
+            std::lock_guard<std::mutex> lock(_releasedMutex);
+            for (const sockaddr_in &endpoint : _releasedEndpoints)
+                _stateReceiver.erase(endpoint);
+            _releasedEndpoints.clear();
+            _hasReleasedEndpoints.store(false, std::memory_order_relaxed);
+        }
+
+        // The kernel reports the drops of the socket since its creation, only the new ones are counted.
+        // The counter wraps around, the difference stays right modulo 2^32.
+        void countDrops(const uint32_t &socketDrops) {
+            const auto dropped = static_cast<uint32_t>(socketDrops - _socketDrops);
+            if (dropped == 0)
+                return;
+            if (_metrics != nullptr)
+                _metrics->addKernelDrops(NetTransport::Udp, dropped);
+            NET_LOG_DEBUG("Kernel dropped {} datagrams on the UDP socket", dropped);
+            _socketDrops = socketDrops;
+        }
+
+        std::future<void> startReceiveThread() {
+            if (!applySocketTelemetry(_socket, _telemetry, true))
+                NET_LOG_WARN("Failed to enable kernel timestamps or drop counts on UDP socket");
+            if (_tcpManager != nullptr) {
+                _tcpManager->setClockSocket(_socket);
+                _tcpManager->setOnUdpEndpointReleased([this](const sockaddr_in &endpoint) { releaseEndpoint(endpoint); });
+            }
+            _ready = std::promise<void>();
+            std::future<void> ready = _ready.get_future();
+            _running = true;
+            _receiveThread = std::thread([this] {
+                const std::string applied = applyThreadPlacement(_placement, _topology);
+                NET_LOG_INFO("Starting UDP receive thread {}", applied);
+                _ready.set_value();
+                startReceive();
+            });
+            return ready;
+        }
+
+        void startReceive() {
+            NET_LOG_DEBUG("Start receiving UDP packets");
+            PacketBuffer buffer = PacketBufferPool::getDefault().acquire(BUFFER_SIZE);
+            BusyPollBackoff backoff(_busyPoll);
+            while (_running) {
+                sockaddr_in cliaddr{};
+                iovec iov{buffer.data(), buffer.size()};
+                alignas(cmsghdr) std::byte control[ReceiveTelemetry::ControlSize];
+                msghdr message{};
+                message.msg_name = &cliaddr;
+                message.msg_namelen = sizeof(cliaddr);
+                message.msg_iov = &iov;
+                message.msg_iovlen = 1;
+                if (_telemetry.timestamps || _telemetry.dropCounts) {
+                    message.msg_control = control;
+                    message.msg_controllen = sizeof(control);
+                }
+
+                const int flags = backoff.spinning() ? MSG_DONTWAIT : 0;
+                const ssize_t n = recvmsg(_socket, &message, flags);
+                // Stopping: still handle a datagram that arrived before the wakeup, it is out of the socket now
+                if (!_running && n <= 0)
+                    break;
+                if (n < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        backoff.idle();
+                        continue;
+                    }
+                    // Any other error comes back on every call, retrying would only spin
+                    NET_LOG_ERROR("Failed to receive on UDP socket, receive thread stops: {}", strerror(errno));
+                    break;
+                }
+                backoff.activity();
+                if (_hasReleasedEndpoints.load(std::memory_order_acquire))
+                    forgetReleasedEndpoints();
+                uint64_t arrivalNs = 0;
+                if (message.msg_controllen != 0) {
+                    const ReceiveTelemetry telemetry = ReceiveTelemetry::parse(message);
+                    arrivalNs = telemetry.kernelNs;
+                    if (telemetry.hasDrops)
+                        countDrops(telemetry.drops);
+                }
+                const size_t count = DatagramAggregator::split(std::span<const std::byte>(buffer.data(), n),
+                    [this, &cliaddr, &arrivalNs](uint32_t packetId, DatagramMessageKind kind, std::span<const std::byte> data) {
+                        if (packetId == UDP_BIND_PACKET_ID) {
+                            uint64_t token;
+                            if (_tcpManager != nullptr && data.size() == sizeof(token)) {
+                                memcpy(&token, data.data(), sizeof(token));
+                                _tcpManager->bindUdpEndpoint(token, cliaddr);
+                            }
+                            return;
+                        }
+                        if (packetId == CLOCK_SYNC_PACKET_ID) {
+                            ClockPong pong;
+                            if (_tcpManager != nullptr && data.size() == sizeof(pong)) {
+                                memcpy(&pong, data.data(), sizeof(pong));
+                                _tcpManager->handleClockPong(pong, cliaddr, steadyNowNs());
+                            }
+                            return;
+                        }
+                        if (kind == DatagramMessageKind::State) {
+                            StateHeader header{};
+                            size_t headerSize;
+                            if (!header.read(data, headerSize) || !_stateReceiver.accept(cliaddr, header))
+                                return;
+                            data = data.subspan(headerSize);
+                        }
+                        _eventRegistry.dispatch(packetId, data, DatagramAggregator::endpointKey(cliaddr), arrivalNs);
+                    });
+                NET_LOG_TRACE("Received {} events in {} bytes", count, n);
+            }
         }
 
     private:
         std::shared_ptr<TcpManager> _tcpManager;
         std::string _host;
         unsigned int _port;
+        int _socket = -1;
+        std::atomic<bool> _running = false;
+        std::promise<void> _ready;
+        std::thread _receiveThread;
         EventRegistry _eventRegistry;
+        ThreadPlacement _placement{"net-udp"};
+        BusyPollConfig _busyPoll;
+        SocketTelemetryConfig _telemetry;
+        NetMetrics *_metrics = nullptr;
+        NumaTopology _topology = NumaTopology::detect();
+
+        DatagramAggregator _aggregator;
+        LatestValueSender _stateSender;
+        std::mutex _aggregatorMutex;
+        // Kept between calls so sending near a position does not allocate
+        std::vector<int> _interestSockets;
+        std::vector<sockaddr_in> _interestAddresses;
+
+        // Endpoints released by the TCP manager, for the receive thread to forget
+        std::mutex _releasedMutex;
+        std::vector<sockaddr_in> _releasedEndpoints;
+        std::atomic<bool> _hasReleasedEndpoints = false;
+
+        // Only used by the receive thread
+        LatestValueReceiver _stateReceiver;
+        uint32_t _socketDrops = 0;
 };
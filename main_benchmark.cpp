@@ -0,0 +1,554 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include "./NewNetworkManager.hpp"
+
+// Benchmarks of the network paths, then micro benchmarks of the registry, serialization and uuids.
+//
+//     benchmark                  everything, as text
+//     benchmark --micro          only the micro benchmarks
+//     benchmark --json out.json  also write the micro benchmark results as JSON, "-" for stdout
+//
+// Build with -DCMAKE_BUILD_TYPE=Release for meaningful numbers. Instructions/op needs perf events,
+// it is null when the kernel or the container does not allow them.
+
+// Keep the optimizer from removing the measured loops
+static volatile uint64_t benchmarkSink = 0;
+
+// Allocations of the current thread, counted by the replaced operator new below
+static thread_local uint64_t benchmarkAllocations = 0;
+
+void *operator new(std::size_t size)
+{
+    benchmarkAllocations++;
+    if (void *pointer = std::malloc(size == 0 ? 1 : size))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+
+template<typename Function>
+static double measureNsPerOp(const size_t &operations, const Function &function)
+{
+    const auto start = std::chrono::steady_clock::now();
+    function();
+    const auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / static_cast<double>(operations);
+}
+
+static uint64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t percentile(std::vector<uint64_t> &values, const double &ratio)
+{
+    if (values.empty())
+        return 0;
+    const auto rank = static_cast<size_t>(ratio * static_cast<double>(values.size() - 1));
+    std::nth_element(values.begin(), values.begin() + rank, values.end());
+    return values[rank];
+}
+
+static NetClient makeBenchmarkClient(const int &socket)
+{
+    NetClient client;
+    client.uuid = generateRandomUuid();
+    client.socket = socket;
+    client.ip = "127.0.0.1";
+    client.port = 40000 + socket % 20000;
+    client.address = {};
+    return client;
+}
+
+/**
+ * Walk every client the way broadcast() does (interest mask, then output state),
+ * over the same flat table stored as one array of whole clients (AoS),
+ * and over the ClientTable hot array, so only the hot/cold split differs.
+ */
+static void benchmarkBroadcastIteration(const size_t &clientCount)
+{
+    // Without the split: the hot fields sit next to the cold ones of the same client
+    struct Client {
+        int socket = -1;
+        uint32_t outputOffset = 0;
+        uint32_t flags = 0;
+        uint32_t interestMask = CLIENT_INTEREST_ALL;
+        ClientTable::Cold cold;
+    };
+    std::vector<Client> clients;
+    ClientTable table;
+    const size_t rounds = 200;
+
+    clients.reserve(clientCount);
+    for (size_t i = 0; i < clientCount; i++) {
+        Client &client = clients.emplace_back();
+        client.cold.client = makeBenchmarkClient(static_cast<int>(i));
+        client.socket = client.cold.client.socket;
+        client.interestMask = i % 3 == 0 ? 0x1 : 0x2;
+        const uint32_t index = table.insert(makeBenchmarkClient(static_cast<int>(i)));
+        table.hot(index).interestMask = i % 3 == 0 ? 0x1 : 0x2;
+    }
+
+    const double aos = measureNsPerOp(clientCount * rounds, [&] {
+        uint64_t sum = 0;
+        for (size_t round = 0; round < rounds; round++)
+            for (const Client &client : clients)
+                if ((client.interestMask & 0x2) != 0 && !(client.flags & CLIENT_FLAG_OUTPUT_PENDING))
+                    sum += client.socket;
+        benchmarkSink = sum;
+    });
+    const double split = measureNsPerOp(clientCount * rounds, [&] {
+        uint64_t sum = 0;
+        for (size_t round = 0; round < rounds; round++)
+            for (const ClientTable::Hot &hot : table.hot())
+                if ((hot.interestMask & 0x2) != 0 && !(hot.flags & CLIENT_FLAG_OUTPUT_PENDING))
+                    sum += hot.socket;
+        benchmarkSink = sum;
+    });
+    std::cout << "broadcast iteration, " << clientCount << " clients (" << sizeof(Client) << " bytes per client in AoS, "
+              << sizeof(ClientTable::Hot) << " hot): " << aos << " ns/client AoS, " << split << " ns/client hot/cold" << std::endl;
+}
+
+/**
+ * Several network threads push packets into the dispatch queue while the game thread drains it,
+ * measuring the cost of each side and the time a packet waits in the queue.
+ */
+static void benchmarkDispatchQueue(const size_t &producerCount)
+{
+    const size_t perProducer = 200000;
+    DispatchQueue queue(65536);
+    std::atomic<bool> go = false;
+    std::atomic<uint64_t> enqueueNs = 0;
+    std::vector<std::thread> producers;
+    std::vector<uint64_t> latencies;
+    latencies.reserve(producerCount * perProducer);
+
+    for (size_t p = 0; p < producerCount; p++) {
+        producers.emplace_back([&] {
+            while (!go);
+            uint64_t spent = 0;
+            for (size_t i = 0; i < perProducer; i++) {
+                const uint64_t start = nowNs();
+                QueuedPacket packet{nullptr, 0, 0, PacketBufferPool::getDefault().acquire(sizeof(uint64_t))};
+                memcpy(packet.data.data(), &start, sizeof(start));
+                while (!queue.tryPush(std::move(packet)))
+                    std::this_thread::yield();
+                spent += nowNs() - start;
+            }
+            enqueueNs += spent;
+        });
+    }
+    go = true;
+    uint64_t dequeueNs = 0;
+    QueuedPacket packet;
+    while (latencies.size() < producerCount * perProducer) {
+        const uint64_t start = nowNs();
+        if (!queue.tryPop(packet))
+            continue;
+        uint64_t pushed;
+        memcpy(&pushed, packet.data.data(), sizeof(pushed));
+        packet.data.reset();
+        const uint64_t end = nowNs();
+        dequeueNs += end - start;
+        latencies.push_back(end - pushed);
+    }
+    for (auto &producer : producers)
+        producer.join();
+    const double operations = static_cast<double>(producerCount * perProducer);
+    std::cout << "dispatch queue, " << producerCount << " producers: "
+              << static_cast<double>(enqueueNs) / operations << " ns/enqueue, "
+              << static_cast<double>(dequeueNs) / operations << " ns/dequeue, latency p50 "
+              << percentile(latencies, 0.5) << " ns, p99 " << percentile(latencies, 0.99) << " ns" << std::endl;
+}
+
+/**
+ * A client sends timestamped datagrams to a UdpManager, measuring the time
+ * from sendto() to the handler, with the receive thread blocking in recvfrom or busy polling.
+ */
+static void benchmarkReceiveLatency(const bool &busyPoll, const unsigned int &port)
+{
+    struct LatencyProbe {
+        uint64_t sentNs;
+    };
+    const size_t sampleCount = 5000;
+    std::vector<uint64_t> latencies(sampleCount);
+    std::atomic<size_t> received = 0;
+
+    UdpManager manager("127.0.0.1", port, nullptr);
+    BusyPollConfig config;
+    config.enabled = busyPoll;
+    manager.setBusyPoll(config);
+    manager.getEventRegistry().registerHandler<LatencyProbe>(1,
+        std::make_shared<std::function<void(LatencyProbe)>>([&](LatencyProbe probe) {
+            const size_t index = received.load(std::memory_order_relaxed);
+            if (index >= sampleCount)
+                return;
+            latencies[index] = nowNs() - probe.sentNs;
+            received.store(index + 1, std::memory_order_release);
+        }));
+    manager.start().wait();
+
+    const int client = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in to{};
+    to.sin_family = AF_INET;
+    to.sin_addr.s_addr = inet_addr("127.0.0.1");
+    to.sin_port = htons(port);
+    DatagramAggregator aggregator;
+    for (size_t i = 0; i < sampleCount; i++) {
+        // Leave the receiver idle between packets, as a game client sending inputs does
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        const LatencyProbe probe{nowNs()};
+        aggregator.enqueue(to, 1, std::span<const std::byte>(reinterpret_cast<const std::byte *>(&probe), sizeof(probe)));
+        aggregator.flush([client](const sockaddr_in &address, std::span<const std::byte> datagram) {
+            sendto(client, datagram.data(), datagram.size(), 0, (const struct sockaddr *) &address, sizeof(address));
+        });
+    }
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (received.load(std::memory_order_acquire) < sampleCount && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    manager.stop();
+    close(client);
+
+    latencies.resize(received.load());
+    std::cout << "receive to handler, " << (busyPoll ? "busy poll" : "blocking") << ": "
+              << latencies.size() << " packets, p50 " << percentile(latencies, 0.5)
+              << " ns, p99 " << percentile(latencies, 0.99) << " ns" << std::endl;
+}
+
+/**
+ * Time from start() to every loop running, and from stop() to every thread joined,
+ * with connected clients that have output waiting.
+ */
+static void benchmarkStartupShutdown(const size_t &clientCount)
+{
+    const unsigned int tcpPort = 47010;
+    NewNetworkManager manager("127.0.0.1", tcpPort, tcpPort + 1);
+
+    auto start = std::chrono::steady_clock::now();
+    manager.start();
+    const double startupMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<int> clients;
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = inet_addr("127.0.0.1");
+    address.sin_port = htons(tcpPort);
+    for (size_t i = 0; i < clientCount; i++) {
+        clients.push_back(socket(AF_INET, SOCK_STREAM, 0));
+        connect(clients.back(), (const struct sockaddr *) &address, sizeof(address));
+    }
+    while (manager.getTcpManager().getClientCount() < clientCount)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    manager.getTcpManager().broadcast(1, std::array<char, 1024>{});
+
+    start = std::chrono::steady_clock::now();
+    manager.stop();
+    const double shutdownMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    for (const int &client : clients)
+        close(client);
+    std::cout << "startup to ready: " << startupMs << " ms, shutdown with " << clientCount
+              << " clients: " << shutdownMs << " ms" << std::endl;
+}
+
+/**
+ * Instructions retired by the calling thread in user space, when the kernel lets us count them.
+ */
+class InstructionCounter {
+    public:
+        InstructionCounter()
+        {
+            perf_event_attr attributes{};
+            attributes.type = PERF_TYPE_HARDWARE;
+            attributes.size = sizeof(attributes);
+            attributes.config = PERF_COUNT_HW_INSTRUCTIONS;
+            attributes.disabled = 1;
+            attributes.exclude_kernel = 1;
+            attributes.exclude_hv = 1;
+            _fd = static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+        }
+
+        ~InstructionCounter()
+        {
+            if (_fd != -1)
+                close(_fd);
+        }
+
+        bool available() const
+        {
+            return _fd != -1;
+        }
+
+        void start()
+        {
+            if (_fd == -1)
+                return;
+            ioctl(_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+
+        uint64_t stop()
+        {
+            uint64_t count = 0;
+            if (_fd == -1)
+                return 0;
+            ioctl(_fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(_fd, &count, sizeof(count)) != sizeof(count))
+                return 0;
+            return count;
+        }
+
+    private:
+        int _fd = -1;
+};
+
+struct MicroResult {
+    std::string name;
+    // Parameters of the case, e.g. {"handlers", 10}
+    std::vector<std::pair<std::string, size_t>> parameters;
+    size_t operations = 0;
+    double nsPerOp = 0;
+    double allocationsPerOp = 0;
+    std::optional<double> instructionsPerOp;
+};
+
+/**
+ * Run a batch of operations several times and keep the fastest run, the slower ones met interrupts
+ * or cold caches. The batch gets the number of the run, to use state prepared for each run.
+ */
+template<typename Function>
+static MicroResult measureMicro(const std::string &name, std::vector<std::pair<std::string, size_t>> parameters,
+                                const size_t &operations, const size_t &runs, const Function &batch)
+{
+    static InstructionCounter instructions;
+    MicroResult result{name, std::move(parameters), operations, 0, 0, std::nullopt};
+    double bestNs = 0;
+
+    for (size_t run = 0; run < runs; run++) {
+        const uint64_t allocations = benchmarkAllocations;
+        instructions.start();
+        const auto start = std::chrono::steady_clock::now();
+        batch(run);
+        const auto end = std::chrono::steady_clock::now();
+        const uint64_t retired = instructions.stop();
+        const double ns = std::chrono::duration<double, std::nano>(end - start).count();
+        if (run == 0 || ns < bestNs) {
+            bestNs = ns;
+            result.allocationsPerOp = static_cast<double>(benchmarkAllocations - allocations) / operations;
+            if (instructions.available())
+                result.instructionsPerOp = static_cast<double>(retired) / operations;
+        }
+    }
+    result.nsPerOp = bestNs / operations;
+    return result;
+}
+
+template<size_t Size>
+struct BenchmarkEvent {
+    std::array<std::byte, Size> bytes{};
+};
+
+/**
+ * Registering handlers, on new ids and on an id that already has handlers.
+ */
+static void benchmarkRegisterHandler(std::vector<MicroResult> &results)
+{
+    const size_t runs = 5;
+    auto handler = std::make_shared<std::function<void(BenchmarkEvent<16>)>>([](BenchmarkEvent<16>) {});
+
+    for (const size_t ids : {1, 100, 10000}) {
+        const size_t perId = ids == 1 ? 100 : 1;
+        std::vector<std::unique_ptr<EventRegistry>> registries;
+        for (size_t run = 0; run < runs; run++)
+            registries.push_back(std::make_unique<EventRegistry>());
+        results.push_back(measureMicro("registerHandler", {{"ids", ids}, {"handlers", perId}}, ids * perId, runs,
+            [&](const size_t &run) {
+                for (size_t id = 0; id < ids; id++)
+                    for (size_t i = 0; i < perId; i++)
+                        registries[run]->registerHandler<BenchmarkEvent<16>>(static_cast<uint32_t>(id), handler);
+            }));
+    }
+}
+
+/**
+ * Dispatching packets by id, as the network threads do, to ids with several handlers each.
+ */
+static void benchmarkTriggerHandler(std::vector<MicroResult> &results)
+{
+    const BenchmarkEvent<16> event{};
+    const std::span<const std::byte> payload(reinterpret_cast<const std::byte *>(&event), sizeof(event));
+
+    for (const size_t handlers : {1, 10, 100}) {
+        for (const size_t ids : {1, 100, 10000}) {
+            EventRegistry registry;
+            uint64_t calls = 0;
+            auto handler = std::make_shared<std::function<void(BenchmarkEvent<16>)>>(
+                [&calls](BenchmarkEvent<16> e) { calls += static_cast<uint64_t>(e.bytes[0]) + 1; });
+            for (size_t id = 0; id < ids; id++)
+                for (size_t i = 0; i < handlers; i++)
+                    registry.registerHandler<BenchmarkEvent<16>>(static_cast<uint32_t>(id), handler);
+            // Ids in a scattered order, as packets of many kinds arrive
+            std::vector<uint32_t> order(4096);
+            uint64_t state = 88172645463325252ull;
+            for (uint32_t &id : order) {
+                state ^= state << 13;
+                state ^= state >> 7;
+                state ^= state << 17;
+                id = static_cast<uint32_t>(state % ids);
+            }
+            const size_t operations = std::max<size_t>(4096, 2000000 / handlers);
+            results.push_back(measureMicro("triggerHandler", {{"handlers", handlers}, {"ids", ids}}, operations, 5,
+                [&](const size_t &) {
+                    for (size_t i = 0; i < operations; i++)
+                        registry.dispatchNow(order[i % order.size()], payload);
+                }));
+            benchmarkSink = calls;
+        }
+    }
+}
+
+template<size_t Size>
+static void benchmarkSerialization(std::vector<MicroResult> &results)
+{
+    EventRegistry registry;
+    BenchmarkEvent<Size> event{};
+    const size_t operations = 200000;
+
+    results.push_back(measureMicro("serializeData", {{"bytes", Size}}, operations, 5, [&](const size_t &) {
+        for (size_t i = 0; i < operations; i++) {
+            event.bytes[0] = static_cast<std::byte>(i);
+            PacketBuffer data = registry.serializeData(event);
+            benchmarkSink = static_cast<uint64_t>(data.data()[0]);
+        }
+    }));
+    PacketBuffer data = registry.serializeData(event);
+    results.push_back(measureMicro("deserializeData", {{"bytes", Size}}, operations, 5, [&](const size_t &) {
+        for (size_t i = 0; i < operations; i++) {
+            data.data()[0] = static_cast<std::byte>(i);
+            const auto decoded = registry.deserializeData<BenchmarkEvent<Size>>(data);
+            benchmarkSink = static_cast<uint64_t>(decoded.bytes[Size - 1]) + static_cast<uint64_t>(decoded.bytes[0]);
+        }
+    }));
+}
+
+static void benchmarkUuid(std::vector<MicroResult> &results)
+{
+    const size_t operations = 100000;
+    results.push_back(measureMicro("generateRandomUuid", {}, operations, 5, [&](const size_t &) {
+        for (size_t i = 0; i < operations; i++)
+            benchmarkSink = generateRandomUuid().size();
+    }));
+}
+
+static std::vector<MicroResult> runMicroBenchmarks()
+{
+    std::vector<MicroResult> results;
+    benchmarkRegisterHandler(results);
+    benchmarkTriggerHandler(results);
+    benchmarkSerialization<8>(results);
+    benchmarkSerialization<64>(results);
+    benchmarkSerialization<512>(results);
+    benchmarkSerialization<4096>(results);
+    benchmarkUuid(results);
+    return results;
+}
+
+static void printMicroResults(const std::vector<MicroResult> &results)
+{
+    for (const MicroResult &result : results) {
+        std::ostringstream line;
+        line << result.name;
+        for (const auto &[key, value] : result.parameters)
+            line << " " << key << "=" << value;
+        line << ": " << result.nsPerOp << " ns/op, " << result.allocationsPerOp << " allocs/op";
+        if (result.instructionsPerOp)
+            line << ", " << *result.instructionsPerOp << " instructions/op";
+        std::cout << line.str() << std::endl;
+    }
+}
+
+static void writeMicroJson(std::ostream &out, const std::vector<MicroResult> &results)
+{
+    out << "{\n  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const MicroResult &result = results[i];
+        out << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << result.name << "\", \"parameters\": {";
+        for (size_t p = 0; p < result.parameters.size(); p++)
+            out << (p == 0 ? "" : ", ") << "\"" << result.parameters[p].first << "\": " << result.parameters[p].second;
+        out << "}, \"operations\": " << result.operations
+            << ", \"ns_per_op\": " << result.nsPerOp
+            << ", \"allocs_per_op\": " << result.allocationsPerOp
+            << ", \"instructions_per_op\": ";
+        if (result.instructionsPerOp)
+            out << *result.instructionsPerOp;
+        else
+            out << "null";
+        out << "}";
+    }
+    out << "\n  ]\n}" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    bool microOnly = false;
+    std::string jsonPath;
+    for (int i = 1; i < argc; i++) {
+        const std::string argument = argv[i];
+        if (argument == "--micro")
+            microOnly = true;
+        else if (argument == "--json" && i + 1 < argc)
+            jsonPath = argv[++i];
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--micro] [--json <file>|-]" << std::endl;
+            return 1;
+        }
+    }
+    // The managers log their start and stop, keep them out of the results
+    NetLogger::get().setLevel(LogLevel::Warn);
+
+    if (!microOnly) {
+        for (const size_t clientCount : {1000, 10000, 100000})
+            benchmarkBroadcastIteration(clientCount);
+        for (const size_t producerCount : {1, 2, 4})
+            benchmarkDispatchQueue(producerCount);
+        benchmarkReceiveLatency(false, 47001);
+        benchmarkReceiveLatency(true, 47002);
+        for (const size_t clientCount : {0, 100})
+            benchmarkStartupShutdown(clientCount);
+    }
+
+    const std::vector<MicroResult> results = runMicroBenchmarks();
+    if (jsonPath != "-")
+        printMicroResults(results);
+    if (jsonPath == "-") {
+        writeMicroJson(std::cout, results);
+    } else if (!jsonPath.empty()) {
+        std::ofstream file(jsonPath);
+        writeMicroJson(file, results);
+    }
+    return 0;
+}
@@ -0,0 +1,751 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <dirent.h>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "./NewNetworkManager.hpp"
+#include "./NetworkManagerClient.hpp"
+
+// Load generator: simulated clients drive an echo server over loopback and measure it.
+//
+//     loadgen --clients 5000 --threads 4 --rate 20 --udp-ratio 0.3 --sizes 32,512 --churn 0.01
+//
+// --mode both (default) runs the echo server in-process, --mode server and --mode client
+// run each side alone so the server can get a process, and its CPUs, to itself.
+// --capture <file> records the traffic the server receives, see replayCapture().
+//
+//     loadgen --mode restart --clients 500 --duration 10
+//
+// runs the echo server in a child process that hands its sockets and clients over to a second one
+// halfway through, see NewNetworkManager::handOff(), and fails if a client was disconnected.
+// The children are this program in --mode server with --hand-off <path> --hand-off-after <s>
+// or --take-over <path>.
+//
+//     loadgen --sweep 1,10,100,1000,10000 --duration 5 --csv sweep.csv
+//
+// runs one load per client count against the same server and prints how throughput, latency
+// and server CPU per message scale, the CSV is there to plot them.
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr uint32_t LOAD_HELLO_ID = 1000;
+// One packet id per message size, the same ids are used over TCP and UDP
+static constexpr uint32_t LOAD_MESSAGE_ID = 1001;
+static constexpr std::array<size_t, 4> LOAD_MESSAGE_SIZES = {32, 128, 512, 1024};
+
+/**
+ * @brief Sent by the server on connect, the socket lets the echo find the client back.
+ */
+struct LoadHello {
+    uint32_t socket;
+};
+
+template<size_t Size>
+struct LoadMessage {
+    uint32_t socket;
+    uint32_t client;
+    uint64_t sentNs;
+    std::array<std::byte, Size - 16> padding;
+};
+
+struct LoadConfig {
+    std::string mode = "both";
+    std::string host = "127.0.0.1";
+    unsigned int tcpPort = 47100;
+    unsigned int udpPort = 47101;
+    size_t clients = 1000;
+    size_t threads = 2;
+    // New connections per second while ramping up, 0 to connect everyone at once
+    double connectRate = 1000;
+    // Messages per second of each client
+    double messageRate = 10;
+    // Part of the messages sent over UDP
+    double udpRatio = 0.2;
+    std::vector<size_t> sizes = {32, 128, 512};
+    // Part of the clients reconnecting every second
+    double churn = 0;
+    std::chrono::seconds duration{10};
+    // Capture file of the received traffic, none if empty
+    std::string capture;
+    // Client counts of a sweep, empty to run the load once
+    std::vector<size_t> sweep;
+    std::string csv;
+    // Server mode: hand the sockets over on this path after handOffAfter, none if empty
+    std::string handOffPath;
+    std::chrono::seconds handOffAfter{0};
+    // Server mode: start from the sockets handed over on this path instead of binding them
+    std::string takeOverPath;
+};
+
+/**
+ * @brief Outcome of one load, a row of a sweep.
+ */
+struct LoadResult {
+    size_t clients = 0;
+    double messagesPerSecond = 0;
+    double bytesPerSecond = 0;
+    uint64_t tcpP50 = 0;
+    uint64_t tcpP99 = 0;
+    uint64_t tcpP999 = 0;
+    uint64_t udpP50 = 0;
+    uint64_t udpP99 = 0;
+    uint64_t udpP999 = 0;
+    // CPU the server threads spent per echoed message, 0 when the server runs in another process
+    double serverCpuNsPerMessage = 0;
+    uint64_t connectAttempts = 0;
+    uint64_t connects = 0;
+    uint64_t disconnects = 0;
+};
+
+/**
+ * @brief Totals at the previous progress line, to print rates.
+ */
+struct LoadProgress {
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    uint64_t bytesReceived = 0;
+};
+
+struct LoadCounters {
+    std::atomic<uint64_t> connectAttempts = 0;
+    std::atomic<uint64_t> connects = 0;
+    std::atomic<int64_t> connected = 0;
+    std::atomic<uint64_t> disconnects = 0;
+    std::atomic<uint64_t> tcpSent = 0;
+    std::atomic<uint64_t> udpSent = 0;
+    std::atomic<uint64_t> tcpReceived = 0;
+    std::atomic<uint64_t> udpReceived = 0;
+    std::atomic<uint64_t> bytesSent = 0;
+    std::atomic<uint64_t> bytesReceived = 0;
+};
+
+/**
+ * @brief A simulated client, everything but the counters is only used from its loop thread.
+ */
+struct SimulatedClient {
+    uint32_t index = 0;
+    std::unique_ptr<NetworkManagerClient> network;
+    uint32_t serverSocket = 0;
+    EventLoop::TimerId timer = TimerWheel::InvalidTimer;
+    Clock::time_point connectStart;
+    std::mt19937 random;
+    bool stopping = false;
+    std::vector<uint64_t> connectNs;
+    std::vector<uint64_t> tcpRttNs;
+    std::vector<uint64_t> udpRttNs;
+};
+
+static uint64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+static uint64_t percentile(std::vector<uint64_t> &values, const double &ratio)
+{
+    if (values.empty())
+        return 0;
+    const auto rank = static_cast<size_t>(ratio * static_cast<double>(values.size() - 1));
+    std::nth_element(values.begin(), values.begin() + rank, values.end());
+    return values[rank];
+}
+
+static std::vector<size_t> parseList(const std::string &list)
+{
+    std::vector<size_t> values;
+    std::stringstream stream(list);
+    std::string item;
+
+    while (std::getline(stream, item, ','))
+        values.push_back(std::stoul(item));
+    return values;
+}
+
+/**
+ * @brief CPU time of the server threads of this process, the ones NewNetworkManager names net-*.
+ */
+static uint64_t serverCpuNs()
+{
+    uint64_t total = 0;
+    DIR *tasks = opendir("/proc/self/task");
+    if (tasks == nullptr)
+        return 0;
+    while (const dirent *task = readdir(tasks)) {
+        if (task->d_name[0] == '.')
+            continue;
+        const std::string path = std::string("/proc/self/task/") + task->d_name;
+        std::string name;
+        std::ifstream(path + "/comm") >> name;
+        if (name.rfind("net-", 0) != 0)
+            continue;
+        // Nanoseconds spent on a CPU, more precise than the clock ticks of stat
+        uint64_t runNs = 0;
+        std::ifstream(path + "/schedstat") >> runNs;
+        total += runNs;
+    }
+    closedir(tasks);
+    return total;
+}
+
+static std::vector<size_t> parseSizes(const std::string &list)
+{
+    std::vector<size_t> sizes;
+    std::stringstream stream(list);
+    std::string item;
+
+    while (std::getline(stream, item, ',')) {
+        const size_t size = std::stoul(item);
+        if (std::find(LOAD_MESSAGE_SIZES.begin(), LOAD_MESSAGE_SIZES.end(), size) == LOAD_MESSAGE_SIZES.end())
+            throw std::runtime_error("Unsupported message size " + item + ", use 32, 128, 512 or 1024");
+        sizes.push_back(size);
+    }
+    if (sizes.empty())
+        throw std::runtime_error("No message size given");
+    return sizes;
+}
+
+static LoadConfig parseArguments(const int argc, char **argv)
+{
+    LoadConfig config;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const std::string key = argv[i];
+        const std::string value = argv[i + 1];
+        if (key == "--mode")
+            config.mode = value;
+        else if (key == "--host")
+            config.host = value;
+        else if (key == "--tcp-port")
+            config.tcpPort = std::stoul(value);
+        else if (key == "--udp-port")
+            config.udpPort = std::stoul(value);
+        else if (key == "--clients")
+            config.clients = std::stoul(value);
+        else if (key == "--threads")
+            config.threads = std::stoul(value);
+        else if (key == "--connect-rate")
+            config.connectRate = std::stod(value);
+        else if (key == "--rate")
+            config.messageRate = std::stod(value);
+        else if (key == "--udp-ratio")
+            config.udpRatio = std::stod(value);
+        else if (key == "--sizes")
+            config.sizes = parseSizes(value);
+        else if (key == "--churn")
+            config.churn = std::stod(value);
+        else if (key == "--duration")
+            config.duration = std::chrono::seconds(std::stoul(value));
+        else if (key == "--capture")
+            config.capture = value;
+        else if (key == "--sweep")
+            config.sweep = parseList(value);
+        else if (key == "--csv")
+            config.csv = value;
+        else if (key == "--hand-off")
+            config.handOffPath = value;
+        else if (key == "--hand-off-after")
+            config.handOffAfter = std::chrono::seconds(std::stoul(value));
+        else if (key == "--take-over")
+            config.takeOverPath = value;
+        else
+            throw std::runtime_error("Unknown option " + key);
+    }
+    if (config.mode != "both" && config.mode != "server" && config.mode != "client" && config.mode != "restart")
+        throw std::runtime_error("--mode must be both, server, client or restart");
+    // Churn disconnects on purpose, the restart check counts every disconnect as lost
+    if (config.mode == "restart" && (config.churn > 0 || !config.sweep.empty()))
+        throw std::runtime_error("--mode restart runs one load without churn");
+    return config;
+}
+
+template<size_t Index = 0>
+static void registerEcho(NewNetworkManager &server)
+{
+    if constexpr (Index < LOAD_MESSAGE_SIZES.size()) {
+        using Message = LoadMessage<LOAD_MESSAGE_SIZES[Index]>;
+        constexpr uint32_t packetId = LOAD_MESSAGE_ID + Index;
+        TcpManager *tcp = &server.getTcpManager();
+        UdpManager *udp = &server.getUdpManager();
+
+        tcp->getEventRegistry().registerHandler<Message>(packetId, std::make_shared<std::function<void(Message)>>(
+            [tcp](Message message) {
+                tcp->sendEvent(static_cast<int>(message.socket), packetId, message);
+            }));
+        udp->getEventRegistry().registerHandler<Message>(packetId, std::make_shared<std::function<void(Message)>>(
+            [tcp, udp](Message message) {
+                sockaddr_in address{};
+                if (!tcp->getUdpAddress(static_cast<int>(message.socket), address))
+                    return;
+                udp->send(address, packetId, message);
+                udp->flush();
+            }));
+        registerEcho<Index + 1>(server);
+    }
+}
+
+template<size_t Index = 0>
+static void registerReceivers(SimulatedClient &client, LoadCounters &counters)
+{
+    if constexpr (Index < LOAD_MESSAGE_SIZES.size()) {
+        using Message = LoadMessage<LOAD_MESSAGE_SIZES[Index]>;
+
+        // The echo comes back on the transport it was sent on, the top bit of the client field tells which
+        client.network->getEventRegistry().registerHandler<Message>(LOAD_MESSAGE_ID + Index,
+            std::make_shared<std::function<void(Message)>>([&client, &counters](Message message) {
+                const uint64_t rtt = nowNs() - message.sentNs;
+                if (message.client & 0x80000000u) {
+                    client.udpRttNs.push_back(rtt);
+                    counters.udpReceived.fetch_add(1, std::memory_order_relaxed);
+                } else {
+                    client.tcpRttNs.push_back(rtt);
+                    counters.tcpReceived.fetch_add(1, std::memory_order_relaxed);
+                }
+                counters.bytesReceived.fetch_add(sizeof(Message), std::memory_order_relaxed);
+            }));
+        registerReceivers<Index + 1>(client, counters);
+    }
+}
+
+template<size_t Index = 0>
+static void sendMessage(SimulatedClient &client, const size_t &size, const bool &udp, LoadCounters &counters)
+{
+    if constexpr (Index < LOAD_MESSAGE_SIZES.size()) {
+        if (LOAD_MESSAGE_SIZES[Index] != size)
+            return sendMessage<Index + 1>(client, size, udp, counters);
+        using Message = LoadMessage<LOAD_MESSAGE_SIZES[Index]>;
+        Message message{};
+        message.socket = client.serverSocket;
+        message.client = client.index | (udp ? 0x80000000u : 0);
+        message.sentNs = nowNs();
+        if (udp) {
+            client.network->sendUdp(LOAD_MESSAGE_ID + Index, message);
+            client.network->flushUdp();
+            counters.udpSent.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            if (client.network->send(LOAD_MESSAGE_ID + Index, message) < 0)
+                return;
+            counters.tcpSent.fetch_add(1, std::memory_order_relaxed);
+        }
+        counters.bytesSent.fetch_add(sizeof(Message), std::memory_order_relaxed);
+    }
+}
+
+class LoadGenerator {
+    public:
+        LoadGenerator(const LoadConfig &config) : _config(config), _group(config.threads, {"loadgen"})
+        {
+
+        }
+
+        /**
+         * @brief Run the load for the configured duration.
+         * @param progress Print a line every second, then the summary.
+         */
+        LoadResult run(std::ostream &report, const bool &progress = true)
+        {
+            const uint64_t cpuStart = serverCpuNs();
+            const Clock::time_point start = Clock::now();
+            const Clock::time_point end = start + _config.duration;
+            Clock::time_point nextReport = start + std::chrono::seconds(1);
+            LoadProgress previous;
+
+            _clients.reserve(_config.clients);
+            while (Clock::now() < end) {
+                // Ramp the connections up at the configured rate
+                const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+                const size_t target = _config.connectRate <= 0 ? _config.clients
+                    : std::min(_config.clients, static_cast<size_t>(elapsed * _config.connectRate) + 1);
+                while (_clients.size() < target)
+                    addClient();
+                if (progress && Clock::now() >= nextReport) {
+                    printProgress(report, std::chrono::duration<double>(Clock::now() - start).count(), previous);
+                    nextReport += std::chrono::seconds(1);
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+            const uint64_t cpuNs = serverCpuNs() - cpuStart;
+            stopClients();
+            LoadResult result = summarize(elapsed, cpuNs);
+            if (progress)
+                printSummary(report, elapsed, result);
+            return result;
+        }
+
+    private:
+        void addClient()
+        {
+            auto client = std::make_unique<SimulatedClient>();
+            SimulatedClient &simulated = *client;
+            simulated.index = static_cast<uint32_t>(_clients.size());
+            simulated.random.seed(simulated.index);
+            simulated.network = std::make_unique<NetworkManagerClient>(_config.host, _config.tcpPort, _config.udpPort, _group);
+
+            // Sent again by a server taking over, the socket changes but the client keeps ticking
+            simulated.network->getEventRegistry().registerHandler<LoadHello>(LOAD_HELLO_ID,
+                std::make_shared<std::function<void(LoadHello)>>([this, &simulated](LoadHello hello) {
+                    simulated.serverSocket = hello.socket;
+                    if (simulated.timer == TimerWheel::InvalidTimer)
+                        scheduleTick(simulated);
+                }));
+            registerReceivers(simulated, _counters);
+            simulated.network->setOnConnectEvent([this, &simulated] {
+                simulated.connectNs.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    Clock::now() - simulated.connectStart).count());
+                _counters.connects.fetch_add(1, std::memory_order_relaxed);
+                _counters.connected.fetch_add(1, std::memory_order_relaxed);
+            });
+            simulated.network->setOnDisconnectEvent([this, &simulated] {
+                simulated.serverSocket = 0;
+                simulated.network->getEventLoop().cancel(simulated.timer);
+                simulated.timer = TimerWheel::InvalidTimer;
+                _counters.connected.fetch_sub(1, std::memory_order_relaxed);
+                _counters.disconnects.fetch_add(1, std::memory_order_relaxed);
+            });
+            _clients.push_back(std::move(client));
+            // Connect from the loop thread, the client is then only touched from there
+            simulated.network->getEventLoop().post([this, &simulated] { connect(simulated); });
+        }
+
+        void connect(SimulatedClient &client)
+        {
+            client.connectStart = Clock::now();
+            _counters.connectAttempts.fetch_add(1, std::memory_order_relaxed);
+            client.network->connect();
+        }
+
+        void scheduleTick(SimulatedClient &client)
+        {
+            if (_config.messageRate <= 0 || client.stopping)
+                return;
+            // Exponential gaps, the clients do not send in lockstep
+            std::exponential_distribution<double> gap(_config.messageRate);
+            const auto delay = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(gap(client.random)));
+            client.timer = client.network->getEventLoop().schedule(Clock::now() + delay, [this, &client] { tick(client); });
+        }
+
+        void tick(SimulatedClient &client)
+        {
+            std::uniform_real_distribution<double> unit(0, 1);
+            const double churnPerMessage = _config.churn / std::max(_config.messageRate, 1e-9);
+
+            client.timer = TimerWheel::InvalidTimer;
+            if (_config.churn > 0 && unit(client.random) < churnPerMessage) {
+                client.network->disconnect();
+                connect(client);
+                return;
+            }
+            const size_t size = _config.sizes[client.random() % _config.sizes.size()];
+            sendMessage(client, size, unit(client.random) < _config.udpRatio, _counters);
+            scheduleTick(client);
+        }
+
+        void stopClients()
+        {
+            std::vector<std::future<void>> stopped;
+
+            // Stop the traffic first, a tick must not run once its client is destroyed
+            for (auto &client : _clients) {
+                SimulatedClient *simulated = client.get();
+                NetworkManagerClient *network = client->network.get();
+                auto done = std::make_shared<std::promise<void>>();
+                stopped.push_back(done->get_future());
+                network->getEventLoop().post([simulated, network, done] {
+                    simulated->stopping = true;
+                    network->getEventLoop().cancel(simulated->timer);
+                    network->setOnDisconnectEvent(nullptr);
+                    done->set_value();
+                });
+            }
+            for (auto &future : stopped)
+                future.wait();
+            for (auto &client : _clients)
+                client->network.reset();
+        }
+
+        void printProgress(std::ostream &report, const double &elapsed, LoadProgress &previous)
+        {
+            const uint64_t sent = _counters.tcpSent + _counters.udpSent;
+            const uint64_t received = _counters.tcpReceived + _counters.udpReceived;
+            const uint64_t bytes = _counters.bytesReceived;
+            char line[256];
+
+            snprintf(line, sizeof(line), "%6.1fs  clients %6ld  sent %9lu msg/s  received %9lu msg/s  %8.2f MB/s",
+                     elapsed, static_cast<long>(_counters.connected.load()),
+                     static_cast<unsigned long>(sent - previous.sent),
+                     static_cast<unsigned long>(received - previous.received),
+                     static_cast<double>(bytes - previous.bytesReceived) / 1e6);
+            report << line << std::endl;
+            previous.sent = sent;
+            previous.received = received;
+            previous.bytesReceived = bytes;
+        }
+
+        static void printLatency(std::ostream &report, const std::string &name, std::vector<uint64_t> &values)
+        {
+            char line[256];
+
+            snprintf(line, sizeof(line), "%-8s samples %9zu  p50 %8.1f us  p90 %8.1f us  p99 %8.1f us  p999 %8.1f us  max %8.1f us",
+                     name.c_str(), values.size(), percentile(values, 0.5) / 1e3, percentile(values, 0.9) / 1e3,
+                     percentile(values, 0.99) / 1e3, percentile(values, 0.999) / 1e3, percentile(values, 1.0) / 1e3);
+            report << line << std::endl;
+        }
+
+        LoadResult summarize(const double &elapsed, const uint64_t &cpuNs)
+        {
+            LoadResult result;
+            const uint64_t received = _counters.tcpReceived + _counters.udpReceived;
+
+            for (auto &client : _clients) {
+                _connectNs.insert(_connectNs.end(), client->connectNs.begin(), client->connectNs.end());
+                _tcpRttNs.insert(_tcpRttNs.end(), client->tcpRttNs.begin(), client->tcpRttNs.end());
+                _udpRttNs.insert(_udpRttNs.end(), client->udpRttNs.begin(), client->udpRttNs.end());
+            }
+            result.clients = _config.clients;
+            result.messagesPerSecond = received / elapsed;
+            result.bytesPerSecond = _counters.bytesReceived / elapsed;
+            result.tcpP50 = percentile(_tcpRttNs, 0.5);
+            result.tcpP99 = percentile(_tcpRttNs, 0.99);
+            result.tcpP999 = percentile(_tcpRttNs, 0.999);
+            result.udpP50 = percentile(_udpRttNs, 0.5);
+            result.udpP99 = percentile(_udpRttNs, 0.99);
+            result.udpP999 = percentile(_udpRttNs, 0.999);
+            result.serverCpuNsPerMessage = received == 0 ? 0 : static_cast<double>(cpuNs) / received;
+            result.connectAttempts = _counters.connectAttempts;
+            result.connects = _counters.connects;
+            result.disconnects = _counters.disconnects;
+            return result;
+        }
+
+        void printSummary(std::ostream &report, const double &elapsed, const LoadResult &result)
+        {
+            report << "Connections: " << _counters.connects << " established out of " << _counters.connectAttempts
+                   << " attempts, " << _counters.disconnects << " disconnected" << std::endl;
+            report << "Messages: TCP " << _counters.tcpReceived << "/" << _counters.tcpSent << " echoed, UDP "
+                   << _counters.udpReceived << "/" << _counters.udpSent << " echoed" << std::endl;
+            report << "Throughput: " << static_cast<uint64_t>(result.messagesPerSecond) << " msg/s, "
+                   << result.bytesPerSecond / 1e6 << " MB/s echoed over " << elapsed << "s" << std::endl;
+            if (result.serverCpuNsPerMessage > 0)
+                report << "Server CPU: " << result.serverCpuNsPerMessage / 1e3 << " us/msg, "
+                       << result.serverCpuNsPerMessage * result.messagesPerSecond / 1e7 << "% of a core" << std::endl;
+            printLatency(report, "connect", _connectNs);
+            printLatency(report, "tcp rtt", _tcpRttNs);
+            printLatency(report, "udp rtt", _udpRttNs);
+        }
+
+    private:
+        LoadConfig _config;
+        LoadCounters _counters;
+        NetworkClientGroup _group;
+        std::vector<std::unique_ptr<SimulatedClient>> _clients;
+        std::vector<uint64_t> _connectNs;
+        std::vector<uint64_t> _tcpRttNs;
+        std::vector<uint64_t> _udpRttNs;
+};
+
+/**
+ * @brief Run one load per client count of the sweep, against the same server.
+ */
+static void runSweep(const LoadConfig &config, std::ostream &report)
+{
+    std::unique_ptr<std::ofstream> csv;
+    char line[256];
+
+    if (!config.csv.empty()) {
+        csv = std::make_unique<std::ofstream>(config.csv);
+        *csv << "clients,msg_per_s,bytes_per_s,tcp_p50_us,tcp_p99_us,tcp_p999_us,udp_p50_us,udp_p99_us,udp_p999_us,"
+                "server_cpu_us_per_msg" << std::endl;
+    }
+    report << " clients       msg/s      MB/s  tcp p50/p99/p999 us        udp p50/p99/p999 us        cpu us/msg" << std::endl;
+    for (const size_t clients : config.sweep) {
+        LoadConfig step = config;
+        step.clients = clients;
+        LoadResult result = LoadGenerator(step).run(report, false);
+        snprintf(line, sizeof(line), "%8zu %11.0f %9.2f  %7.1f %7.1f %8.1f  %7.1f %7.1f %8.1f  %9.2f",
+                 clients, result.messagesPerSecond, result.bytesPerSecond / 1e6,
+                 result.tcpP50 / 1e3, result.tcpP99 / 1e3, result.tcpP999 / 1e3,
+                 result.udpP50 / 1e3, result.udpP99 / 1e3, result.udpP999 / 1e3, result.serverCpuNsPerMessage / 1e3);
+        report << line << std::endl;
+        if (csv)
+            *csv << clients << "," << result.messagesPerSecond << "," << result.bytesPerSecond << ","
+                 << result.tcpP50 / 1e3 << "," << result.tcpP99 / 1e3 << "," << result.tcpP999 / 1e3 << ","
+                 << result.udpP50 / 1e3 << "," << result.udpP99 / 1e3 << "," << result.udpP999 / 1e3 << ","
+                 << result.serverCpuNsPerMessage / 1e3 << std::endl;
+    }
+}
+
+/**
+ * @brief Allow as many sockets as the hard limit, each client takes two and three more in-process.
+ */
+static void raiseFileLimit(const LoadConfig &config, std::ostream &report)
+{
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+        return;
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    size_t clients = config.clients;
+    for (const size_t count : config.sweep)
+        clients = std::max(clients, count);
+    const size_t needed = clients * (config.mode == "both" ? 3 : 2) + 64;
+    if (limit.rlim_cur < needed)
+        report << "Warning: " << limit.rlim_cur << " file descriptors allowed, " << needed
+               << " needed, run the server and the clients in separate processes" << std::endl;
+}
+
+/**
+ * @brief Echo the messages and greet every client, the ones handed over by a previous process included.
+ */
+static void configureEcho(NewNetworkManager &server)
+{
+    registerEcho(server);
+    TcpManager &tcp = server.getTcpManager();
+    tcp.setOnClientConnectEvent([&tcp](const NetClient &client) {
+        tcp.sendEvent(client.socket, LOAD_HELLO_ID, LoadHello{static_cast<uint32_t>(client.socket)});
+    });
+}
+
+/**
+ * @brief Run this program again in --mode server with the connection options of the config.
+ */
+static pid_t spawnServer(const LoadConfig &config, const char *program, const std::vector<std::string> &options)
+{
+    std::vector<std::string> arguments = {program, "--mode", "server", "--host", config.host,
+                                          "--tcp-port", std::to_string(config.tcpPort),
+                                          "--udp-port", std::to_string(config.udpPort),
+                                          "--duration", std::to_string(config.duration.count())};
+    arguments.insert(arguments.end(), options.begin(), options.end());
+    std::vector<char *> argv;
+    for (std::string &argument : arguments)
+        argv.push_back(argument.data());
+    argv.push_back(nullptr);
+    pid_t pid = 0;
+    if (posix_spawn(&pid, "/proc/self/exe", nullptr, nullptr, argv.data(), environ) != 0)
+        throw std::runtime_error("Failed to start the server process");
+    return pid;
+}
+
+/**
+ * @brief Wait until a server accepts TCP connections on the port of the config.
+ */
+static bool waitForServer(const LoadConfig &config, const std::chrono::seconds &timeout)
+{
+    const Clock::time_point deadline = Clock::now() + timeout;
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(config.tcpPort);
+    inet_pton(AF_INET, config.host.c_str(), &address.sin_addr);
+
+    while (Clock::now() < deadline) {
+        const int probe = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        const bool listening = connect(probe, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == 0;
+        close(probe);
+        if (listening)
+            return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+/**
+ * @brief Drive the clients while the server restarts through a socket handoff, see --mode restart.
+ * @return true if no client was disconnected and both server processes did their part.
+ */
+static bool runRestart(const LoadConfig &config, const char *program, std::ostream &report)
+{
+    const std::string path = "/tmp/loadgen-" + std::to_string(getpid()) + ".sock";
+    const auto handOffAfter = config.handOffAfter.count() > 0 ? config.handOffAfter
+                              : std::max(config.duration / 2, std::chrono::seconds(1));
+
+    const pid_t previous = spawnServer(config, program, {"--hand-off", path,
+                                                         "--hand-off-after", std::to_string(handOffAfter.count())});
+    if (!waitForServer(config, std::chrono::seconds(10))) {
+        kill(previous, SIGKILL);
+        waitpid(previous, nullptr, 0);
+        throw std::runtime_error("The server process did not start");
+    }
+    // Waits on the path until the first one hands over
+    const pid_t next = spawnServer(config, program, {"--take-over", path});
+    report << "Running " << config.clients << " clients on " << config.threads << " threads for "
+           << config.duration.count() << "s, the server restarts after " << handOffAfter.count() << "s" << std::endl;
+    const LoadResult result = LoadGenerator(config).run(report);
+
+    int previousStatus = 0;
+    waitpid(previous, &previousStatus, 0);
+    // The clients are gone, the second server has nothing left to serve
+    kill(next, SIGTERM);
+    waitpid(next, nullptr, 0);
+    unlink(path.c_str());
+
+    const bool handedOver = WIFEXITED(previousStatus) && WEXITSTATUS(previousStatus) == 0;
+    const bool passed = handedOver && result.disconnects == 0 && result.connects == result.connectAttempts;
+    report << "Restart " << (passed ? "passed" : "failed") << ": " << (handedOver ? "handed over" : "handoff failed")
+           << ", " << result.connects << "/" << result.connectAttempts << " connected, "
+           << result.disconnects << " disconnected" << std::endl;
+    return passed;
+}
+
+int main(int argc, char **argv) {
+    const LoadConfig config = parseArguments(argc, argv);
+    // Only the warnings of the managers, keep the console for the report
+    NetLogger::get().setLevel(LogLevel::Warn);
+    std::ostream &report = std::cout;
+    std::unique_ptr<NewNetworkManager> server;
+
+    raiseFileLimit(config, report);
+
+    if (config.mode == "restart")
+        return runRestart(config, argv[0], report) ? 0 : 1;
+    if (config.mode != "client") {
+        server = std::make_unique<NewNetworkManager>(config.host, config.tcpPort, config.udpPort);
+        if (!config.takeOverPath.empty()) {
+            // The previous process may only hand over once its run is halfway through
+            server->startFromHandoff(config.takeOverPath, configureEcho, config.duration + std::chrono::seconds(10));
+        } else {
+            server->start();
+            // No client can connect before the first run of the loops, the handlers are in place by then
+            configureEcho(*server);
+        }
+        if (!config.capture.empty())
+            server->getCapture().start(config.capture);
+        report << "Echo server listening on " << config.host << ":" << config.tcpPort << " (TCP), "
+               << config.udpPort << " (UDP)" << std::endl;
+    }
+    if (config.mode == "server") {
+        if (!config.handOffPath.empty()) {
+            std::this_thread::sleep_for(config.handOffAfter);
+            server->handOff(config.handOffPath);
+            report << "Echo server handed over its sockets on " << config.handOffPath << std::endl;
+        } else {
+            std::this_thread::sleep_for(config.duration);
+        }
+    } else if (!config.sweep.empty()) {
+        runSweep(config, report);
+    } else {
+        report << "Running " << config.clients << " clients on " << config.threads << " threads for "
+               << config.duration.count() << "s" << std::endl;
+        LoadGenerator generator(config);
+        generator.run(report);
+    }
+    if (server) {
+        server->getCapture().stop();
+        if (!config.capture.empty())
+            report << "Captured " << server->getCapture().getPackets() << " packets into " << config.capture
+                   << " (" << server->getCapture().getDropped() << " dropped)" << std::endl;
+        server->stop();
+    }
+    return 0;
+}
@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "./StatsSegment.hpp"
+
+// Live stats of a server exporting them, see StatsExportConfig. Reads the shared memory segment
+// of the server, so it can run at any rate without slowing the server down.
+//
+//     netstat --port 47100 --interval 1000 --top 20
+//
+// --name reads a segment by its name instead of the TCP port of the server, --interval 0 prints once.
+
+struct NetstatConfig {
+    std::string name;
+    unsigned int port = 4242;
+    std::chrono::milliseconds interval{1000};
+    size_t top = 20;
+};
+
+static NetstatConfig parseArguments(const int argc, char **argv)
+{
+    NetstatConfig config;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const std::string key = argv[i];
+        const std::string value = argv[i + 1];
+        if (key == "--name")
+            config.name = value;
+        else if (key == "--port")
+            config.port = std::stoul(value);
+        else if (key == "--interval")
+            config.interval = std::chrono::milliseconds(std::stoul(value));
+        else if (key == "--top")
+            config.top = std::stoul(value);
+        else
+            throw std::runtime_error("Unknown option " + key);
+    }
+    if (config.name.empty())
+        config.name = "/net-stats-" + std::to_string(config.port);
+    return config;
+}
+
+static HistogramSnapshot histogramOf(const uint64_t (&buckets)[LatencyHistogram::BucketCount])
+{
+    HistogramSnapshot histogram;
+
+    histogram.buckets.assign(std::begin(buckets), std::end(buckets));
+    for (const uint64_t &bucket : histogram.buckets)
+        histogram.count += bucket;
+    return histogram;
+}
+
+static void printLatency(std::ostream &report, const char *name, const HistogramSnapshot &histogram)
+{
+    char line[256];
+
+    snprintf(line, sizeof(line), "%-16s samples %10lu  p50 %9.1f us  p99 %9.1f us  p999 %9.1f us  max %9.1f us",
+             name, static_cast<unsigned long>(histogram.count), histogram.percentile(0.5) / 1e3,
+             histogram.percentile(0.99) / 1e3, histogram.percentile(0.999) / 1e3, histogram.percentile(1) / 1e3);
+    report << line << std::endl;
+}
+
+static void printStats(std::ostream &report, const StatsSegmentHeader &header, const ServerStats &server,
+                       std::vector<PacketStats> &packets, const size_t &top)
+{
+    const uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    char line[256];
+
+    snprintf(line, sizeof(line), "Server pid %lu, up %.1fs, published %.1fs ago",
+             static_cast<unsigned long>(header.pid), (server.publishedNs - server.startedNs) / 1e9,
+             now > server.publishedNs ? (now - server.publishedNs) / 1e9 : 0.0);
+    report << line << std::endl;
+    snprintf(line, sizeof(line), "Clients %lu  dispatch queue %lu/%lu  executor %lu pending on %lu threads",
+             static_cast<unsigned long>(server.tcpClients), static_cast<unsigned long>(server.dispatchQueueDepth),
+             static_cast<unsigned long>(server.dispatchQueueCapacity), static_cast<unsigned long>(server.executorPending),
+             static_cast<unsigned long>(server.executorThreads));
+    report << line << std::endl;
+    snprintf(line, sizeof(line), "Buffers %lu in use, high water %lu, %lu hits, %lu misses  kernel drops %lu  untracked %lu",
+             static_cast<unsigned long>(server.poolInUse), static_cast<unsigned long>(server.poolHighWaterMark),
+             static_cast<unsigned long>(server.poolHits), static_cast<unsigned long>(server.poolMisses),
+             static_cast<unsigned long>(server.kernelDropsUdp), static_cast<unsigned long>(server.untrackedPackets));
+    report << line << std::endl;
+    printLatency(report, "decode", histogramOf(server.decode));
+    printLatency(report, "handler", histogramOf(server.handler));
+    printLatency(report, "kernel->handler", histogramOf(server.kernelToHandler));
+
+    std::sort(packets.begin(), packets.end(), [](const PacketStats &a, const PacketStats &b) {
+        return a.receivedPerSecond + a.sentPerSecond > b.receivedPerSecond + b.sentPerSecond;
+    });
+    report << "proto         id     recv/s     sent/s        recv        sent  handler p50/p99 us  kernel p50/p99 us" << std::endl;
+    for (size_t i = 0; i < std::min(top, packets.size()); i++) {
+        const PacketStats &packet = packets[i];
+        snprintf(line, sizeof(line), "%-5s %10u %10.0f %10.0f %11lu %11lu  %8.1f %9.1f  %8.1f %8.1f",
+                 packet.transport == static_cast<uint8_t>(NetTransport::Tcp) ? "tcp" : "udp", packet.packetId,
+                 packet.receivedPerSecond, packet.sentPerSecond, static_cast<unsigned long>(packet.received),
+                 static_cast<unsigned long>(packet.sent), packet.handler.p50 / 1e3, packet.handler.p99 / 1e3,
+                 packet.kernelToHandler.p50 / 1e3, packet.kernelToHandler.p99 / 1e3);
+        report << line << std::endl;
+    }
+}
+
+int main(int argc, char **argv) {
+    const NetstatConfig config = parseArguments(argc, argv);
+    std::ostream &report = std::cout;
+    ServerStats server;
+    std::vector<PacketStats> packets;
+
+    while (true) {
+        try {
+            // Opened again every time, a restarted server creates a new segment
+            StatsSegmentReader reader(config.name);
+            if (!reader.read(server, packets)) {
+                std::cerr << "No complete stats in " << config.name << " yet" << std::endl;
+            } else {
+                printStats(report, reader.getHeader(), server, packets, config.top);
+            }
+        } catch (const std::runtime_error &error) {
+            // Not started yet, or restarting: try again at the next interval
+            std::cerr << "Server not running: " << error.what() << std::endl;
+        }
+        if (config.interval.count() == 0)
+            break;
+        report << std::endl;
+        std::this_thread::sleep_for(config.interval);
+    }
+    return 0;
+}
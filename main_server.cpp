@@ -13,7 +13,7 @@ int main() {
     sleep(100);
 
     std::cout << "Stopping TCP server..." << std::endl;
-    //tcpManager.stop();
+    tcpManager.stop();
 
     return 0;
 }
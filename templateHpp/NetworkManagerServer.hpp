@@ -18,16 +18,4 @@ class NetworkManagerServer {
 
     private:
         void dataReceived(const unsigned int packetId, const std::vector<std::byte> &data);
-};
-
-class NetworkManagerClient {
-    public:
-        NetworkManagerClient(std::string host, unsigned int port);
-
-    public:
-        template<typename EvenType>
-        send(const EvenType &event);
-
-    private:
-        void dataReceived(const unsigned int packetId, const std::vector<std::byte> &data);
-};
+};
\ No newline at end of file